@@ -4,6 +4,7 @@
 #include <boost/shared_ptr.hpp>
 #include <camera_constants.h>
 #include <simulation_io.hpp>
+#include <depth_codec.h>
 
 // For OpenCV
 #include <opencv2/core/core.hpp>
@@ -22,15 +23,7 @@ SimExample::Ptr simexample;
 pcl::simulation::Scene::Ptr scene_;
 
 static void writeDepthImage(cv::Mat &depthImg, std::string path){
-    cv::Mat depthImgRaw = cv::Mat::zeros(depthImg.rows, depthImg.cols, CV_16UC1);
-    for(int u=0; u<depthImg.rows; u++)
-      for(int v=0; v<depthImg.cols; v++){
-        float depth = depthImg.at<float>(u,v)*10000;
-        unsigned short depthShort = (unsigned short)depth;
-        depthShort = (depthShort << 3 | depthShort >> 13);
-        depthImgRaw.at<unsigned short>(u, v) = depthShort;
-      }
-    cv::imwrite(path, depthImgRaw);
+    depth_codec::writeImage(path, depthImg, true);
 }
 
 void clearScene(){
@@ -0,0 +1,77 @@
+// Flat adjacency of a set of model pairs (first -> second), used by the tetrahedron
+// matching of the volumetric 4PCS mode (Match4PCSBase::FindCongruentQuadrilateralsV4PCS).
+// The neighbours of every vertex are stored sorted and without duplicates in one array,
+// so that they are listed with two offsets and a pair is tested with a binary search.
+
+#ifndef PAIR_ADJACENCY_H
+#define PAIR_ADJACENCY_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace Super4PCS{
+
+class PairAdjacency
+{
+public:
+    typedef std::vector<std::pair<int, int> > PairsVector;
+
+    PairAdjacency() {}
+
+    void build(const PairsVector& pairs) {
+        int numVertices = 0;
+        for (const auto& pair : pairs)
+            numVertices = std::max(numVertices, pair.first + 1);
+
+        offsets_.assign(numVertices + 1, 0);
+        for (const auto& pair : pairs)
+            ++offsets_[pair.first + 1];
+        for (int v = 0; v < numVertices; ++v)
+            offsets_[v + 1] += offsets_[v];
+
+        neighbors_.resize(pairs.size());
+        std::vector<int> fill(offsets_.begin(), offsets_.end() - 1);
+        for (const auto& pair : pairs)
+            neighbors_[fill[pair.first]++] = pair.second;
+
+        // sort and compact every row in place
+        int end = 0;
+        for (int v = 0; v < numVertices; ++v) {
+            int* first = &neighbors_[0] + offsets_[v];
+            int* last = &neighbors_[0] + offsets_[v + 1];
+            std::sort(first, last);
+            last = std::unique(first, last);
+            offsets_[v] = end;
+            end = std::copy(first, last, neighbors_.begin() + end) - neighbors_.begin();
+        }
+        offsets_[numVertices] = end;
+        neighbors_.resize(end);
+    }
+
+    inline int numVertices() const { return int(offsets_.size()) - 1; }
+
+    // Sorted neighbours [begin, end) of v, empty if v has none
+    inline void neighbors(int v, const int*& begin, const int*& end) const {
+        if (v < 0 || v >= numVertices() || offsets_[v] == offsets_[v + 1]) {
+            begin = end = nullptr;
+            return;
+        }
+        begin = &neighbors_[offsets_[v]];
+        end = begin + (offsets_[v + 1] - offsets_[v]);
+    }
+
+    inline bool contains(int first, int second) const {
+        const int *begin, *end;
+        neighbors(first, begin, end);
+        return begin != end && std::binary_search(begin, end, second);
+    }
+
+private:
+    std::vector<int> offsets_;      // row v is neighbors_[offsets_[v], offsets_[v+1])
+    std::vector<int> neighbors_;
+};
+
+} // namespace Super4PCS
+
+#endif // PAIR_ADJACENCY_H
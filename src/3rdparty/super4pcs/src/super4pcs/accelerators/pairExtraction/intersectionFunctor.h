@@ -49,8 +49,17 @@
 #define _INTERSECTION_H_
 
 #include "intersectionNode.h"
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <list>
 #include <iostream>
+#include <thread>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Super4PCS{
 namespace Accelerators{
@@ -66,6 +75,59 @@ static Scalar GetRoundedEpsilonValue(Scalar epsilon, int* lvl = nullptr) {
     return 1.f/pow(2,lvlMax);
 }
 
+namespace internal{
+
+//! \brief Positions of the packed points within a spherical shell
+/*!
+ * rows holds dim rows of n coordinates (n multiple of 4, padded with infinite
+ * coordinates). Writes to hits the positions whose squared distance to center is
+ * in (inner, outer) and returns their number.
+ */
+template <int dim, typename Scalar>
+inline int shellCandidates(const Scalar* rows, int n, const Scalar* center,
+                           Scalar inner, Scalar outer, int* hits){
+  int nbHit = 0;
+  for(int j = 0; j != n; j++){
+    Scalar sqDist = 0;
+    for(int d = 0; d != dim; d++){
+      const Scalar diff = rows[d * n + j] - center[d];
+      sqDist += diff * diff;
+    }
+    hits[nbHit] = j;
+    nbHit += (sqDist > inner) & (sqDist < outer);
+  }
+  return nbHit;
+}
+
+#ifdef __SSE2__
+//! Same as the generic version, 4 points at a time as internal::PackedPoints::scan
+template <int dim>
+inline int shellCandidates(const float* rows, int n, const float* center,
+                           float inner, float outer, int* hits){
+  __m128 c[dim];
+  for(int d = 0; d != dim; d++)
+    c[d] = _mm_set1_ps(center[d]);
+  const __m128 in = _mm_set1_ps(inner);
+  const __m128 out = _mm_set1_ps(outer);
+
+  int nbHit = 0;
+  for(int j = 0; j < n; j += 4){
+    __m128 sqDist = _mm_setzero_ps();
+    for(int d = 0; d != dim; d++){
+      const __m128 diff = _mm_sub_ps(_mm_loadu_ps(rows + d * n + j), c[d]);
+      sqDist = _mm_add_ps(sqDist, _mm_mul_ps(diff, diff));
+    }
+    int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(sqDist, in),
+                                          _mm_cmplt_ps(sqDist, out)));
+    for(; mask; mask &= mask - 1)
+      hits[nbHit++] = j + __builtin_ctz(mask);
+  }
+  return nbHit;
+}
+#endif
+
+} // namespace internal
+
 //! \brief Extract pairs of points by rasterizing primitives and collect points
 /*!
  * Acceleration technique used in Super4PCS
@@ -91,37 +153,95 @@ struct IntersectionFunctor{
     ProcessingFunctor& functor
   );
 
+  //! \brief Same extraction as process, with the primitives split over numThreads
+  //! workers
+  /*!
+   * Each worker runs the tests of process on chunks of primitives and collects the
+   * pairs in a local buffer. The points of an intersecting leaf are tested together:
+   * the primitives must be spheres (center() and radius(), see HyperSphere). The
+   * functor must provide
+   * a PairsVector type, a const process(primId, pointId, PairsVector&) and
+   * appendPairs(const PairsVector&), which receives the buffers in primitive order:
+   * the pairs come out in the same order as with process.
+   */
+  template <class PrimitiveContainer,
+            class PointContainer,
+            class ProcessingFunctor>
+  void
+  processParallel(
+    const PrimitiveContainer& M, //!< Input primitives to intersect with Q
+    const PointContainer    & Q, //!< Normalized innput point set \in [0:1]^d
+    Scalar &epsilon,              //!< Intersection accuracy, refined
+    unsigned int minNodeSize,    //!< Min number of points in nodes
+    ProcessingFunctor& functor,
+    int numThreads
+  );
+
+private:
+  template <class PointContainer>
+  using Node = NdNode<Point, dim, Scalar, PointContainer>;
+
+  //! Leaf nodes with the half edge length used to test them against a primitive
+  template <class PointContainer>
+  using LeafContainer = std::vector< std::pair<Node<PointContainer>, Scalar> >;
+
+  //! Points of the leaves with one contiguous row per dimension, padded to a
+  //! multiple of 4, so that the distances of a leaf to a primitive are computed
+  //! with vector instructions as internal::PackedPoints does for the verification
+  struct PackedLeaves{
+    std::vector<Scalar> coords;     //!< dim padded rows per leaf
+    std::vector<unsigned int> ids;  //!< point id of each packed value
+    std::vector<int> first;         //!< first packed value of each leaf, then the end
+  };
+
+  //! Subdivides the nodes intersecting a primitive down to the epsilon level, the
+  //! nodes of a level are tested on numThreads workers
+  template <class PrimitiveContainer, class PointContainer>
+  static void
+  buildLeaves(
+    const PrimitiveContainer& M,
+    const PointContainer    & Q,
+    Scalar &epsilon,
+    unsigned int minNodeSize,
+    std::vector<unsigned int>& ids,
+    LeafContainer<PointContainer>& leaves,
+    int numThreads
+  );
+
+  template <class PointContainer>
+  static void
+  packLeaves(const LeafContainer<PointContainer>& leaves, PackedLeaves& packed);
+
+  //! Runs task(k) for every k in [0, numTasks) on numThreads workers, inline for a
+  //! single one
+  template <class Task>
+  static void runTasks(int numTasks, int numThreads, Task task);
+
 };
 
 
-/*!
-   \return Pairs< PointId, PrimitiveId>
- */
 template <class Primitive, class Point, int dim, typename Scalar>
 template <class PrimitiveContainer,
-          class PointContainer,
-          class ProcessingFunctor>
+          class PointContainer>
 void
-IntersectionFunctor<Primitive, Point, dim, Scalar>::process(
-    const PrimitiveContainer& M, //!< Input primitives to intersect with Q
-    const PointContainer    & Q, //!< Normalized innput point set \in [0:1]^d
-    Scalar &epsilon,              //!< Intersection accuracy in [0:1]
-    unsigned int minNodeSize,    //!< Min number of points in nodes
-    ProcessingFunctor& functor
+IntersectionFunctor<Primitive, Point, dim, Scalar>::buildLeaves(
+    const PrimitiveContainer& M,
+    const PointContainer    & Q,
+    Scalar &epsilon,
+    unsigned int minNodeSize,
+    std::vector<unsigned int>& ids,
+    LeafContainer<PointContainer>& leaves,
+    int numThreads
     )
 {
   using std::pow;
 
-  // types definitions
-  typedef NdNode<Point, dim, Scalar, PointContainer> Node;
-  typedef typename std::vector<Node> NodeContainer;
+  typedef Node<PointContainer> NodeType;
+  typedef typename std::vector<NodeType> NodeContainer;
 
-  typedef typename Node::IdContainer IdContainer;
-  typedef typename std::pair<unsigned int, unsigned int> ResPair;
-  typedef typename std::vector<ResPair> ResContainer;
+  // nodes tested per task
+  const int nodeChunkSize = 16;
 
-  // Global variables
-  const unsigned int nbPoint = Q.size();    //!< Number of points
   int lvlMax = 0;
   epsilon = GetRoundedEpsilonValue(epsilon, &lvlMax);
 
@@ -133,19 +253,10 @@ IntersectionFunctor<Primitive, Point, dim, Scalar>::process(
   NodeContainer* childNodes = &pong; //!< Child nodes for the next level
 
   //! Nodes too small for split
-  std::vector< std::pair<Node, Scalar> > earlyNodes;
-//
-//  // Fill the idContainer with identity values
-  if (functor.ids.size() != nbPoint){
-    std::cout << "[IntersectionFunctor] Init id array" << std::endl;
-    functor.ids.clear();
-    for(unsigned int i = 0; i < nbPoint; i++)
-      functor.ids.push_back(i);
-  }
-
+  LeafContainer<PointContainer> earlyNodes;
 
   // Buid root node in the child node, will be copied to the current nodes
-  childNodes->push_back(Node::buildUnitRootNode(Q, functor.ids));
+  childNodes->push_back(NodeType::buildUnitRootNode(Q, ids));
 
   Scalar edgeLength = 0.f;
   Scalar edgeHalfLength = 0.f;
@@ -163,74 +274,256 @@ IntersectionFunctor<Primitive, Point, dim, Scalar>::process(
     std::swap(nodes, childNodes);
     childNodes->clear();
 
-//#pragma omp parallel
-    for(typename NodeContainer::iterator nit  = nodes->begin();
-                                               nit != nodes->end(); nit++){
-      Node &n = *nit;
-
-      // Check if the current node intersect one of the primitives
-      // In this case, subdivide, store new nodes and stop the loop
-      for(typename PrimitiveContainer::const_iterator pit = M.begin();
-          pit != M.end(); pit++){
-
-        if ((*pit).intersect(n.center(), edgeHalfLength+epsilon)){
-          // There is two options now: either there is already few points in the
-          // current node, in that case we stop splitting it, or we split.
-          if (n.rangeLength() > int(minNodeSize)){
-//#pragma omp critical
-            n.split(*childNodes, edgeHalfLength);
-          }else{
-//#pragma omp critical
-            earlyNodes.emplace_back(n, edgeHalfLength+epsilon);
+    // The nodes split disjoint id ranges, so chunks of nodes are tested in
+    // parallel. Their children and early nodes are merged in node order, the
+    // leaves do not depend on numThreads.
+    const int nbNode = nodes->size();
+    const int nbNodeChunk = (nbNode + nodeChunkSize - 1) / nodeChunkSize;
+    std::vector<NodeContainer> chunkChildNodes(nbNodeChunk);
+    std::vector<LeafContainer<PointContainer> > chunkEarlyNodes(nbNodeChunk);
+
+    runTasks(nbNodeChunk, numThreads, [&](int c) {
+      const int last = std::min(nbNode, (c + 1) * nodeChunkSize);
+      for(int i = c * nodeChunkSize; i != last; i++){
+        NodeType &n = (*nodes)[i];
+
+        // Check if the current node intersect one of the primitives
+        // In this case, subdivide, store new nodes and stop the loop
+        for(typename PrimitiveContainer::const_iterator pit = M.begin();
+            pit != M.end(); pit++){
+
+          if ((*pit).intersect(n.center(), edgeHalfLength+epsilon)){
+            // There is two options now: either there is already few points in the
+            // current node, in that case we stop splitting it, or we split.
+            if (n.rangeLength() > int(minNodeSize)){
+              n.split(chunkChildNodes[c], edgeHalfLength);
+            }else{
+              chunkEarlyNodes[c].emplace_back(n, edgeHalfLength+epsilon);
+            }
+            break;
           }
-          break;
         }
       }
+    });
+
+    for(int c = 0; c < nbNodeChunk; c++){
+      childNodes->insert(childNodes->end(),
+                         chunkChildNodes[c].begin(), chunkChildNodes[c].end());
+      earlyNodes.insert(earlyNodes.end(),
+                        chunkEarlyNodes[c].begin(), chunkEarlyNodes[c].end());
     }
     clvl++;
   }
 
-  // Second Loop
-  ResContainer results;
-  results.reserve(childNodes->size());
+  // the nodes of the last level first, then the early ones
+  leaves.clear();
+  leaves.reserve(childNodes->size() + earlyNodes.size());
+  for(typename NodeContainer::const_iterator itN = childNodes->begin();
+      itN != childNodes->end(); itN++)
+    leaves.emplace_back(*itN, epsilon*2.f);
+  leaves.insert(leaves.end(), earlyNodes.begin(), earlyNodes.end());
+}
+
+
+template <class Primitive, class Point, int dim, typename Scalar>
+template <class PointContainer>
+void
+IntersectionFunctor<Primitive, Point, dim, Scalar>::packLeaves(
+    const LeafContainer<PointContainer>& leaves,
+    PackedLeaves& packed
+    )
+{
+  packed.coords.clear();
+  packed.ids.clear();
+  packed.first.clear();
+  for(typename LeafContainer<PointContainer>::const_iterator itLeaf =
+                 leaves.begin();
+      itLeaf != leaves.end();
+      itLeaf++){
+    const Node<PointContainer>& leaf = (*itLeaf).first;
+    const int n = leaf.rangeLength();
+    const int paddedN = (n + 3) / 4 * 4;
+    packed.first.push_back(packed.ids.size());
+
+    // the padding points never pass the distance test
+    for(int d = 0; d != dim; d++){
+      for(int j = 0; j != n; j++)
+        packed.coords.push_back(leaf.pointInRange(j)[d]);
+      for(int j = n; j != paddedN; j++)
+        packed.coords.push_back(std::numeric_limits<Scalar>::infinity());
+    }
+    for(int j = 0; j != paddedN; j++)
+      packed.ids.push_back(j < n ? leaf.idInRange(j) : 0);
+  }
+  packed.first.push_back(packed.ids.size());
+}
+
+
+template <class Primitive, class Point, int dim, typename Scalar>
+template <class Task>
+void
+IntersectionFunctor<Primitive, Point, dim, Scalar>::runTasks(
+    int numTasks,
+    int numThreads,
+    Task task
+    )
+{
+  numThreads = std::max(1, std::min(numThreads, numTasks));
+  if (numThreads == 1) {
+    for(int k = 0; k < numTasks; k++)
+      task(k);
+    return;
+  }
+
+  std::atomic<int> nextTask(0);
+  std::vector<std::thread> workers;
+  for(int t = 0; t < numThreads; t++)
+    workers.push_back(std::thread([&]() {
+      int k;
+      while ((k = nextTask++) < numTasks)
+        task(k);
+    }));
+  for(auto& w : workers)
+    w.join();
+}
+
+
+/*!
+   \return Pairs< PointId, PrimitiveId>
+ */
+template <class Primitive, class Point, int dim, typename Scalar>
+template <class PrimitiveContainer,
+          class PointContainer,
+          class ProcessingFunctor>
+void
+IntersectionFunctor<Primitive, Point, dim, Scalar>::process(
+    const PrimitiveContainer& M, //!< Input primitives to intersect with Q
+    const PointContainer    & Q, //!< Normalized innput point set \in [0:1]^d
+    Scalar &epsilon,              //!< Intersection accuracy in [0:1]
+    unsigned int minNodeSize,    //!< Min number of points in nodes
+    ProcessingFunctor& functor
+    )
+{
+  const unsigned int nbPoint = Q.size();    //!< Number of points
+
+//  // Fill the idContainer with identity values
+  if (functor.ids.size() != nbPoint){
+    std::cout << "[IntersectionFunctor] Init id array" << std::endl;
+    functor.ids.clear();
+    for(unsigned int i = 0; i < nbPoint; i++)
+      functor.ids.push_back(i);
+  }
+
+  LeafContainer<PointContainer> leaves;
+  buildLeaves(M, Q, epsilon, minNodeSize, functor.ids, leaves, 1);
 
+  // Second Loop
   unsigned int pId = 0;
   for(typename PrimitiveContainer::const_iterator itP = M.begin();
       itP != M.end(); itP++, pId++){
-    // add childs
-    for(typename NodeContainer::const_iterator itN = childNodes->begin();
-        itN != childNodes->end(); itN++){
-      if ((*itP).intersect((*itN).center(), epsilon*2.f)){
+    for(typename LeafContainer<PointContainer>::const_iterator itLeaf =
+                   leaves.begin();
+        itLeaf != leaves.end();
+        itLeaf++){
+      if((*itP).intersect((*itLeaf).first.center(), (*itLeaf).second)){
 
+        // Notice the functor we are collecting points for the current primitive
         functor.beginPrimitiveCollect(pId);
-        for(unsigned int j = 0; j!= (*itN).rangeLength(); j++){
-          if(pId>(*itN).idInRange(j))
-            if((*itP).intersectPoint((*itN).pointInRange(j),epsilon))
-              functor.process(pId, (*itN).idInRange(j));
+        for(int j = 0; j!= (*itLeaf).first.rangeLength(); j++){
+          if(pId>(*itLeaf).first.idInRange(j))
+            if((*itP).intersectPoint((*itLeaf).first.pointInRange(j),epsilon))
+              functor.process(pId, (*itLeaf).first.idInRange(j));
+
         }
         functor.endPrimitiveCollect(pId);
       }
     }
+  }
+}
 
-    // add other leafs
-    for(typename std::vector< std::pair<Node, Scalar> >::const_iterator itPairs =
-                   earlyNodes.begin();
-        itPairs != earlyNodes.end();
-        itPairs++){
-      if((*itP).intersect((*itPairs).first.center(), (*itPairs).second)){
 
-        // Notice the functor we are collecting points for the current primitive
-        functor.beginPrimitiveCollect(pId);
-        for(unsigned int j = 0; j!= (*itPairs).first.rangeLength(); j++){
-          if(pId>(*itPairs).first.idInRange(j))
-            if((*itP).intersectPoint((*itPairs).first.pointInRange(j),epsilon))
-              functor.process(pId, (*itPairs).first.idInRange(j));
+template <class Primitive, class Point, int dim, typename Scalar>
+template <class PrimitiveContainer,
+          class PointContainer,
+          class ProcessingFunctor>
+void
+IntersectionFunctor<Primitive, Point, dim, Scalar>::processParallel(
+    const PrimitiveContainer& M, //!< Input primitives to intersect with Q
+    const PointContainer    & Q, //!< Normalized innput point set \in [0:1]^d
+    Scalar &epsilon,              //!< Intersection accuracy in [0:1]
+    unsigned int minNodeSize,    //!< Min number of points in nodes
+    ProcessingFunctor& functor,
+    int numThreads
+    )
+{
+  typedef typename ProcessingFunctor::PairsVector PairsVector;
+
+  // primitives handled per task
+  const int chunkSize = 64;
+
+  const unsigned int nbPoint = Q.size();    //!< Number of points
+  if (functor.ids.size() != nbPoint){
+    functor.ids.clear();
+    for(unsigned int i = 0; i < nbPoint; i++)
+      functor.ids.push_back(i);
+  }
 
+  LeafContainer<PointContainer> leaves;
+  buildLeaves(M, Q, epsilon, minNodeSize, functor.ids, leaves, numThreads);
+
+  PackedLeaves packed;
+  packLeaves(leaves, packed);
+  int maxLeafSize = 0;
+  for(unsigned int l = 0; l != leaves.size(); l++)
+    maxLeafSize = std::max(maxLeafSize, packed.first[l+1] - packed.first[l]);
+
+  const int nbPrimitive = M.size();
+  const int nbChunk = (nbPrimitive + chunkSize - 1) / chunkSize;
+  std::vector<PairsVector> buffers(nbChunk);
+
+  // Same tests as the second loop of process, on the primitives of chunk c
+  auto collectChunk = [&](int c) {
+    std::vector<int> candidates(maxLeafSize);
+
+    const unsigned int last = std::min(nbPrimitive, (c + 1) * chunkSize);
+    for(unsigned int pId = c * chunkSize; pId != last; pId++){
+      const Primitive& prim = M[pId];
+
+      // intersectPoint holds within a shell of squared distances to the center,
+      // widened for the rounding: only the points in the shell are tested with it
+      const Scalar radius = prim.radius();
+      const Scalar outer = (radius + epsilon) * (radius + epsilon) * Scalar(1.001);
+      const Scalar inner = radius > epsilon ?
+                           (radius - epsilon) * (radius - epsilon) * Scalar(0.999) :
+                           Scalar(-1);
+
+      for(unsigned int l = 0; l != leaves.size(); l++){
+        if(!prim.intersect(leaves[l].first.center(), leaves[l].second))
+          continue;
+
+        const int first = packed.first[l];
+        const int n = packed.first[l+1] - first;
+        if (n == 0)
+          continue;
+
+        const int nbCandidate = internal::shellCandidates<dim>(
+          &packed.coords[dim * first], n, prim.center().data(), inner, outer,
+          candidates.data());
+
+        for(int k = 0; k != nbCandidate; k++){
+          const unsigned int id = packed.ids[first + candidates[k]];
+          if(pId>id)
+            if(prim.intersectPoint(Q[id],epsilon))
+              functor.process(pId, id, buffers[c]);
         }
-        functor.endPrimitiveCollect(pId);
       }
     }
-  }
+  };
+
+  runTasks(nbChunk, numThreads, collectChunk);
+
+  for(int c = 0; c < nbChunk; c++)
+    functor.appendPairs(buffers[c]);
 }
 
 } // namespace PairExtraction
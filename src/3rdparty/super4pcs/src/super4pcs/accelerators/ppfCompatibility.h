@@ -0,0 +1,156 @@
+// Pair feature compatibility of the sampled scene points and the samplers used by
+// the StoCS base selection (Match4PCSBase::SelectQuadrilateralStoCS).
+
+#ifndef PPF_COMPATIBILITY_H
+#define PPF_COMPATIBILITY_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace Super4PCS{
+
+// Directed n x n bit matrix: bit (i, j) is set when the point pair feature of (i, j)
+// is present on the model. Rows are padded to whole 64-bit words, so that candidate
+// sets can be intersected a word at a time.
+class PPFCompatibilityMatrix
+{
+public:
+    PPFCompatibilityMatrix() : n_(0), words_(0) {}
+
+    inline int size() const { return n_; }
+    inline int wordsPerRow() const { return words_; }
+    inline const uint64_t* row(int i) const { return &bits_[size_t(i) * words_]; }
+    inline bool test(int i, int j) const { return (row(i)[j >> 6] >> (j & 63)) & 1; }
+
+    // fillRow(i, row) sets the bits of row i, rows are split over numThreads workers
+    template <typename RowFunctor>
+    void build(int n, int numThreads, RowFunctor fillRow) {
+        n_ = n;
+        words_ = (n + 63) / 64;
+        bits_.assign(size_t(n_) * words_, 0);
+
+        numThreads = std::max(1, std::min(numThreads, n_));
+        std::vector<std::thread> workers;
+        for (int t = 0; t < numThreads; ++t)
+            workers.push_back(std::thread([this, t, numThreads, &fillRow]() {
+                // interleaved rows, the cost of a row depends on the point probabilities
+                for (int i = t; i < n_; i += numThreads)
+                    fillRow(i, &bits_[size_t(i) * words_]);
+            }));
+        for (auto &w : workers)
+            w.join();
+    }
+
+private:
+    int n_;
+    int words_;
+    std::vector<uint64_t> bits_;
+};
+
+inline void setBit(uint64_t* bits, int i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+inline void clearBit(uint64_t* bits, int i) { bits[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+
+// Calls f(i) for every set bit i of the first words*64 bits
+template <typename Functor>
+inline void forEachSetBit(const uint64_t* bits, int words, Functor f) {
+    for (int w = 0; w < words; ++w) {
+        uint64_t word = bits[w];
+        while (word) {
+            f(w * 64 + __builtin_ctzll(word));
+            word &= word - 1;
+        }
+    }
+}
+
+// Draws a set bit i with probability weights[i] / mass, where mass is the sum of the
+// weights of all set bits. Returns -1 when the set has no mass.
+template <typename Rng>
+inline int sampleFromBitset(const uint64_t* bits, int words, const std::vector<float>& weights,
+                            Rng& rng, float& mass) {
+    mass = 0;
+    forEachSetBit(bits, words, [&](int i) { mass += weights[i]; });
+    if (!(mass > 0))
+        return -1;
+
+    float target = std::uniform_real_distribution<float>(0, mass)(rng);
+    int last = -1;
+    for (int w = 0; w < words; ++w) {
+        uint64_t word = bits[w];
+        while (word) {
+            int i = w * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            if (weights[i] <= 0)
+                continue;
+            last = i;
+            target -= weights[i];
+            if (target < 0)
+                return i;
+        }
+    }
+    // rounding left a little mass at the end
+    return last;
+}
+
+// Walker's alias method: O(n) construction and O(1) draws from a fixed discrete
+// distribution, used for the first base point which is drawn from the unmodified
+// point probabilities.
+class AliasTable
+{
+public:
+    inline bool empty() const { return prob_.empty(); }
+
+    // returns false when the weights have no mass
+    bool build(const std::vector<float>& weights) {
+        const int n = weights.size();
+        prob_.clear();
+        alias_.clear();
+
+        double sum = 0;
+        for (int i = 0; i < n; ++i)
+            sum += std::max(weights[i], 0.f);
+        if (!(sum > 0))
+            return false;
+
+        prob_.resize(n);
+        alias_.resize(n);
+        std::vector<double> scaled(n);
+        std::vector<int> small, large;
+        for (int i = 0; i < n; ++i) {
+            scaled[i] = std::max(weights[i], 0.f) * n / sum;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+        while (!small.empty() && !large.empty()) {
+            int s = small.back(); small.pop_back();
+            int l = large.back();
+            prob_[s] = scaled[s];
+            alias_[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // leftovers are 1 up to rounding, but never hand out a point without weight
+        int anyPositive = std::max_element(weights.begin(), weights.end()) - weights.begin();
+        for (int i : large) { prob_[i] = 1.0; alias_[i] = i; }
+        for (int i : small) { prob_[i] = weights[i] > 0 ? 1.0 : 0.0; alias_[i] = anyPositive; }
+        return true;
+    }
+
+    template <typename Rng>
+    inline int sample(Rng& rng) const {
+        int column = std::uniform_int_distribution<int>(0, prob_.size() - 1)(rng);
+        return std::uniform_real_distribution<double>(0, 1)(rng) < prob_[column] ? column : alias_[column];
+    }
+
+private:
+    std::vector<double> prob_;
+    std::vector<int> alias_;
+};
+
+} // namespace Super4PCS
+
+#endif // PPF_COMPATIBILITY_H
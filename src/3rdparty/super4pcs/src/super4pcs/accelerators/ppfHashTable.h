@@ -0,0 +1,110 @@
+// Flat copy of the model point pair feature map (PPFMap) used by the Hough voting
+// (Match4PCSBase::Perform_Hough_Voting): the model pairs of every feature are stored
+// contiguously, together with a per pair value computed once at build time (the model
+// alpha angle), and the features are found with an open addressing hash table instead
+// of the std::map of vector keys.
+
+#ifndef PPF_HASH_TABLE_H
+#define PPF_HASH_TABLE_H
+
+#include <stdint.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace Super4PCS{
+
+class PPFHashTable
+{
+public:
+    struct Entry {
+        int first, second;  // model point indices of the pair
+        float value;
+    };
+
+    typedef std::map<std::vector<int>, std::vector<std::pair<int,int> > > PPFMapType;
+
+    PPFHashTable() : mask_(0), shift_(64) {}
+
+    inline bool empty() const { return entries_.empty(); }
+    inline int numEntries() const { return entries_.size(); }
+    inline const Entry& entry(int i) const { return entries_[i]; }
+
+    // value(first, second) gives the stored value of each model pair
+    template <typename ValueFunctor>
+    void build(const PPFMapType& map, ValueFunctor value) {
+        entries_.clear();
+        table_.clear();
+        if (map.empty())
+            return;
+
+        int tableSize = 16;
+        shift_ = 60;
+        while (tableSize < 2 * int(map.size())) {
+            tableSize *= 2; --shift_;
+        }
+        table_.assign(tableSize, Slot{kEmpty, 0, 0});
+        mask_ = tableSize - 1;
+
+        for (const auto& feature : map) {
+            uint64_t key;
+            if (feature.first.size() != 4 || !packKey(feature.first.data(), key))
+                continue;
+            Slot slot{key, int(entries_.size()), 0};
+            for (const auto& pair : feature.second)
+                entries_.push_back(Entry{pair.first, pair.second, value(pair.first, pair.second)});
+            slot.end = entries_.size();
+
+            uint64_t i = hash(key);
+            while (table_[i].key != kEmpty)
+                i = (i + 1) & mask_;
+            table_[i] = slot;
+        }
+    }
+
+    // Range [begin, end) of the entries of the feature ppf, empty if not on the model
+    inline void find(const int* ppf, int& begin, int& end) const {
+        begin = end = 0;
+        uint64_t key;
+        if (table_.empty() || !packKey(ppf, key))
+            return;
+        for (uint64_t i = hash(key); table_[i].key != kEmpty; i = (i + 1) & mask_)
+            if (table_[i].key == key) {
+                begin = table_[i].begin;
+                end = table_[i].end;
+                return;
+            }
+    }
+
+private:
+    static constexpr uint64_t kEmpty = ~uint64_t(0);
+
+    struct Slot {
+        uint64_t key;
+        int begin, end;     // range in entries_
+    };
+
+    // the 4 features (distance and angle bins) fit 16 bits each
+    static inline bool packKey(const int* ppf, uint64_t& key) {
+        key = 0;
+        for (int k = 0; k < 4; ++k) {
+            if (ppf[k] < 0 || ppf[k] >= (1 << 16))
+                return false;
+            key |= uint64_t(ppf[k]) << (16 * k);
+        }
+        return key != kEmpty;
+    }
+
+    inline uint64_t hash(uint64_t key) const {
+        return (key * 0x9E3779B97F4A7C15ull) >> shift_;
+    }
+
+    std::vector<Entry> entries_;
+    std::vector<Slot> table_;
+    uint64_t mask_;
+    int shift_;
+};
+
+} // namespace Super4PCS
+
+#endif // PPF_HASH_TABLE_H
@@ -0,0 +1,255 @@
+// Read-only kd-tree specialised for the LCP verification (Match4PCSBase::Verify and
+// WeightedVerify): every transform queries each validation point once for a neighbor
+// of the sampled scene within delta.
+//
+// Compared to Super4PCS::KdTree the nodes are stored in a flat array in depth-first
+// order (the left child of a node is the next node), the points are copied in leaf
+// order as separate x/y/z arrays, and the leaves are small and padded so that their
+// distances are evaluated 4 points at a time with SSE. The traversal stack lives on
+// the caller's stack, so const queries can run from several threads.
+
+#ifndef STATIC_KDTREE_H
+#define STATIC_KDTREE_H
+
+#include "Eigen/Core"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace Super4PCS{
+namespace internal{
+
+// Point positions as separate x/y/z arrays, stored in blocks of 4 so that the squared
+// distances to a query are evaluated 4 at a time
+struct PackedPoints
+{
+    std::vector<float> x, y, z;
+    std::vector<int> ids;
+
+    inline int size() const { return x.size(); }
+
+    inline void clear() { x.clear(); y.clear(); z.clear(); ids.clear(); }
+
+    inline void reserve(int n) { x.reserve(n); y.reserve(n); z.reserve(n); ids.reserve(n); }
+
+    inline void push(const Eigen::Matrix<float, 3, 1>& p, int id) {
+        x.push_back(p.x()); y.push_back(p.y()); z.push_back(p.z());
+        ids.push_back(id);
+    }
+
+    // pads to a multiple of 4 with points that never pass the distance test
+    inline void pad() {
+        const float inf = std::numeric_limits<float>::infinity();
+        while (size() % 4)
+            push(Eigen::Matrix<float, 3, 1>::Constant(inf), -1);
+    }
+
+    // Scans the points [begin, end) (begin and end multiples of 4) for the closest one
+    // with squared distance <= bestSq, updating best and bestSq. With anyHit, returns
+    // true as soon as such a point is found.
+    template <bool anyHit>
+    inline bool scan(int begin, int end, const Eigen::Matrix<float, 3, 1>& q,
+                     float& bestSq, int& best) const {
+#ifdef __SSE2__
+        const __m128 qx = _mm_set1_ps(q.x());
+        const __m128 qy = _mm_set1_ps(q.y());
+        const __m128 qz = _mm_set1_ps(q.z());
+        for (int i = begin; i < end; i += 4) {
+            const __m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[i]), qx);
+            const __m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[i]), qy);
+            const __m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[i]), qz);
+            const __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                        _mm_mul_ps(dz, dz));
+            const int mask = _mm_movemask_ps(_mm_cmple_ps(d, _mm_set1_ps(bestSq)));
+            if (!mask)
+                continue;
+            if (anyHit) {
+                best = ids[i + __builtin_ctz(mask)];
+                return true;
+            }
+            float dist[4];
+            _mm_storeu_ps(dist, d);
+            for (int k = 0; k < 4; ++k)
+                if ((mask >> k) & 1 && dist[k] <= bestSq) {
+                    bestSq = dist[k];
+                    best = ids[i + k];
+                }
+        }
+#else
+        for (int i = begin; i < end; ++i) {
+            const float dx = x[i] - q.x(), dy = y[i] - q.y(), dz = z[i] - q.z();
+            const float d = dx * dx + dy * dy + dz * dz;
+            if (d <= bestSq) {
+                bestSq = d;
+                best = ids[i];
+                if (anyHit)
+                    return true;
+            }
+        }
+#endif
+        return false;
+    }
+};
+
+} // namespace internal
+
+class StaticKdTree
+{
+public:
+    typedef float Scalar;
+    typedef int Index;
+    typedef Eigen::Matrix<Scalar, 3, 1> VectorType;
+
+    // points per leaf, leaves are padded to a multiple of 4
+    enum { kLeafSize = 16 };
+
+    static constexpr Index invalidIndex() { return -1; }
+
+    StaticKdTree() {}
+
+    inline bool empty() const { return nodes_.empty(); }
+
+    // pos(i) returns the position of point i, for i in [0, n)
+    template <typename PosFunctor>
+    void build(int n, PosFunctor pos) {
+        nodes_.clear();
+        points_.clear();
+        if (n <= 0)
+            return;
+
+        std::vector<VectorType> points(n);
+        for (int i = 0; i < n; ++i)
+            points[i] = pos(i);
+        std::vector<Index> order(n);
+        std::iota(order.begin(), order.end(), 0);
+
+        nodes_.reserve(2 * (n / kLeafSize + 1));
+        points_.reserve(n + 4 * (n / kLeafSize + 1));
+        createNode(points, order, 0, n);
+    }
+
+    // Closest point with squared distance <= sqdist, or invalidIndex()
+    inline Index queryRestrictedClosestIndex(const VectorType& q, Scalar sqdist) const {
+        return query<false>(q, sqdist);
+    }
+
+    // Only tells whether some point lies within sqdist: stops at the first hit
+    inline bool hasNeighbor(const VectorType& q, Scalar sqdist) const {
+        return query<true>(q, sqdist) != invalidIndex();
+    }
+
+    // Batched version of queryRestrictedClosestIndex over the columns of queries
+    template <typename Derived>
+    inline void queryRestrictedClosestIndices(const Eigen::MatrixBase<Derived>& queries,
+                                              Scalar sqdist, Index* result) const {
+        for (int i = 0; i < queries.cols(); ++i)
+            result[i] = query<false>(queries.col(i), sqdist);
+    }
+
+private:
+    struct Node {
+        Scalar split;
+        int dim;        // split axis, -1 for leaves
+        int first;      // leaves: first point in points_, inner nodes: right child
+        int size;       // leaves: padded number of points
+    };
+
+    int createNode(const std::vector<VectorType>& points, std::vector<Index>& order,
+                   int start, int end) {
+        const int nodeId = nodes_.size();
+        nodes_.push_back(Node());
+
+        if (end - start <= kLeafSize) {
+            Node leaf;
+            leaf.split = 0;
+            leaf.dim = -1;
+            leaf.first = points_.size();
+            for (int i = start; i < end; ++i)
+                points_.push(points[order[i]], order[i]);
+            points_.pad();
+            leaf.size = points_.size() - leaf.first;
+            nodes_[nodeId] = leaf;
+            return nodeId;
+        }
+
+        // median split on the widest axis of the subset
+        VectorType lo = points[order[start]], hi = lo;
+        for (int i = start + 1; i < end; ++i) {
+            lo = lo.cwiseMin(points[order[i]]);
+            hi = hi.cwiseMax(points[order[i]]);
+        }
+        int dim;
+        (hi - lo).maxCoeff(&dim);
+
+        const int mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                         [&points, dim](Index a, Index b) { return points[a][dim] < points[b][dim]; });
+
+        Node inner;
+        inner.split = points[order[mid]][dim];
+        inner.dim = dim;
+        inner.size = 0;
+        createNode(points, order, start, mid);
+        inner.first = createNode(points, order, mid, end);
+        nodes_[nodeId] = inner;
+        return nodeId;
+    }
+
+    template <bool anyHit>
+    inline Index query(const VectorType& q, Scalar sqdist) const {
+        if (nodes_.empty())
+            return invalidIndex();
+
+        // sq is the squared distance from q to the cell of the node, accumulated from
+        // the per axis offsets to the splits on the path (Arya and Mount)
+        struct Entry { int node; Scalar sq; Scalar off[3]; };
+        // median splits: the depth is below log2(2^31 / kLeafSize) + 1
+        Entry stack[64];
+        int count = 0;
+        stack[count++] = Entry{0, 0, {0, 0, 0}};
+
+        Index best = invalidIndex();
+        Scalar bestSq = sqdist;
+
+        while (count) {
+            Entry e = stack[--count];
+            if (e.sq > bestSq)
+                continue;
+
+            int nodeId = e.node;
+            // descend to the closest leaf, deferring the far children
+            while (nodes_[nodeId].dim >= 0) {
+                const Node& node = nodes_[nodeId];
+                const Scalar off = q[node.dim] - node.split;
+                const int near = off < 0 ? nodeId + 1 : node.first;
+                const Scalar farSq = e.sq - e.off[node.dim] * e.off[node.dim] + off * off;
+                if (farSq <= bestSq) {
+                    Entry& far = stack[count++];
+                    far = e;
+                    far.node = off < 0 ? node.first : nodeId + 1;
+                    far.sq = farSq;
+                    far.off[node.dim] = off;
+                }
+                nodeId = near;
+            }
+
+            const Node& leaf = nodes_[nodeId];
+            if (points_.scan<anyHit>(leaf.first, leaf.first + leaf.size, q, bestSq, best))
+                return best;
+        }
+        return best;
+    }
+
+    std::vector<Node> nodes_;
+    internal::PackedPoints points_;
+};
+
+} // namespace Super4PCS
+
+#endif // STATIC_KDTREE_H
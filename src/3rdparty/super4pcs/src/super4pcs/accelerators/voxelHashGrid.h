@@ -0,0 +1,189 @@
+// Hashed occupancy grid answering the same restricted closest point queries as
+// StaticKdTree, for a radius fixed at construction (delta in the LCP verification).
+//
+// The cells are 4 * radius wide, so along each axis the ball of radius r <= radius
+// around a query point overlaps the cell of the query point and at most one neighbor,
+// only when the point is within r of the boundary: a query costs between 1 and 8
+// (3.4 on average) hash probes and the scan of the points of those cells, independently
+// of the size of the cloud. The points are sorted by cell and packed as in StaticKdTree,
+// the hash table (Fibonacci hashing, linear probing, load factor below 1/4) maps the
+// occupied cells to their point ranges.
+
+#ifndef VOXEL_HASH_GRID_H
+#define VOXEL_HASH_GRID_H
+
+#include "staticKdTree.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+namespace Super4PCS{
+
+class VoxelHashGrid
+{
+public:
+    typedef float Scalar;
+    typedef int Index;
+    typedef Eigen::Matrix<Scalar, 3, 1> VectorType;
+
+    static constexpr Index invalidIndex() { return -1; }
+
+    VoxelHashGrid() : radius_(0), cellSize_(0) {}
+
+    int tableSize() const { return table_.size(); }
+    inline bool empty() const { return table_.empty(); }
+    inline Scalar radius() const { return radius_; }
+
+    // pos(i) returns the position of point i, for i in [0, n). The queries must use a
+    // squared distance of at most radius^2.
+    template <typename PosFunctor>
+    void build(int n, PosFunctor pos, Scalar radius) {
+        table_.clear();
+        points_.clear();
+        radius_ = radius;
+        if (n <= 0 || !(radius > 0))
+            return;
+
+        std::vector<VectorType> points(n);
+        for (int i = 0; i < n; ++i)
+            points[i] = pos(i);
+
+        VectorType lo = points[0], hi = lo;
+        for (int i = 1; i < n; ++i) {
+            lo = lo.cwiseMin(points[i]);
+            hi = hi.cwiseMax(points[i]);
+        }
+        // the cell coordinates must fit the 21 bits of a key field
+        cellSize_ = std::max(4 * radius, (hi - lo).maxCoeff() / Scalar(kMaxCells - 4));
+        origin_ = lo - VectorType::Constant(cellSize_);
+        for (int k = 0; k < 3; ++k)
+            dims_[k] = int((hi[k] - origin_[k]) / cellSize_) + 2;
+
+        std::vector<uint64_t> keys(n);
+        for (int i = 0; i < n; ++i) {
+            const VectorType c = ((points[i] - origin_) / cellSize_).array().floor();
+            keys[i] = cellKey(int(c.x()), int(c.y()), int(c.z()));
+        }
+        std::vector<Index> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&keys](Index a, Index b) { return keys[a] < keys[b]; });
+
+        int numCells = 0;
+        for (int i = 0; i < n; ++i)
+            numCells += (i == 0 || keys[order[i]] != keys[order[i - 1]]);
+        int tableSize = 16;
+        shift_ = 60;
+        while (tableSize < 4 * numCells) {
+            tableSize *= 2; --shift_;
+        }
+        table_.assign(tableSize, Cell{kEmpty, 0, 0});
+        mask_ = tableSize - 1;
+
+        points_.reserve(n + 3 * numCells);
+        for (int i = 0; i < n;) {
+            Cell cell{keys[order[i]], points_.size(), 0};
+            for (; i < n && keys[order[i]] == cell.key; ++i)
+                points_.push(points[order[i]], order[i]);
+            points_.pad();
+            cell.end = points_.size();
+            uint64_t slot = hash(cell.key);
+            while (table_[slot].key != kEmpty)
+                slot = (slot + 1) & mask_;
+            table_[slot] = cell;
+        }
+    }
+
+    // Closest point with squared distance <= sqdist, or invalidIndex()
+    inline Index queryRestrictedClosestIndex(const VectorType& q, Scalar sqdist) const {
+        return query<false>(q, sqdist);
+    }
+
+    // Only tells whether some point lies within sqdist: stops at the first hit
+    inline bool hasNeighbor(const VectorType& q, Scalar sqdist) const {
+        return query<true>(q, sqdist) != invalidIndex();
+    }
+
+    // Batched version of queryRestrictedClosestIndex over the columns of queries
+    template <typename Derived>
+    inline void queryRestrictedClosestIndices(const Eigen::MatrixBase<Derived>& queries,
+                                              Scalar sqdist, Index* result) const {
+        for (int i = 0; i < queries.cols(); ++i)
+            result[i] = query<false>(queries.col(i), sqdist);
+    }
+
+private:
+    enum { kFieldBits = 21, kMaxCells = 1 << kFieldBits };
+    static constexpr uint64_t kEmpty = ~uint64_t(0);
+
+    struct Cell {
+        uint64_t key;
+        int begin, end;     // range in points_
+    };
+
+    static inline uint64_t cellKey(int x, int y, int z) {
+        return uint64_t(x) | (uint64_t(y) << kFieldBits) | (uint64_t(z) << (2 * kFieldBits));
+    }
+
+    inline uint64_t hash(uint64_t key) const {
+        return (key * 0x9E3779B97F4A7C15ull) >> shift_;
+    }
+
+    inline const Cell* find(int x, int y, int z) const {
+        if (x < 0 || y < 0 || z < 0 || x >= dims_[0] || y >= dims_[1] || z >= dims_[2])
+            return nullptr;
+        const uint64_t key = cellKey(x, y, z);
+        for (uint64_t slot = hash(key); table_[slot].key != kEmpty; slot = (slot + 1) & mask_)
+            if (table_[slot].key == key)
+                return &table_[slot];
+        return nullptr;
+    }
+
+    template <bool anyHit>
+    inline Index query(const VectorType& q, Scalar sqdist) const {
+        if (table_.empty())
+            return invalidIndex();
+
+        // cells overlapped by the ball on each axis: the cell of q, and its neighbor
+        // when q is closer than the radius to the boundary. The margin on the radius
+        // covers the rounding of the cell coordinates.
+        const Scalar r = std::sqrt(sqdist) * Scalar(1.001);
+        int lo[3], hi[3];
+        for (int k = 0; k < 3; ++k) {
+            const Scalar c = (q[k] - origin_[k]) / cellSize_;
+            const Scalar cell = std::floor(c);
+            // outside of the grid (or NaN): no point can be within radius
+            if (!(cell > -2 && cell < dims_[k] + 1))
+                return invalidIndex();
+            const Scalar f = (c - cell) * cellSize_;
+            lo[k] = int(cell) - (f < r);
+            hi[k] = int(cell) + (cellSize_ - f < r);
+        }
+
+        Index best = invalidIndex();
+        Scalar bestSq = sqdist;
+        for (int z = lo[2]; z <= hi[2]; ++z)
+            for (int y = lo[1]; y <= hi[1]; ++y)
+                for (int x = lo[0]; x <= hi[0]; ++x) {
+                    const Cell* cell = find(x, y, z);
+                    if (cell && points_.scan<anyHit>(cell->begin, cell->end, q, bestSq, best))
+                        return best;
+                }
+        return best;
+    }
+
+    Scalar radius_;
+    Scalar cellSize_;
+    VectorType origin_;
+    int dims_[3];
+    std::vector<Cell> table_;
+    uint64_t mask_;
+    int shift_;
+    internal::PackedPoints points_;
+};
+
+} // namespace Super4PCS
+
+#endif // VOXEL_HASH_GRID_H
@@ -65,6 +65,7 @@ bool Match4PCS::FindCongruentQuadrilaterals(
         Scalar distance_threshold2,
         const std::vector<std::pair<int, int>>& P_pairs,
         const std::vector<std::pair<int, int>>& Q_pairs,
+        const std::vector<Point3D>& /*base*/,
         std::vector<match_4pcs::Quadrilateral>* quadrilaterals) const {
   if (quadrilaterals == nullptr) return false;
 
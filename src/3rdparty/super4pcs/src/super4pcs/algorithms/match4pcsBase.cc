@@ -45,11 +45,13 @@
 #include "shared4pcs.h"
 
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <thread>
 #include <queue>
-#include <tuple>
+#include <unordered_map>
 #include <unordered_set>
-#include <boost/functional/hash.hpp>
 
 #include "Eigen/Core"
 #include "Eigen/Geometry"                 // MatrixBase.homogeneous()
@@ -58,20 +60,16 @@
 #include "shared4pcs.h"
 #include "sampling.h"
 #include "accelerators/kdtree.h"
+#include "accelerators/pairAdjacency.h"
 
 #include "io/io.h"
+
+#include <depth_codec.h>
+
 const double pi = std::acos(-1);
 
-namespace std {
-  template<typename... T>
-  struct hash<tuple<T...>>
-  {
-      size_t operator()(tuple<T...> const& arg) const noexcept
-      {
-          return boost::hash_value(arg);
-      }
-  };
-}
+// (v1, v2) edges matched per task by the volumetric 4PCS mode
+const int kV4PCSChunk = 64;
 
 // Compute the closest points between two 3D line segments and obtain the two
 // invariants corresponding to the closet points. This is the "intersection"
@@ -159,47 +157,125 @@ int approximate_bin(int val, int disc) {
   return closest;
 }
 
-static void addToConnectivityMap(const std::vector<std::pair<int, int>>& pairs, float &distance,
-                                std::map<std::pair<int, float>, std::vector<int> > &connectivity_map){
-
-  for (size_t i = 0; i < pairs.size(); ++i) {
-    std::pair<int, float> vertex_distance_pair = std::make_pair(pairs[i].first, distance);
-    std::map<std::pair<int, float>, std::vector<int> >::iterator it = connectivity_map.find(vertex_distance_pair);
+static Eigen::Isometry3d convertToIsometry3d(Eigen::Matrix<float, 4, 4> &transformation){
+  Eigen::Isometry3d poseIsometry;
+  poseIsometry.setIdentity();
 
-    if (it == connectivity_map.end()) {
-      std::vector<int> vertices;
-      vertices.push_back(pairs[i].second);
-      connectivity_map.insert (std::make_pair(vertex_distance_pair,vertices));
-    }
-    else {
-      it->second.push_back(pairs[i].second);
+  for(int ii=0; ii<4; ii++)
+    for(int jj=0; jj<4; jj++){
+      poseIsometry.matrix()(ii,jj) = transformation(ii, jj);
     }
-  }
 
+  return poseIsometry;
 }
 
-static void addToConnectivityPresenceMap(const std::vector<std::pair<int, int>>& pairs, float &distance,
-                                std::map<std::pair<int, int>, int > &connectivity_map){
-
-  for (size_t i = 0; i < pairs.size(); ++i) {
-    std::map<std::pair<int, int>, int>::iterator it = connectivity_map.find(pairs[i]);
-    if (it == connectivity_map.end())
-      connectivity_map.insert (std::make_pair(pairs[i],1));
+// Runs task(k) for every k in [0, num_tasks) on num_threads workers, inline for a single one
+template <typename Task>
+static void runParallelTasks(int num_tasks, int num_threads, Task task) {
+  num_threads = std::max(1, std::min(num_threads, num_tasks));
+  if (num_threads == 1) {
+    for (int k = 0; k < num_tasks; k++)
+      task(k);
+    return;
   }
 
+  std::atomic<int> next_task(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < num_threads; t++)
+    workers.push_back(std::thread([&]() {
+      int k;
+      while ((k = next_task++) < num_tasks)
+        task(k);
+    }));
+  for (auto &worker : workers)
+    worker.join();
 }
 
-static Eigen::Isometry3d convertToIsometry3d(Eigen::Matrix<float, 4, 4> &transformation){
-  Eigen::Isometry3d poseIsometry;
-  poseIsometry.setIdentity();
+// Hash grid of the pose cluster seeds over the translation and the unit quaternion (up to
+// sign) of the rotation. Rotations within max_angle have quaternions within
+// 2sin(max_angle/4), so a pose only needs the seeds of the cells within the radius along
+// each coordinate. The cells are 4 times the radius: 1.5 cells per coordinate on average.
+class PoseGrid {
+ public:
+  PoseGrid(float max_angle, float max_translation) {
+    for (int i = 0; i < kCoords; i++) {
+      // the margin covers the float rounding of the exact test
+      radius_[i] = 1.01f * (i < 3 ? max_translation : 2 * std::sin(max_angle / 4));
+      cell_size_[i] = 4 * radius_[i];
+    }
+  }
 
-  for(int ii=0; ii<4; ii++)
-    for(int jj=0; jj<4; jj++){
-      poseIsometry.matrix()(ii,jj) = transformation(ii, jj);
+  void Insert(const Eigen::Matrix<float, 4, 4> &pose, int id) {
+    float coords[kCoords];
+    int cell[kCoords];
+    Coordinates(pose, false, coords);
+    for (int i = 0; i < kCoords; i++)
+      cell[i] = int(std::floor(coords[i] / cell_size_[i]));
+    bins_[Key(cell)].push_back(id);
+  }
+
+  // Sorted ids of the seeds that may be within the radius of pose
+  void Candidates(const Eigen::Matrix<float, 4, 4> &pose, std::vector<int> &ids) const {
+    ids.clear();
+    for (int flip = 0; flip < 2; flip++) {
+      float coords[kCoords];
+      Coordinates(pose, flip == 1, coords);
+      // q and -q are the same rotation: close to w = 0 the seed may have the other sign
+      if (flip == 1 && std::abs(coords[3]) >= radius_[3])
+        break;
+
+      // along each coordinate, the cell of the pose and its neighbor when the pose is
+      // closer than the radius to the boundary
+      int lo[kCoords], hi[kCoords], cell[kCoords];
+      for (int i = 0; i < kCoords; i++) {
+        const int base = int(std::floor(coords[i] / cell_size_[i]));
+        const float offset = coords[i] - base * cell_size_[i];
+        lo[i] = offset < radius_[i] ? base - 1 : base;
+        hi[i] = cell_size_[i] - offset < radius_[i] ? base + 1 : base;
+        cell[i] = lo[i];
+      }
+
+      while (true) {
+        auto bin = bins_.find(Key(cell));
+        if (bin != bins_.end())
+          ids.insert(ids.end(), bin->second.begin(), bin->second.end());
+        int i = 0;
+        for (; i < kCoords && cell[i] == hi[i]; i++)
+          cell[i] = lo[i];
+        if (i == kCoords)
+          break;
+        cell[i]++;
+      }
     }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  }
 
-  return poseIsometry;
-}
+ private:
+  enum { kCoords = 7 };
+
+  static void Coordinates(const Eigen::Matrix<float, 4, 4> &pose, bool flip, float *coords) {
+    const Eigen::Quaternionf q(Eigen::Matrix3f(pose.block<3,3>(0,0)));
+    const float sign = (q.w() < 0) != flip ? -1 : 1;
+    for (int i = 0; i < 3; i++)
+      coords[i] = pose(i, 3);
+    coords[3] = sign * q.w();
+    coords[4] = sign * q.x();
+    coords[5] = sign * q.y();
+    coords[6] = sign * q.z();
+  }
+
+  // collisions only add seeds to test
+  static uint64_t Key(const int *cell) {
+    uint64_t key = 0;
+    for (int i = 0; i < kCoords; i++)
+      key = (key ^ uint32_t(cell[i])) * 0x9E3779B97F4A7C15ull;
+    return key;
+  }
+
+  float radius_[kCoords], cell_size_[kCoords];
+  std::unordered_map<uint64_t, std::vector<int> > bins_;
+};
 
 namespace Super4PCS{
 
@@ -209,78 +285,54 @@ Match4PCSBase::Match4PCSBase(const match_4pcs::Match4PCSOptions& options)
     max_base_diameter_(-1),
     P_mean_distance_(1.0),
     best_LCP_(0.0F),
-    options_(options) {
+    options_(options),
+    ppf_table_(nullptr) {
   base_3D_.resize(4);
 }
 
 void Match4PCSBase::init(const std::vector<Point3D>& P,
-                         const std::vector<Point3D>& Q,
-                         const std::vector<Point3D>& Q_validation,
-                         std::string probImagePath,
+                         std::shared_ptr<const ModelContext> model,
+                         const cv::Mat& probImg,
+                         cv::Point probOrigin,
                          Eigen::Matrix3f camIntrinsic,
-                         std::string objName,
-                         std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, 
-                         int max_count_ppf){
+                         std::string objName){
 
     start_time = clock();
     const Scalar kDiameterFraction = 0.3;
 
+    // The model side is centered once in the ModelContext, only the segment is
+    // prepared here.
+    model_ = model;
     centroid_P_ = VectorType::Zero();
-    centroid_Q_ = VectorType::Zero();
+    centroid_Q_ = model_->centroid();
 
     sampled_P_3D_.clear();
     sampled_Q_3D_.clear();
     validation_Q_3D.clear();
 
     sampled_P_3D_ = P;
-    sampled_Q_3D_ = Q;
-    validation_Q_3D = Q_validation;
+    sampled_Q_3D_ = model_->sampled();
+    validation_Q_3D = model_->validation();
+    hull_Q_3D = model_->hull();
 
     std::cout << "Super4PCS::Match4PCSBase::init:sampled_P_3D_size: " << sampled_P_3D_.size() << std::endl;
     std::cout << "Super4PCS::Match4PCSBase::init:sampled_Q_3D_size: " << sampled_Q_3D_.size() << std::endl;
 
-    // Compute the centroids.
+    // Compute the centroid.
     for (int i = 0; i < sampled_P_3D_.size(); ++i) {
         centroid_P_ += sampled_P_3D_[i].pos();
     }
 
     centroid_P_ /= Scalar(sampled_P_3D_.size());
 
-    for (int i = 0; i < sampled_Q_3D_.size(); ++i) {
-        centroid_Q_ += sampled_Q_3D_[i].pos();
-    }
-
-    centroid_Q_ /= Scalar(sampled_Q_3D_.size());
-
-    // Move the samples to the centroids to allow robustness in rotation.
+    // Move the samples to the centroid to allow robustness in rotation.
     for (int i = 0; i < sampled_P_3D_.size(); ++i) {
         sampled_P_3D_[i].pos() -= centroid_P_;
     }
-    for (int i = 0; i < sampled_Q_3D_.size(); ++i) {
-        sampled_Q_3D_[i].pos() -= centroid_Q_;
-    }
-    for (int i = 0; i < validation_Q_3D.size(); ++i) {
-        validation_Q_3D[i].pos() -= centroid_Q_;
-    }
-
-    for (int i = 0; i < hull_Q_3D.size(); ++i) {
-        hull_Q_3D[i].pos() -= centroid_Q_;
-    }
 
     initKdTree();
-    // Compute the diameter of P approximately (randomly). This is far from being
-    // Guaranteed close to the diameter but gives good results for most common
-    // objects if they are densely sampled.
-    P_diameter_ = 0.0;
-    for (int i = 0; i < kNumberOfDiameterTrials; ++i) {
-        int at = rand() % sampled_Q_3D_.size();
-        int bt = rand() % sampled_Q_3D_.size();
-
-        Scalar l = (sampled_Q_3D_[bt].pos() - sampled_Q_3D_[at].pos()).norm();
-        if (l > P_diameter_) {
-            P_diameter_ = l;
-        }
-    }
+    // Diameter of the model, computed once in the ModelContext
+    P_diameter_ = model_->diameter();
 
     // Normalize the delta (See the paper) and the maximum base distance.
     // delta = P_mean_distance_ * delta;
@@ -304,24 +356,30 @@ void Match4PCSBase::init(const std::vector<Point3D>& P,
     rot_disc = 10;
 
     baseSet.clear();
+    base_pool_.clear();
     allTransforms.clear();
 
+    random_seed_ = options_.random_seed ? options_.random_seed :
+      (unsigned int)std::chrono::system_clock::now().time_since_epoch().count();
+
+    // The coarse levels of WeightedVerify score prefixes of the validation points,
+    // shuffle them so that every prefix is a random subset.
+    std::mt19937 validation_generator = RandomStream(2, 0);
+    std::shuffle(validation_Q_3D.begin(), validation_Q_3D.end(), validation_generator);
+    validation_Q_pos_.resize(3, validation_Q_3D.size());
+    for (int i = 0; i < validation_Q_3D.size(); ++i) {
+        validation_Q_pos_.col(i) = validation_Q_3D[i].pos();
+    }
+
+    verification_stats_ = VerificationStats();
+    verification_stats_.pruned_at_level.assign(kVerifyLevels - 1, 0);
+
     current_trial_ = 0;
     best_LCP_ = 0.0;
     best_lcp_index = -1;
 
     // call Virtual handler
-    Initialize(P, Q);
-
-    // Reading the probability image
-    cv::Mat probImgRaw = cv::imread(probImagePath, CV_16UC1);
-    cv::Mat probImg = cv::Mat::zeros(probImgRaw.rows, probImgRaw.cols, CV_32FC1);
-    for(int u=0; u<probImgRaw.rows; u++)
-      for(int v=0; v<probImgRaw.cols; v++){
-        unsigned short probShort = probImgRaw.at<unsigned short>(u,v);
-        float prob = (float)probShort/10000;
-        probImg.at<float>(u, v) = prob;
-      }
+    Initialize(P, sampled_Q_3D_);
 
     // Priority based sampling
     for (int i = 0; i < sampled_P_3D_.size(); ++i) {
@@ -335,13 +393,28 @@ void Match4PCSBase::init(const std::vector<Point3D>& P,
       int col = point2D[0]/point2D[2];
       int row = point2D[1]/point2D[2];
 
-      orig_probabilities_.push_back(probImg.at<float>(row, col));
+      // the probability map only covers its region, zero outside
+      int probRow = row - probOrigin.y;
+      int probCol = col - probOrigin.x;
+      bool inside = probRow >= 0 && probRow < probImg.rows && probCol >= 0 && probCol < probImg.cols;
+      orig_probabilities_.push_back(inside ? probImg.at<float>(probRow, probCol) : 0.f);
       corr_pixels.push_back(std::make_pair(row,col));
     }
+    max_probability_ = orig_probabilities_.empty() ? 0.f :
+      *std::max_element(orig_probabilities_.begin(), orig_probabilities_.end());
 
     this->registered_indices.clear();
-    this->PPFMap = &PPFMap;
-    this->max_count_ppf = max_count_ppf;
+    this->PPFMap = &model_->PPFMap();
+    this->max_count_ppf = model_->maxCountPPF();
+
+    // the table is built by the first request of the model
+    if(options_.use_ppf_hough_voting)
+      ppf_table_ = &model_->votingTable([this](int first, int second) {
+        return float(computeAlpha(sampled_Q_3D_[first].pos(), sampled_Q_3D_[first].normal(),
+                                  sampled_Q_3D_[second].pos()));
+      });
+    else if(operMode == 1)
+      InitStoCSSampling();
 }
 
 void
@@ -357,12 +430,12 @@ Match4PCSBase::getRegisteredModel(const Eigen::Ref<const MatrixType> &mat) {
   for (int i = 0; i < number_of_points; ++i) {
 
     // Use the kdtree to get the nearest neighbor
-    Super4PCS::KdTree<Scalar>::Index resId =
-    kd_tree_.doQueryRestrictedClosestIndex(
+    Super4PCS::StaticKdTree::Index resId =
+    kd_tree_.queryRestrictedClosestIndex(
                 (mat * sampled_Q_3D_[i].pos().homogeneous()).head<3>(),
                 sq_eps);
 
-    if ( resId != Super4PCS::KdTree<Scalar>::invalidIndex() ) {
+    if ( resId != Super4PCS::StaticKdTree::invalidIndex() ) {
 
         VectorType n_q = mat.block<3,3>(0,0)*sampled_Q_3D_[i].normal();
         float angle_n = std::acos(sampled_P_3D_[resId].normal().dot(n_q))*180/M_PI;
@@ -414,6 +487,12 @@ bool Match4PCSBase::SelectRandomTriangle(int &base1, int &base2, int &base3) {
 // corresponding the the base pairing are computed.
 bool Match4PCSBase::TryQuadrilateral(Scalar &invariant1, Scalar &invariant2,
                                      int& id1, int& id2, int& id3, int& id4) {
+  return TryQuadrilateral(base_3D_, invariant1, invariant2, id1, id2, id3, id4);
+}
+
+bool Match4PCSBase::TryQuadrilateral(std::vector<Point3D> &base,
+                                     Scalar &invariant1, Scalar &invariant2,
+                                     int& id1, int& id2, int& id3, int& id4) {
 
   Scalar min_distance = std::numeric_limits<Scalar>::max();
   int best1, best2, best3, best4;
@@ -430,8 +509,8 @@ bool Match4PCSBase::TryQuadrilateral(Scalar &invariant1, Scalar &invariant2,
       // Compute the closest points on both segments, the corresponding
       // invariants and the distance between the closest points.
       Scalar segment_distance = distSegmentToSegment(
-                  base_3D_[i].pos(), base_3D_[j].pos(),
-                  base_3D_[k].pos(), base_3D_[l].pos(),
+                  base[i].pos(), base[j].pos(),
+                  base[k].pos(), base[l].pos(),
                   local_invariant1, local_invariant2);
       // Retail the smallest distance and the best order so far.
       if (segment_distance < min_distance) {
@@ -448,11 +527,11 @@ bool Match4PCSBase::TryQuadrilateral(Scalar &invariant1, Scalar &invariant2,
 
   if(best1 < 0 || best2 < 0 || best3 < 0 || best4 < 0 ) return false;
 
-  std::vector<Point3D> tmp = base_3D_;
-  base_3D_[0] = tmp[best1];
-  base_3D_[1] = tmp[best2];
-  base_3D_[2] = tmp[best3];
-  base_3D_[3] = tmp[best4];
+  std::vector<Point3D> tmp = base;
+  base[0] = tmp[best1];
+  base[1] = tmp[best2];
+  base[2] = tmp[best3];
+  base[3] = tmp[best4];
 
   std::array<int, 4> tmpId = {id1, id2, id3, id4};
   id1 = tmpId[best1];
@@ -579,214 +658,161 @@ bool Match4PCSBase::SelectQuadrilateral(Scalar& invariant1, Scalar& invariant2,
   return false;
 }
 
-bool Match4PCSBase::computePPF(int &pIdx1, int &pIdx2, std::vector<int> &ppf_) {
-  VectorType p1 = sampled_P_3D_[pIdx1].pos();
-  VectorType p2 = sampled_P_3D_[pIdx2].pos();
-  VectorType n1 = sampled_P_3D_[pIdx1].normal();
-  VectorType n2 = sampled_P_3D_[pIdx2].normal();
-  VectorType u = p1 - p2;
+// Binned point pair feature of (a, b), the key of PPFMap
+static inline void pairFeature(const Point3D& a, const Point3D& b, int trans_disc, int rot_disc, int* ppf_) {
+  const Point3D::VectorType& n1 = a.normal();
+  const Point3D::VectorType& n2 = b.normal();
+  const Point3D::VectorType u = a.pos() - b.pos();
 
   int ppf_1 = int(u.norm()*1000);
   int ppf_2 = int(atan2(n1.cross(u).norm(), n1.dot(u))*180/M_PI);
   int ppf_3 = int(atan2(n2.cross(u).norm(), n2.dot(u))*180/M_PI);
   int ppf_4 = int(atan2(n1.cross(n2).norm(), n1.dot(n2))*180/M_PI);
 
-  ppf_.push_back(approximate_bin(ppf_1, trans_disc));
-  ppf_.push_back(approximate_bin(ppf_2, rot_disc));
-  ppf_.push_back(approximate_bin(ppf_3, rot_disc));
-  ppf_.push_back(approximate_bin(ppf_4, rot_disc));
+  ppf_[0] = approximate_bin(ppf_1, trans_disc);
+  ppf_[1] = approximate_bin(ppf_2, rot_disc);
+  ppf_[2] = approximate_bin(ppf_3, rot_disc);
+  ppf_[3] = approximate_bin(ppf_4, rot_disc);
 }
 
-bool Match4PCSBase::SelectQuadrilateralStoCS(Scalar& invariant1, Scalar& invariant2,
-                                        int& base1, int& base2, int& base3,
-                                        int& base4, float& baseProbability) {
-  ofstream pFile;
-  std::vector<int> ppf_;
-  bool point_present;
-  float sum_probabilities;
+bool Match4PCSBase::computePPF(int &pIdx1, int &pIdx2, std::vector<int> &ppf_) {
+  int feature[4];
+  pairFeature(sampled_P_3D_[pIdx1], sampled_P_3D_[pIdx2], trans_disc, rot_disc, feature);
+  ppf_.insert(ppf_.end(), feature, feature + 4);
+  return true;
+}
 
-  std::vector<float> curr_probabilities_(orig_probabilities_);
-  
-  // Select point 1
-  unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-  std::default_random_engine generator (seed);
-  std::discrete_distribution<int> p_dist_1 (curr_probabilities_.begin(),curr_probabilities_.end());
-  base1 = p_dist_1(generator);
-  baseProbability = curr_probabilities_[base1];
+void Match4PCSBase::InitStoCSSampling() {
+  const int n = sampled_P_3D_.size();
 
-  // for (int i = 0; i < curr_probabilities_.size(); i++) {
-  //   ofstream pFile1;
-  //   pFile1.open ("/home/chaitanya/Desktop/b1.txt", std::ofstream::out | std::ofstream::app);
-  //   pFile1 << corr_pixels[i].first << " " << corr_pixels[i].second << " " << curr_probabilities_[i] << std::endl;
-  //   pFile1.close();
-  // }
+  probable_points_.assign((n + 63) / 64, 0);
+  for (int i = 0; i < n; i++)
+    if(orig_probabilities_[i] != 0)
+      setBit(probable_points_.data(), i);
 
-  // Select point 2
-  sum_probabilities = 0;
-  point_present = false;
-  for (int i = 0; i < sampled_P_3D_.size(); i++) {
-    if(i == base1 || curr_probabilities_[i] == 0) {
-      curr_probabilities_[i] = 0;
-      continue;
+  // points without probability are never part of a base, their rows and columns stay empty
+  int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  ppf_compat_.build(n, num_threads, [this, n](int i, uint64_t *row) {
+    if(orig_probabilities_[i] == 0)
+      return;
+    std::vector<int> ppf_;
+    for (int j = 0; j < n; j++) {
+      if(j == i || orig_probabilities_[j] == 0)
+        continue;
+      ppf_.clear();
+      computePPF(i, j, ppf_);
+      if(PPFMap->find(ppf_) != PPFMap->end())
+        setBit(row, j);
     }
+  });
 
-    // computing edge factor
-    ppf_.clear();
-    computePPF(base1, i, ppf_);
-    auto it = PPFMap->find(ppf_);
-    float edge_i_0 = (it == PPFMap->end()) ? 0:1;
+  first_point_sampler_.build(orig_probabilities_);
+}
 
-    curr_probabilities_[i] = orig_probabilities_[i]*
-      orig_probabilities_[base1]*
-      edge_i_0;
+std::mt19937 Match4PCSBase::RandomStream(int stage, int index) const {
+  std::seed_seq seq{random_seed_, (unsigned int)stage, (unsigned int)index};
+  return std::mt19937(seq);
+}
 
-    if(curr_probabilities_[i] != 0) point_present = true;
+bool Match4PCSBase::SelectQuadrilateralStoCS(Scalar& invariant1, Scalar& invariant2,
+                                        int& base1, int& base2, int& base3,
+                                        int& base4, float& baseProbability,
+                                        std::mt19937& generator) {
+  // Each point is drawn with probability proportional to its own probability, among the
+  // points whose pair feature with the previous base point is present on the model.
+  // The candidate sets are bit sets, intersected with the rows of ppf_compat_.
+  if (first_point_sampler_.empty())
+    return false;
 
-    sum_probabilities += curr_probabilities_[i];
-  }
-  if(point_present == false) return false;
-  
-  // update the probability distribution
-  for (int i = 0; i < sampled_P_3D_.size(); i++)
-    curr_probabilities_[i] /= sum_probabilities;
-  
-  std::discrete_distribution<int> p_dist_2 (curr_probabilities_.begin(), curr_probabilities_.end());
-  base2 = p_dist_2(generator);
-  baseProbability = baseProbability*curr_probabilities_[base2];
+  const int words = ppf_compat_.wordsPerRow();
+  std::vector<uint64_t> candidates(probable_points_);
+  float mass;
 
-  // for (int i = 0; i < curr_probabilities_.size(); i++) {
-  //   ofstream pFile1;
-  //   pFile1.open ("/home/chaitanya/Desktop/b2.txt", std::ofstream::out | std::ofstream::app);
-  //   pFile1 << corr_pixels[i].first << " " << corr_pixels[i].second << " " << curr_probabilities_[i] << std::endl;
-  //   pFile1.close();
-  // }
+  // Select point 1
+  base1 = first_point_sampler_.sample(generator);
+  baseProbability = orig_probabilities_[base1];
+
+  // Select point 2
+  const uint64_t *row_1 = ppf_compat_.row(base1);
+  for (int w = 0; w < words; w++)
+    candidates[w] &= row_1[w];
+  clearBit(candidates.data(), base1);
+
+  base2 = sampleFromBitset(candidates.data(), words, orig_probabilities_, generator, mass);
+  if (base2 < 0) return false;
+  baseProbability = baseProbability*orig_probabilities_[base2]/mass;
 
   // Select point 3
-  sum_probabilities = 0;
-  point_present = false;
+  const uint64_t *row_2 = ppf_compat_.row(base2);
+  for (int w = 0; w < words; w++)
+    candidates[w] &= row_2[w];
+  clearBit(candidates.data(), base2);
+
   VectorType v_1 = sampled_P_3D_[base2].pos() - sampled_P_3D_[base1].pos();
-  for (int i = 0; i < sampled_P_3D_.size(); i++) {
+  forEachSetBit(candidates.data(), words, [&](int i) {
     VectorType v_2 = sampled_P_3D_[i].pos() - sampled_P_3D_[base1].pos();
     float int_angle = acos(v_1.dot(v_2))*180/M_PI;
     int_angle = std::min(int_angle, 180-int_angle);
+    if (int_angle < 30)
+      clearBit(candidates.data(), i);
+  });
 
-    if(i == base1 || i == base2 || curr_probabilities_[i] == 0 || int_angle < 30){
-      curr_probabilities_[i] = 0;
-      continue;
-    }
-
-    // computing edge factor
-    ppf_.clear();
-    computePPF(base2, i, ppf_);
-
-    auto it = PPFMap->find(ppf_);
-    float edge_i_1 = (it == PPFMap->end()) ? 0:1;
-
-    curr_probabilities_[i] = curr_probabilities_[i]*
-      orig_probabilities_[base2]*
-      edge_i_1;
-
-    if(curr_probabilities_[i] != 0) point_present = true;
-    sum_probabilities += curr_probabilities_[i];
-  }
-  if(point_present == false) return false;
+  base3 = sampleFromBitset(candidates.data(), words, orig_probabilities_, generator, mass);
+  if (base3 < 0) return false;
+  baseProbability = baseProbability*orig_probabilities_[base3]/mass;
 
-  // update the probability distribution
-  for (int i = 0; i < sampled_P_3D_.size(); i++)
-    curr_probabilities_[i] /= sum_probabilities;
-
-  std::discrete_distribution<int> p_dist_3 (curr_probabilities_.begin(), curr_probabilities_.end());
-  base3 = p_dist_3(generator);
-  baseProbability = baseProbability*curr_probabilities_[base3];
-
-  // for (int i = 0; i < curr_probabilities_.size(); i++) {
-  //   ofstream pFile1;
-  //   pFile1.open ("/home/chaitanya/Desktop/b3.txt", std::ofstream::out | std::ofstream::app);
-  //   pFile1 << corr_pixels[i].first << " " << corr_pixels[i].second << " " << curr_probabilities_[i] << std::endl;
-  //   pFile1.close();
-  // }
-  
   // Select point 4
-  sum_probabilities = 0;
-  point_present = false;
-  for (int i = 0; i < sampled_P_3D_.size(); i++) {
-    if(i == base1 || i == base2 || i == base3 || curr_probabilities_[i] == 0){
-      curr_probabilities_[i] = 0;
-      continue;
-    }
-
-    // The 4th point will be a one that is close to be planar
-    double x1 = sampled_P_3D_[base1].x();
-    double y1 = sampled_P_3D_[base1].y();
-    double z1 = sampled_P_3D_[base1].z();
-    double x2 = sampled_P_3D_[base2].x();
-    double y2 = sampled_P_3D_[base2].y();
-    double z2 = sampled_P_3D_[base2].z();
-    double x3 = sampled_P_3D_[base3].x();
-    double y3 = sampled_P_3D_[base3].y();
-    double z3 = sampled_P_3D_[base3].z();
-
-    // Fit a plane
-    Scalar denom = (-x3 * y2 * z1 + x2 * y3 * z1 + x3 * y1 * z2 - x1 * y3 * z2 -
-                    x2 * y1 * z3 + x1 * y2 * z3);
-
-    if (denom != 0) {
-      Scalar A =
-          (-y2 * z1 + y3 * z1 + y1 * z2 - y3 * z2 - y1 * z3 + y2 * z3) / denom;
-      Scalar B =
-          (x2 * z1 - x3 * z1 - x1 * z2 + x3 * z2 + x1 * z3 - x2 * z3) / denom;
-      Scalar C =
-          (-x2 * y1 + x3 * y1 + x1 * y2 - x3 * y2 - x1 * y3 + x2 * y3) / denom;
-
+  const uint64_t *row_3 = ppf_compat_.row(base3);
+  for (int w = 0; w < words; w++)
+    candidates[w] &= row_3[w];
+  clearBit(candidates.data(), base3);
+
+  // The 4th point will be a one that is close to be planar
+  double x1 = sampled_P_3D_[base1].x();
+  double y1 = sampled_P_3D_[base1].y();
+  double z1 = sampled_P_3D_[base1].z();
+  double x2 = sampled_P_3D_[base2].x();
+  double y2 = sampled_P_3D_[base2].y();
+  double z2 = sampled_P_3D_[base2].z();
+  double x3 = sampled_P_3D_[base3].x();
+  double y3 = sampled_P_3D_[base3].y();
+  double z3 = sampled_P_3D_[base3].z();
+
+  // Fit a plane
+  Scalar denom = (-x3 * y2 * z1 + x2 * y3 * z1 + x3 * y1 * z2 - x1 * y3 * z2 -
+                  x2 * y1 * z3 + x1 * y2 * z3);
+
+  if (denom != 0) {
+    Scalar A =
+        (-y2 * z1 + y3 * z1 + y1 * z2 - y3 * z2 - y1 * z3 + y2 * z3) / denom;
+    Scalar B =
+        (x2 * z1 - x3 * z1 - x1 * z2 + x3 * z2 + x1 * z3 - x2 * z3) / denom;
+    Scalar C =
+        (-x2 * y1 + x3 * y1 + x1 * y2 - x3 * y2 - x1 * y3 + x2 * y3) / denom;
+
+    forEachSetBit(candidates.data(), words, [&](int i) {
       Scalar planar_distance = std::abs(A * sampled_P_3D_[i].x() + B * sampled_P_3D_[i].y() +
         C * sampled_P_3D_[i].z() - 1.0);
 
       if(planar_distance > 0.01 ||
         (sampled_P_3D_[i].pos()- sampled_P_3D_[base1].pos()).norm() < 0.01 || 
         (sampled_P_3D_[i].pos()- sampled_P_3D_[base2].pos()).norm() < 0.01 || 
-        (sampled_P_3D_[i].pos()- sampled_P_3D_[base3].pos()).norm() < 0.01 ) {
-        curr_probabilities_[i] = 0;
-        continue;  
-      }
-    }
-
-    // computing edge factor
-    ppf_.clear();
-    computePPF(base3, i, ppf_);
-    auto it = PPFMap->find(ppf_);
-    float edge_i_2 = (it == PPFMap->end()) ? 0:1;
-
-    curr_probabilities_[i] =  curr_probabilities_[i]*
-      orig_probabilities_[base3]*
-      edge_i_2;
-
-    if(curr_probabilities_[i] != 0) point_present = true;
-    sum_probabilities += curr_probabilities_[i];
+        (sampled_P_3D_[i].pos()- sampled_P_3D_[base3].pos()).norm() < 0.01 )
+        clearBit(candidates.data(), i);
+    });
   }
 
-  if(point_present == false) return false;
-
-  // update the probability distribution
-  for (int i = 0; i < sampled_P_3D_.size(); i++)
-    curr_probabilities_[i] /= sum_probabilities;
-
-  std::discrete_distribution<int> p_dist_4 (curr_probabilities_.begin(),curr_probabilities_.end());
-  base4 = p_dist_4(generator);
-  baseProbability = baseProbability*curr_probabilities_[base4];
-
-  // for (int i = 0; i < curr_probabilities_.size(); i++) {
-  //   ofstream pFile1;
-  //   pFile1.open ("/home/chaitanya/Desktop/b4.txt", std::ofstream::out | std::ofstream::app);
-  //   pFile1 << corr_pixels[i].first << " " << corr_pixels[i].second << " " << curr_probabilities_[i] << std::endl;
-  //   pFile1.close();
-  // }
+  base4 = sampleFromBitset(candidates.data(), words, orig_probabilities_, generator, mass);
+  if (base4 < 0) return false;
+  baseProbability = baseProbability*orig_probabilities_[base4]/mass;
 
-  base_3D_[0] = sampled_P_3D_[base1];
-  base_3D_[1] = sampled_P_3D_[base2];
-  base_3D_[2] = sampled_P_3D_[base3];
-  base_3D_[3] = sampled_P_3D_[base4];
+  std::vector<Point3D> base(4);
+  base[0] = sampled_P_3D_[base1];
+  base[1] = sampled_P_3D_[base2];
+  base[2] = sampled_P_3D_[base3];
+  base[3] = sampled_P_3D_[base4];
 
-  TryQuadrilateral(invariant1, invariant2, base1, base2, base3, base4);
+  TryQuadrilateral(base, invariant1, invariant2, base1, base2, base3, base4);
 
   return true;
 }
@@ -985,74 +1011,65 @@ bool Match4PCSBase::FindCongruentQuadrilateralsV4PCS(std::vector<std::pair<int,
                                                      float &distance4, float &distance5, float &distance6,
                                                      float &distance_threshold, std::vector<match_4pcs::Quadrilateral>* quadrilaterals) {
   if (quadrilaterals == nullptr) return false;
-  
-  std::map<std::pair<int, float>, std::vector<int> > connectivity_map_2, connectivity_map_3;
-  addToConnectivityMap(pairs2, distance2, connectivity_map_2);
-  addToConnectivityMap(pairs3, distance3, connectivity_map_3);
-
-  std::map<std::pair<int, int>, int > connectivity_map_4, connectivity_map_5, connectivity_map_6;
-  addToConnectivityPresenceMap(pairs4, distance4, connectivity_map_4);
-  addToConnectivityPresenceMap(pairs5, distance5, connectivity_map_5);
-  addToConnectivityPresenceMap(pairs6, distance6, connectivity_map_6);
-
-  quadrilaterals->clear();
-  std::unordered_set<std::tuple<int, int, int> > base_3;
-  base_3.clear();
-
-  for (size_t i = 0; i < pairs1.size(); ++i) {
-    // search for v1, d2 in the connectivity map to find candidates for v3
-    std::pair<int, Scalar> vertex_distance_pair = std::make_pair(pairs1[i].first, distance2);
-    std::map<std::pair<int, float>, std::vector<int> >::iterator it = connectivity_map_2.find(vertex_distance_pair);
-
-    if (it != connectivity_map_2.end()) {
-      std::vector<int> vertices = it->second;
-      for(int j=0; j < vertices.size(); j++){
-        std::map<std::pair<int, int>, int >::iterator conn_it4 = connectivity_map_4.find(std::make_pair(vertices[j], pairs1[i].second));
-        if (conn_it4 != connectivity_map_4.end())
-          base_3.insert(std::make_tuple(pairs1[i].first, pairs1[i].second, vertices[j]));
-      }
-    }
-  }
-
-  // std::cout << "distances: " << distance1 << " " << distance2 << " " << distance3 << " " << distance4 << " " << distance5 << " " << distance6 << std::endl;
-  // std::cout << "base 3 size: " << base_3.size() << std::endl;
-
-  // search for v4
-  std::unordered_set<std::tuple<int, int, int> >::iterator base3_it;
-  for (base3_it = base_3.begin(); base3_it != base_3.end(); base3_it++){
-    int v1 = std::get<0>(*base3_it);
-    int v2 = std::get<1>(*base3_it);
-    int v3 = std::get<2>(*base3_it);
-
-    std::pair<int, Scalar> vertex_distance_pair = std::make_pair(v1, distance3);
-    std::map<std::pair<int, float>, std::vector<int> >::iterator it = connectivity_map_3.find(vertex_distance_pair);
 
-    if (it != connectivity_map_3.end()) {
-      std::vector<int> vertices = it->second;
-      for(int k=0; k < vertices.size(); k++){
-        std::map<std::pair<int, int>, int >::iterator conn_it5 = connectivity_map_5.find(std::make_pair(vertices[k], v2));
-        std::map<std::pair<int, int>, int >::iterator conn_it6 = connectivity_map_6.find(std::make_pair(vertices[k], v3));
-
-        if ((conn_it5 != connectivity_map_5.end()) && (conn_it6 != connectivity_map_6.end()))
-          quadrilaterals->emplace_back(v1, v2, v3, vertices[k]);
+  // Every pair set holds the model pairs of a single base edge, the neighbours of a vertex
+  // are looked up in flat adjacency arrays instead of maps keyed on (vertex, distance).
+  PairAdjacency adjacency_2, adjacency_3, adjacency_4, adjacency_5, adjacency_6;
+  adjacency_2.build(pairs2);
+  adjacency_3.build(pairs3);
+  adjacency_4.build(pairs4);
+  adjacency_5.build(pairs5);
+  adjacency_6.build(pairs6);
+
+  std::vector<std::pair<int, int> > edges_1(pairs1);
+  std::sort(edges_1.begin(), edges_1.end());
+  edges_1.erase(std::unique(edges_1.begin(), edges_1.end()), edges_1.end());
+
+  // The (v1, v2) edges are split in chunks matched in parallel, the tetrahedra are then
+  // concatenated in edge order so that the result does not depend on the scheduling.
+  const int num_chunks = (edges_1.size() + kV4PCSChunk - 1) / kV4PCSChunk;
+  const int num_threads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector< std::vector<match_4pcs::Quadrilateral> > chunk_quads(num_chunks);
+
+  runParallelTasks(num_chunks, num_threads, [&](int c) {
+    const int last = std::min(int(edges_1.size()), (c + 1) * kV4PCSChunk);
+    for (int i = c * kV4PCSChunk; i < last; ++i) {
+      const int v1 = edges_1[i].first;
+      const int v2 = edges_1[i].second;
+
+      // v3 at distance2 of v1 and distance4 of v2
+      const int *v3_begin, *v3_end, *v4_begin, *v4_end;
+      adjacency_2.neighbors(v1, v3_begin, v3_end);
+      adjacency_3.neighbors(v1, v4_begin, v4_end);
+      for (const int* v3 = v3_begin; v3 != v3_end; ++v3) {
+        if (!adjacency_4.contains(*v3, v2))
+          continue;
+
+        // v4 at distance3 of v1, distance5 of v2 and distance6 of v3
+        for (const int* v4 = v4_begin; v4 != v4_end; ++v4)
+          if (adjacency_5.contains(*v4, v2) && adjacency_6.contains(*v4, *v3))
+            chunk_quads[c].emplace_back(v1, v2, *v3, *v4);
       }
     }
+  });
 
-  } // iterate over triplets
+  quadrilaterals->clear();
+  for (int c = 0; c < num_chunks; ++c)
+    quadrilaterals->insert(quadrilaterals->end(), chunk_quads[c].begin(), chunk_quads[c].end());
 
   return true;
 }
 
 void Match4PCSBase::initKdTree(){
-  size_t number_of_points = sampled_P_3D_.size();
-
   // Build the kdtree.
-  kd_tree_ = Super4PCS::KdTree<Scalar>(number_of_points);
-
-  for (size_t i = 0; i < number_of_points; ++i) {
-    kd_tree_.add(sampled_P_3D_[i].pos());
-  }
-  kd_tree_.finalize();
+  kd_tree_.build(sampled_P_3D_.size(),
+                 [this](int i) { return sampled_P_3D_[i].pos(); });
+
+  // The LCP queries use a fixed radius of delta, the grid cells are sized for it.
+  if (options_.use_voxel_hash_verification)
+    voxel_grid_.build(sampled_P_3D_.size(),
+                      [this](int i) { return sampled_P_3D_[i].pos(); },
+                      options_.delta);
 }
 
 /*################################################################################################
@@ -1101,7 +1118,7 @@ static inline void TNormalize3(Eigen::Vector3d& v)
   }
 }
 
-void Match4PCSBase::computeTransformRT(VectorType& p1_t, const VectorType& n1_t, Eigen::Matrix3d& R, Eigen::Vector3d& t)
+void Match4PCSBase::computeTransformRT(const VectorType& p1_t, const VectorType& n1_t, Eigen::Matrix3d& R, Eigen::Vector3d& t) const
 {
   Eigen::Vector3d p1,n1;
   p1 << p1_t[0], p1_t[1], p1_t[2];
@@ -1131,18 +1148,14 @@ void Match4PCSBase::computeTransformRT(VectorType& p1_t, const VectorType& n1_t,
   t = -R * p1;
 }
 
-double Match4PCSBase::computeAlpha(VectorType& p1_t, const VectorType& n1_t, VectorType& p2_t)
+// Angle of p2 around the x axis of the local frame (R, Tmg) of a point
+static inline double alphaInFrame(const Eigen::Matrix3d& R, const Eigen::Vector3d& Tmg,
+                                  const Match4PCSBase::VectorType& p2_t)
 {
-  Eigen::Vector3d p1,n1,p2;
-  p1 << p1_t[0], p1_t[1], p1_t[2];
-  n1 << n1_t[0], n1_t[1], n1_t[2];
+  Eigen::Vector3d p2, mpt;
   p2 << p2_t[0], p2_t[1], p2_t[2];
-
-  Eigen::Vector3d Tmg, mpt;
-  Eigen::Matrix3d R;
   double alpha;
-  
-  computeTransformRT(p1_t, n1_t, R, Tmg);
+
   mpt = Tmg + R * p2;
   alpha=atan2(-mpt[2], mpt[1]);
 
@@ -1157,6 +1170,15 @@ double Match4PCSBase::computeAlpha(VectorType& p1_t, const VectorType& n1_t, Vec
   return (-alpha);
 }
 
+double Match4PCSBase::computeAlpha(const VectorType& p1_t, const VectorType& n1_t, const VectorType& p2_t) const
+{
+  Eigen::Vector3d Tmg;
+  Eigen::Matrix3d R;
+
+  computeTransformRT(p1_t, n1_t, R, Tmg);
+  return alphaInFrame(R, Tmg, p2_t);
+}
+
 /**
  * Compute a rotation in order to rotate around X direction
  */
@@ -1287,125 +1309,115 @@ bool Match4PCSBase::ComputeRigidTransformFromCongruentPairHough(std::vector<Supe
   return true;
 }
 
-bool Match4PCSBase::ComputeRigidTransformFromPPF(int reference_point_index,
-  std::vector< std::pair <Eigen::Isometry3d, float> > &allPose){ 
+int Match4PCSBase::ComputeRigidTransformFromPPF(int reference_point_index, std::vector<int> &accumulator,
+                                                Eigen::Matrix<Scalar, 4, 4> &transform) const {
+  const double angle_step = 2 * M_PI / kAlphaBins;
 
-  float angle_step = (12.0)*M_PI/180.0;
-  int numAlphaBins = (int) (floor (2 * M_PI / angle_step));
-  int numModelPoints = sampled_Q_3D_.size();
+  // the reference point on the segment is the origin of the local reference frame
+  const Point3D& s1 = sampled_P_3D_[reference_point_index];
+  Eigen::Vector3d tsg;
+  Eigen::Matrix3d Rsg;
+  computeTransformRT(s1.pos(), s1.normal(), Rsg, tsg);
 
-  int refIndMax = 0;
-  int alphaIndMax = 0;
+  int accIndMax = -1;
   int maxVotes = 0;
+  int ppf_[4];
+  for (int ii = 0; ii < sampled_P_3D_.size(); ii++) {
+    if (ii == reference_point_index)
+      continue;
 
-  std::vector<int> accumulator(numModelPoints*numAlphaBins, 0);
-
-  // the first point on the segment is the origin of the local reference frame
-  Point3D s1 = sampled_P_3D_[reference_point_index];
-  int total_computations = 0;
-  for (int ii=0; ii<sampled_P_3D_.size(); ii++) {
-    // get alpha_s
-    Point3D s2 = sampled_P_3D_[ii];
-    
-    double alpha_scene_1 = computeAlpha(s1.pos(), s1.normal(), s2.pos());
-
-    std::vector<std::pair<int, int>> pairs;
-    std::vector<int> ppf_;
-
-    computePPF(reference_point_index, ii, ppf_);
-    pairs.clear();
-
-    auto it = PPFMap->find(ppf_);
-    if(it != PPFMap->end())
-      pairs = it->second;
-
-    // std::cout << "voting for pairs: " << pairs.size() << std::endl; 
-    total_computations +=  pairs.size();
-    for (int jj = 0; jj < pairs.size(); jj++) {
-      // for the first pair
-      int model_index_1 = pairs[jj].first;
-      int model_index_2 = pairs[jj].second;
-
-      Point3D model_point_1 = sampled_Q_3D_[model_index_1];
-      Point3D model_point_2 = sampled_Q_3D_[model_index_2];
-
-      double alpha_model_1 = computeAlpha(model_point_1.pos(), model_point_1.normal(), model_point_2.pos());
-      double alpha_1 = alpha_model_1 - alpha_scene_1;
-      int alpha_index_1 = (int)(numAlphaBins*(alpha_1 + 2*M_PI) / (4*M_PI));
-      accumulator[model_index_1*numAlphaBins + alpha_index_1]++;
-    }
-  }
+    const Point3D& s2 = sampled_P_3D_[ii];
+    pairFeature(s1, s2, trans_disc, rot_disc, ppf_);
+    int begin, end;
+    ppf_table_->find(ppf_, begin, end);
+    if (begin == end)
+      continue;
 
-  // Maximize the accumulator
-  for (int k = 0; k < numModelPoints; k++)
-  {
-    for (int j = 0; j < numAlphaBins; j++)
-    {
-      const int accInd = k*numAlphaBins + j;
-      const int accVal = accumulator[ accInd ];
-      if (accVal > maxVotes)
-      {
+    // the model alpha of every pair is precomputed in ppf_table_
+    const double alpha_scene = alphaInFrame(Rsg, tsg, s2.pos());
+    for (int jj = begin; jj < end; jj++) {
+      const PPFHashTable::Entry& model_pair = ppf_table_->entry(jj);
+      int alpha_index = int(std::floor((model_pair.value - alpha_scene) / angle_step)) % kAlphaBins;
+      if (alpha_index < 0)
+        alpha_index += kAlphaBins;
+
+      const int accInd = model_pair.first * kAlphaBins + alpha_index;
+      const int accVal = ++accumulator[accInd];
+      if (accVal > maxVotes) {
         maxVotes = accVal;
-        refIndMax = k;
-        alphaIndMax = j;
+        accIndMax = accInd;
       }
     }
   }
 
-  std::cout << "numModelPoints: " << numModelPoints << std::endl;
-  std::cout << "numAlphaBins: " << numAlphaBins << std::endl;
-  std::cout << "total_computations: " << total_computations << std::endl;
-
-  Point3D best_model_point;
-  
-  Eigen::Matrix4d Talpha;
-  double alpha;
-
-  Eigen::Vector3d tsg;
-  Eigen::Matrix3d Rsg;
-  Eigen::Matrix3d RInv;
-
-  Eigen::Vector3d tmg;
-  Eigen::Matrix3d Rmg;
-  Eigen::Vector3d tInv;
-
-  Eigen::Matrix4d TsgInv;
-  Eigen::Matrix4d Tmg;
+  if (maxVotes == 0)
+    return 0;
+  std::fill(accumulator.begin(), accumulator.end(), 0);
 
-  computeTransformRT(s1.pos(), s1.normal(), Rsg, tsg);
+  Eigen::Vector3d tmg, tInv, t(0, 0, 0);
+  Eigen::Matrix3d Rmg, RInv, R;
+  Eigen::Matrix4d TsgInv, Tmg, Talpha;
 
   RInv = Rsg.transpose();
   tInv = -RInv * tsg;
-
   rtToPose(RInv, tInv, TsgInv);
 
-  best_model_point = sampled_Q_3D_[refIndMax];
-
+  const Point3D& best_model_point = sampled_Q_3D_[accIndMax / kAlphaBins];
   computeTransformRT(best_model_point.pos(), best_model_point.normal(), Rmg, tmg);
-
   rtToPose(Rmg, tmg, Tmg);
 
-  alpha = (alphaIndMax*(4*M_PI))/numAlphaBins-2*M_PI;
-
-  Eigen::Matrix3d R;
-  Eigen::Vector3d t;
-  t << 0, 0, 0;
+  // center of the alpha bin
+  const double alpha = (accIndMax % kAlphaBins + 0.5) * angle_step;
   getUnitXRotation(alpha, R);
   rtToPose(R, t, Talpha);
 
-  Eigen::Matrix4d rawPose = TsgInv * (Talpha * Tmg);
+  // between the centered clouds, as the transforms of the congruent sets
+  const Eigen::Matrix4d rawPose = TsgInv * (Talpha * Tmg);
+  transform = rawPose.cast<Scalar>();
 
-  Eigen::Matrix<float, 4, 4> transformation;
-  transformation << rawPose(0,0), rawPose(0,1), rawPose(0,2), rawPose(0,3),
-                    rawPose(1,0), rawPose(1,1), rawPose(1,2), rawPose(1,3),
-                    rawPose(2,0), rawPose(2,1), rawPose(2,2), rawPose(2,3),
-                    rawPose(3,0), rawPose(3,1), rawPose(3,2), rawPose(3,3);
+  return maxVotes;
+}
+
+void Match4PCSBase::ClusterVotedPoses(std::vector<std::pair<Eigen::Matrix<Scalar, 4, 4>, int> > &poses) const {
+  // same cluster within two alpha bins and a tenth of the model diameter
+  const Scalar max_angle = 2 * 2 * M_PI / kAlphaBins;
+  const Scalar max_translation = 0.1 * P_diameter_;
 
-  std::cout << "rawPose: " << rawPose << std::endl;
+  auto byVotes = [](const std::pair<MatrixType, int> &a, const std::pair<MatrixType, int> &b) {
+    return a.second > b.second;
+  };
+  std::stable_sort(poses.begin(), poses.end(), byVotes);
+
+  // each pose joins the first cluster within the thresholds of its seed, the grid only
+  // skips the seeds that cannot be
+  std::vector<std::pair<MatrixType, int> > clusters;
+  PoseGrid grid(max_angle, max_translation);
+  std::vector<int> candidates;
+  for (const auto &pose : poses) {
+    grid.Candidates(pose.first, candidates);
+    auto cluster = clusters.end();
+    for (int id : candidates) {
+      const MatrixType &seed = clusters[id].first;
+      const Eigen::Matrix<Scalar, 3, 3> relative =
+        seed.block<3,3>(0,0).transpose() * pose.first.block<3,3>(0,0);
+      const Scalar cos_angle = std::max(Scalar(-1), std::min(Scalar(1), (relative.trace() - 1) / 2));
+      if (std::acos(cos_angle) < max_angle &&
+          (seed.block<3,1>(0,3) - pose.first.block<3,1>(0,3)).norm() < max_translation) {
+        cluster = clusters.begin() + id;
+        break;
+      }
+    }
 
-  allPose.push_back(std::make_pair(convertToIsometry3d(transformation), maxVotes));
+    if (cluster != clusters.end()) {
+      cluster->second += pose.second;
+    } else {
+      grid.Insert(pose.first, clusters.size());
+      clusters.push_back(pose);
+    }
+  }
 
-  return true;
+  std::stable_sort(clusters.begin(), clusters.end(), byVotes);
+  poses.swap(clusters);
 }
 
 bool Match4PCSBase::ComputeRigidTransformFromCongruentPair(
@@ -1414,7 +1426,8 @@ bool Match4PCSBase::ComputeRigidTransformFromCongruentPair(
         int base_id3,
         int base_id4,
         match_4pcs::Quadrilateral &congruent_quad,
-        std::vector< std::pair <Eigen::Isometry3d, float> > &allPose){
+        std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
+        std::vector<Eigen::Matrix<Scalar, 4, 4> > &transforms){
 
   std::array<std::pair<Point3D, Point3D>,4> congruent_points;
 
@@ -1465,7 +1478,7 @@ bool Match4PCSBase::ComputeRigidTransformFromCongruentPair(
                              );             // state: compute scale ratio ?
 
   if(ok && rms >= Scalar(0.)) {
-    allTransforms.push_back(transform);
+    transforms.push_back(transform);
 
     Eigen::Matrix<float, 4, 4> transformation;
     transformation = transform;
@@ -1696,8 +1709,9 @@ float Match4PCSBase::c_dist_mean(int index_1, int index_2) {
 // distance at most (normalized) delta from some point in Q. In the paper
 // we describe randomized verification. We apply deterministic one here with
 // early termination. It was found to be fast in practice.
+template <typename SpatialIndex>
 Match4PCSBase::Scalar
-Match4PCSBase::Verify(const Eigen::Ref<const MatrixType> &mat) {
+Match4PCSBase::Verify(const SpatialIndex &index, const Eigen::Ref<const MatrixType> &mat) {
 
   // We allow factor 2 scaling in the normalization.
   const Scalar epsilon = options_.delta;
@@ -1709,60 +1723,151 @@ Match4PCSBase::Verify(const Eigen::Ref<const MatrixType> &mat) {
 
   const Scalar sq_eps = epsilon*epsilon;
 
-  for (int i = 0; i < number_of_points; ++i) {
+  // The points are transformed a chunk at a time, each chunk is small enough to
+  // keep the early termination effective.
+  Eigen::Matrix<Scalar, 3, Eigen::Dynamic, 0, 3, kVerifyChunk> moved;
+  const Eigen::Matrix<Scalar, 3, 3> rot = mat.block<3,3>(0,0);
+  const VectorType trans = mat.block<3,1>(0,3);
 
-    // Use the kdtree to get the nearest neighbor
-    Super4PCS::KdTree<Scalar>::Index resId =
-    kd_tree_.doQueryRestrictedClosestIndex(
-                (mat * validation_Q_3D[i].pos().homogeneous()).head<3>(),
-                sq_eps);
+  for (int begin = 0; begin < number_of_points; begin += kVerifyChunk) {
+    const int size = std::min(int(kVerifyChunk), int(number_of_points) - begin);
+    moved.noalias() = rot * validation_Q_pos_.middleCols(begin, size);
+    moved.colwise() += trans;
+
+    for (int j = 0; j < size; ++j) {
+      const int i = begin + j;
 
-    if ( resId != Super4PCS::KdTree<Scalar>::invalidIndex() )
-        good_points++;
+      // Use the spatial index to check for a neighbor
+      if ( index.hasNeighbor(moved.col(j), sq_eps) )
+          good_points++;
 
-    // We can terminate if there is no longer chance to get better than the
-    // current best LCP.
-    if (number_of_points - i + good_points < terminate_value) {
-      break;
+      // We can terminate if there is no longer chance to get better than the
+      // current best LCP.
+      if (number_of_points - i + good_points < terminate_value) {
+        return Scalar(good_points) / Scalar(number_of_points);
+      }
     }
   }
 
   return Scalar(good_points) / Scalar(number_of_points);
 }
 
-Match4PCSBase::Scalar
-Match4PCSBase::WeightedVerify(const Eigen::Ref<const MatrixType> &mat, std::vector<int> &temp_registered_indices) {
+// Weighted LCP: sum of the probabilities of the points of P matched by the points of Q,
+// with compatible normals. The score is computed coarse to fine on growing prefixes of
+// the (shuffled) validation points. After each coarse level the score is bounded by
+// assuming that all the remaining points match the most probable point of P, and the
+// transform is discarded when that bound cannot beat the best LCP: Perform_N_steps only
+// keeps the transforms improving it. A discarded transform gets its partial score.
+//
+// A block of transforms is scored in one sweep over the validation points: each point
+// is transformed by all the matrices at once (one SIMD lane per transform) and the
+// spatial index is probed for each transform still alive, so the validation cloud is
+// read once per block rather than once per transform.
+template <typename SpatialIndex>
+void
+Match4PCSBase::WeightedVerify(const SpatialIndex &index, const MatrixType *mats, int count, Scalar *lcps,
+                              std::vector<int> *temp_registered_indices) {
+  typedef Eigen::Array<Scalar, kVerifyBlock, 1> BlockArray;
 
   // We allow factor 2 scaling in the normalization.
   const Scalar epsilon = options_.delta;
-  
-  float weighted_match = 0;
 
-  const size_t number_of_points = validation_Q_3D.size();
+  const int number_of_points = validation_Q_3D.size();
+  const float threshold = best_LCP_ * number_of_points;
 
   const Scalar sq_eps = epsilon*epsilon;
 
-  for (int i = 0; i < number_of_points; ++i) {
+  verification_stats_.num_verified += count;
 
-    // Use the kdtree to get the nearest neighbor
-    Super4PCS::KdTree<Scalar>::Index resId =
-    kd_tree_.doQueryRestrictedClosestIndex(
-                (mat * validation_Q_3D[i].pos().homogeneous()).head<3>(),
-                sq_eps);
+  // coefficients of the first three rows of the matrices, the unused lanes repeat
+  // the last matrix
+  BlockArray coeffs[3][4];
+  for (int k = 0; k < kVerifyBlock; ++k) {
+    const MatrixType &mat = mats[std::min(k, count - 1)];
+    for (int row = 0; row < 3; ++row)
+      for (int col = 0; col < 4; ++col)
+        coeffs[row][col](k) = mat(row, col);
+  }
 
-    if ( resId != Super4PCS::KdTree<Scalar>::invalidIndex() ) {
+  float weighted_match[kVerifyBlock];
+  bool alive[kVerifyBlock];
+  for (int k = 0; k < count; ++k) {
+    weighted_match[k] = 0;
+    alive[k] = true;
+  }
+  int num_alive = count;
 
-        VectorType n_q = mat.block<3,3>(0,0)*validation_Q_3D[i].normal();
-        float angle_n = std::acos(sampled_P_3D_[resId].normal().dot(n_q))*180/M_PI;
-        angle_n = std::min(angle_n, fabs(180-angle_n));
-        if(angle_n < 30){
-          weighted_match += orig_probabilities_[resId];
-          temp_registered_indices.push_back(resId);
+  int begin = 0;
+  for (int level = 0; level < kVerifyLevels && num_alive; ++level) {
+    const int end = number_of_points >> (kVerifyLevels - 1 - level);
+    if (end <= begin)
+      continue;
+
+    for (int i = begin; i < end; ++i) {
+      const VectorType &p = validation_Q_3D[i].pos();
+      const BlockArray x = coeffs[0][0] * p.x() + coeffs[0][1] * p.y() + coeffs[0][2] * p.z() + coeffs[0][3];
+      const BlockArray y = coeffs[1][0] * p.x() + coeffs[1][1] * p.y() + coeffs[1][2] * p.z() + coeffs[1][3];
+      const BlockArray z = coeffs[2][0] * p.x() + coeffs[2][1] * p.y() + coeffs[2][2] * p.z() + coeffs[2][3];
+
+      for (int k = 0; k < count; ++k) {
+        if (!alive[k])
+          continue;
+
+        // Use the spatial index to get the nearest neighbor
+        const typename SpatialIndex::Index resId =
+          index.queryRestrictedClosestIndex(VectorType(x(k), y(k), z(k)), sq_eps);
+
+        if ( resId != SpatialIndex::invalidIndex() ) {
+
+            VectorType n_q = mats[k].template block<3,3>(0,0)*validation_Q_3D[i].normal();
+            float angle_n = std::acos(sampled_P_3D_[resId].normal().dot(n_q))*180/M_PI;
+            angle_n = std::min(angle_n, fabs(180-angle_n));
+            if(angle_n < 30){
+              weighted_match[k] += orig_probabilities_[resId];
+              temp_registered_indices[k].push_back(resId);
+            }
         }
+      }
+    }
+    begin = end;
+
+    if (end < number_of_points) {
+      for (int k = 0; k < count; ++k) {
+        if (alive[k] && weighted_match[k] + (number_of_points - end) * max_probability_ < threshold) {
+          alive[k] = false;
+          num_alive--;
+          verification_stats_.pruned_at_level[level]++;
+        }
+      }
     }
   }
 
-  return weighted_match / Scalar(number_of_points);
+  for (int k = 0; k < count; ++k)
+    lcps[k] = weighted_match[k] / Scalar(number_of_points);
+}
+
+Match4PCSBase::Scalar
+Match4PCSBase::Verify(const Eigen::Ref<const MatrixType> &mat) {
+  if (options_.use_voxel_hash_verification)
+    return Verify(voxel_grid_, mat);
+  return Verify(kd_tree_, mat);
+}
+
+void
+Match4PCSBase::WeightedVerify(const MatrixType *mats, int count, Scalar *lcps,
+                              std::vector<int> *temp_registered_indices) {
+  if (options_.use_voxel_hash_verification)
+    WeightedVerify(voxel_grid_, mats, count, lcps, temp_registered_indices);
+  else
+    WeightedVerify(kd_tree_, mats, count, lcps, temp_registered_indices);
+}
+
+Match4PCSBase::Scalar
+Match4PCSBase::WeightedVerify(const Eigen::Ref<const MatrixType> &mat, std::vector<int> &temp_registered_indices) {
+  const MatrixType transform = mat;
+  Scalar lcp;
+  WeightedVerify(&transform, 1, &lcp, &temp_registered_indices);
+  return lcp;
 }
 
 // The main 4PCS function. Computes the best rigid transformation and transfoms
@@ -1775,14 +1880,38 @@ Match4PCSBase::ComputeTransformation(const std::vector<Point3D>& P,
                                      Eigen::Isometry3d &bestPose, 
                                      std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
                                      std::string probImagePath, std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf, 
-                                     Eigen::Matrix3f camIntrinsic, std::string objName, std::string scenePath, std::vector<int> &registered_points) {
+                                     Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath, std::vector<int> &registered_points) {
 
   if (Q == nullptr) return kLargeNumber;
 
-  hull_Q_3D = *Q_hull;
-  init(P, *Q, *Q_validation, probImagePath, camIntrinsic, objName, PPFMap, max_count_ppf);
+  std::shared_ptr<const ModelContext> model =
+    std::make_shared<ModelContext>(*Q, *Q_validation, *Q_hull, PPFMap, max_count_ppf);
+  // Reading the probability image
+  cv::Mat probImage;
+  depth_codec::readImage(probImagePath, probImage, false);
 
-  Perform_N_steps(Q, allPose, scenePath, objName);
+  return ComputeTransformation(P, model, bestPose, allPose, probImage, cv::Point(0, 0), camIntrinsic,
+                               objName, debugPath, registered_points);
+}
+
+// Same as above, the model side is shared by all the requests of the model
+Match4PCSBase::Scalar
+Match4PCSBase::ComputeTransformation(const std::vector<Point3D>& P,
+                                     std::shared_ptr<const ModelContext> model,
+                                     Eigen::Isometry3d &bestPose,
+                                     std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
+                                     const cv::Mat& probImage, cv::Point probOrigin,
+                                     Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath, std::vector<int> &registered_points) {
+
+  if (model == nullptr) return kLargeNumber;
+
+  init(P, model, probImage, probOrigin, camIntrinsic, objName);
+  std::vector<Point3D>* Q = &sampled_Q_3D_;
+
+  if (options_.use_ppf_hough_voting)
+    Perform_Hough_Voting(Q, allPose, debugPath, objName);
+  else
+    Perform_N_steps(Q, allPose, debugPath, objName);
 
   if(best_lcp_index != -1){
     bestPose = allPose[best_lcp_index].first;
@@ -1794,88 +1923,175 @@ Match4PCSBase::ComputeTransformation(const std::vector<Point3D>& P,
   }
 
   return best_LCP_;
-
-  // Perform_Hough_Voting(Q, allPose, scenePath, objName);
-  // bestPose = allPose[0].first;
-
-  // return 0.5;
 }
 
+// Point pair feature voting: every segment point with a non-zero probability is a
+// reference point, and votes for (model point, rotation around the normal) with all the
+// segment pairs it belongs to whose feature is on the model. The peak of each reference
+// point gives a pose, the poses are clustered and the clusters are scored with the
+// weighted LCP, as the StoCS hypotheses.
 bool Match4PCSBase::Perform_Hough_Voting(std::vector<Point3D>* Q,
                                     std::vector< std::pair <Eigen::Isometry3d, float> > &allPose, 
-                                    std::string scenePath, std::string objName) {
+                                    std::string debugPath, std::string objName) {
 
   if (Q == nullptr)
     return false;
 
-  for(int reference_point_index = 0; reference_point_index < sampled_P_3D_.size(); reference_point_index++) {
-    bool TrueFalse = (rand() % 100) < 20;
-    if(TrueFalse) {
-      std::cout << "reference point : " << reference_point_index << "\n\n\n"; 
-      ComputeRigidTransformFromPPF(reference_point_index, allPose);
+  // Step 1: Voting
+  // The reference points are split over the workers, each one with its own accumulator.
+  std::chrono::steady_clock::time_point voting_start = std::chrono::steady_clock::now();
+  std::vector<int> reference_points;
+  for (int i = 0; i < sampled_P_3D_.size(); i++)
+    if (orig_probabilities_[i] != 0)
+      reference_points.push_back(i);
+
+  const int num_references = reference_points.size();
+  const int num_workers = std::max(1, std::min(int(std::thread::hardware_concurrency()), num_references));
+  std::vector<std::pair<MatrixType, int> > voted_poses(num_references);
+
+  runParallelTasks(num_workers, num_workers, [&](int t) {
+    std::vector<int> accumulator(sampled_Q_3D_.size() * kAlphaBins, 0);
+    for (int k = t; k < num_references; k += num_workers)
+      voted_poses[k].second = ComputeRigidTransformFromPPF(reference_points[k], accumulator, voted_poses[k].first);
+  });
+
+  voted_poses.erase(std::remove_if(voted_poses.begin(), voted_poses.end(),
+                                   [](const std::pair<MatrixType, int> &pose) { return pose.second == 0; }),
+                    voted_poses.end());
+  base_selection_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - voting_start).count();
+
+  // Step 2: Clustering
+  std::chrono::steady_clock::time_point clustering_start = std::chrono::steady_clock::now();
+  const int num_voted = voted_poses.size();
+  ClusterVotedPoses(voted_poses);
+  clustering_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - clustering_start).count();
+
+  std::cout << "Hough voting: " << num_references << " reference points in " << base_selection_time
+            << " s, " << num_voted << " poses, " << voted_poses.size() << " clusters" << std::endl;
+
+  // Step 3: Verification
+  // every cluster gets its full score: no pruning against the best LCP
+  std::chrono::steady_clock::time_point verification_start = std::chrono::steady_clock::now();
+  allTransforms.clear();
+  for (const auto &pose : voted_poses) {
+    allTransforms.push_back(pose.first);
+
+    // from the centered clouds to the original ones
+    Eigen::Matrix<Scalar, 4, 4> transformation = pose.first;
+    transformation.block<3,1>(0,3) += centroid_P_ - transformation.block<3,3>(0,0) * centroid_Q_;
+    allPose.push_back(std::make_pair(convertToIsometry3d(transformation), 0));
+  }
+
+  const int num_transforms = allTransforms.size();
+  Scalar block_lcps[kVerifyBlock];
+  std::vector<int> block_registered_indices[kVerifyBlock];
+  Scalar best_lcp = 0;
+  for (int first = 0; first < num_transforms; first += kVerifyBlock) {
+    const int count = std::min(int(kVerifyBlock), num_transforms - first);
+    for (int k = 0; k < count; k++)
+      block_registered_indices[k].clear();
+
+    WeightedVerify(&allTransforms[first], count, block_lcps, block_registered_indices);
+
+    for (int k = 0; k < count; k++) {
+      const int pose_index = first + k;
+      allPose[allPose.size() - num_transforms + pose_index].second = block_lcps[k];
+      if (block_lcps[k] > best_lcp) {
+        best_lcp = block_lcps[k];
+        best_lcp_index = allPose.size() - num_transforms + pose_index;
+        best_transform = allTransforms[pose_index];
+        registered_indices = block_registered_indices[k];
+      }
     }
   }
-    
+  best_LCP_ = best_lcp;
+  congruent_set_verification = std::chrono::duration<float>(std::chrono::steady_clock::now() - verification_start).count();
+  total_time = float( clock () - start_time ) /  CLOCKS_PER_SEC;
+
+  std::cout << "Verified poses: " << num_transforms << " in " << congruent_set_verification << " s" << std::endl;
+
   return true;
 }
 
 // Performs N RANSAC iterations and compute the best transformation.
 bool Match4PCSBase::Perform_N_steps(std::vector<Point3D>* Q,
                                     std::vector< std::pair <Eigen::Isometry3d, float> > &allPose, 
-                                    std::string scenePath, std::string objName) {
+                                    std::string debugPath, std::string objName) {
   if (Q == nullptr)
     return false;
 
+  // StoCS base selection and congruent set extraction only read the shared state and run
+  // as parallel tasks. Task k of a stage always draws from its own random stream, so the
+  // results only depend on options_.random_seed and not on the scheduling. The other
+  // modes keep the base in base_3D_ and use rand(), they run on a single worker.
+  const int num_threads = (operMode == 1) ? std::max(1u, std::thread::hardware_concurrency()) : 1;
+
   // Step 1: Base Selection
-  clock_t base_selection_start = clock();
-  while(baseSet.size() < max_number_of_bases_) {
+  std::chrono::steady_clock::time_point base_selection_start = std::chrono::steady_clock::now();
+  const int first_base = baseSet.size();
+  const int num_bases = std::max(0, max_number_of_bases_ - first_base);
+  base_pool_.resize(first_base + num_bases);
+
+  runParallelTasks(num_bases, num_threads, [&](int k) {
+    std::mt19937 generator = RandomStream(0, k);
     Scalar invariant1, invariant2;
     std::vector<int> baseIdx(4,0);
-    float baseProbability;
+    float baseProbability = 0;
 
     bool selectedBase = false;
-    if(operMode == 0)
-      selectedBase = SelectQuadrilateral(invariant1, invariant2, baseIdx[0], baseIdx[1], baseIdx[2], baseIdx[3]);
-    else if(operMode == 1)
-      selectedBase = SelectQuadrilateralStoCS(invariant1, invariant2, baseIdx[0], baseIdx[1], baseIdx[2], baseIdx[3], baseProbability);
-    else if(operMode == 2)
-      selectedBase = SelectTetrahedronBase(invariant1, invariant2, baseIdx[0], baseIdx[1], baseIdx[2], baseIdx[3]);
-
-    if(selectedBase) {
-      BaseGraph *b_t = new BaseGraph(baseIdx, invariant1, invariant2, baseProbability);
-      baseSet.push_back(b_t);
+    while(!selectedBase) {
+      if(operMode == 0)
+        selectedBase = SelectQuadrilateral(invariant1, invariant2, baseIdx[0], baseIdx[1], baseIdx[2], baseIdx[3]);
+      else if(operMode == 1)
+        selectedBase = SelectQuadrilateralStoCS(invariant1, invariant2, baseIdx[0], baseIdx[1], baseIdx[2], baseIdx[3],
+                                                baseProbability, generator);
+      else if(operMode == 2)
+        selectedBase = SelectTetrahedronBase(invariant1, invariant2, baseIdx[0], baseIdx[1], baseIdx[2], baseIdx[3]);
     }
-  }
-  
+    base_pool_[first_base + k] = BaseGraph(baseIdx, invariant1, invariant2, baseProbability);
+  });
+  for (int k = 0; k < num_bases; k++)
+    baseSet.push_back(&base_pool_[first_base + k]);
+
   std::cout << "Base set pool size: " << baseSet.size() << std::endl;
-  base_selection_time = float( clock () - base_selection_start ) /  CLOCKS_PER_SEC;
+  base_selection_time = std::chrono::duration<float>(std::chrono::steady_clock::now() - base_selection_start).count();
 
   // Step 3: Congruent Set Extraction
-  clock_t cse_start = clock();
-  for (auto base_it: baseSet) {
+  std::chrono::steady_clock::time_point cse_start = std::chrono::steady_clock::now();
+  std::vector< std::vector< std::pair <Eigen::Isometry3d, float> > > base_poses(baseSet.size());
+  std::vector< std::vector<Eigen::Matrix<Scalar, 4, 4> > > base_transforms(baseSet.size());
+
+  runParallelTasks(baseSet.size(), num_threads, [&](int k) {
+    BaseGraph *base_it = baseSet[k];
+    std::mt19937 generator = RandomStream(1, k);
     ExtractCongruentSet(base_it);
-    
+
     int max_sampled_csets = 100;
     if(base_it->congruent_quads.size() < max_sampled_csets) {
       for (int jj = 0; jj < base_it->congruent_quads.size(); jj++)
       ComputeRigidTransformFromCongruentPair(base_it->baseIds_[0], base_it->baseIds_[1],
                                               base_it->baseIds_[2], base_it->baseIds_[3],
-                                              base_it->congruent_quads[jj], allPose);
+                                              base_it->congruent_quads[jj], base_poses[k], base_transforms[k]);
     }
     else {
+      std::uniform_int_distribution<int> c_set_dist(0, base_it->congruent_quads.size() - 1);
       std::unordered_set<int> c_set_indices;
       while(c_set_indices.size() < max_sampled_csets)
-        c_set_indices.insert(rand() % base_it->congruent_quads.size());
+        c_set_indices.insert(c_set_dist(generator));
 
       for(auto c_set_it: c_set_indices)
         ComputeRigidTransformFromCongruentPair(base_it->baseIds_[0], base_it->baseIds_[1],
                                               base_it->baseIds_[2], base_it->baseIds_[3],
-                                              base_it->congruent_quads[c_set_it], allPose);
+                                              base_it->congruent_quads[c_set_it], base_poses[k], base_transforms[k]);
     }
+  });
 
-    base_it++;
+  // merge in base order, allPose[i] stays the pose of allTransforms[i]
+  for (int k = 0; k < baseSet.size(); k++) {
+    allPose.insert(allPose.end(), base_poses[k].begin(), base_poses[k].end());
+    allTransforms.insert(allTransforms.end(), base_transforms[k].begin(), base_transforms[k].end());
   }
-  congruent_set_extraction = float( clock () - cse_start ) /  CLOCKS_PER_SEC;
+  congruent_set_extraction = std::chrono::duration<float>(std::chrono::steady_clock::now() - cse_start).count();
   
   std::cout << "Number of poses: " << allPose.size() << std::endl;
 
@@ -1883,22 +2099,47 @@ bool Match4PCSBase::Perform_N_steps(std::vector<Point3D>* Q,
   std::vector<float> selection_time;
 
   // Step 3: Congruent Set Verification
-  clock_t verification_start = clock ();
-  int pose_index = 0;
-  for (auto transforms_it: allTransforms) {
-    std::vector<int> temp_registered_indices;
-    Scalar lcp = verifyRigidTransform(transforms_it, temp_registered_indices);
-    if (lcp > best_LCP_) {
-      best_LCP_  = lcp;
-      best_lcp_index = pose_index;
-      best_transform = transforms_it;
-      selected_indices.push_back(best_lcp_index);
-      selection_time.push_back(float( clock () - start_time ) /  CLOCKS_PER_SEC);
-      registered_indices = temp_registered_indices;
+  // The transforms are scored a block at a time, then accepted in order. Scoring a block
+  // against the best LCP from before the block only prunes less, the result is the same.
+  std::chrono::steady_clock::time_point verification_start = std::chrono::steady_clock::now();
+  const int num_transforms = allTransforms.size();
+  Scalar block_lcps[kVerifyBlock];
+  std::vector<int> block_registered_indices[kVerifyBlock];
+  for (int first = 0; first < num_transforms; first += kVerifyBlock) {
+    const int count = std::min(int(kVerifyBlock), num_transforms - first);
+    for (int k = 0; k < count; k++)
+      block_registered_indices[k].clear();
+
+    if (operMode == 1)
+      WeightedVerify(&allTransforms[first], count, block_lcps, block_registered_indices);
+    else
+      for (int k = 0; k < count; k++)
+        block_lcps[k] = verifyRigidTransform(allTransforms[first + k], block_registered_indices[k]);
+
+    for (int k = 0; k < count; k++) {
+      const int pose_index = first + k;
+      const Scalar lcp = block_lcps[k];
+      if (lcp > best_LCP_) {
+        best_LCP_  = lcp;
+        best_lcp_index = pose_index;
+        best_transform = allTransforms[pose_index];
+        selected_indices.push_back(best_lcp_index);
+        selection_time.push_back(float( clock () - start_time ) /  CLOCKS_PER_SEC);
+        registered_indices = block_registered_indices[k];
+      }
+      allPose[pose_index].second = lcp;
     }
-    allPose[pose_index].second = lcp;
-    pose_index++;
   }
+  congruent_set_verification = std::chrono::duration<float>(std::chrono::steady_clock::now() - verification_start).count();
+
+  std::cout << "Verified poses: " << num_transforms << " in " << congruent_set_verification << " s ("
+            << (congruent_set_verification > 0 ? num_transforms / congruent_set_verification : 0) << " poses/s)";
+  if (operMode == 1) {
+    std::cout << ", pruned per level:";
+    for (int level = 0; level < verification_stats_.pruned_at_level.size(); level++)
+      std::cout << " " << verification_stats_.pruned_at_level[level];
+  }
+  std::cout << std::endl;
 
   auto temp_poses = allPose;
 
@@ -1907,13 +2148,12 @@ bool Match4PCSBase::Perform_N_steps(std::vector<Point3D>* Q,
     allPose.push_back(temp_poses[selected_indices[ii]]);
     
     ofstream pFile;
-    pFile.open ((scenePath + "debug_super4PCS/" + objName + "_time.txt").c_str(),
+    pFile.open ((debugPath + objName + "_time.txt").c_str(),
         std::ofstream::out | std::ofstream::app);
     pFile << selection_time[ii] << std::endl;
     pFile.close();
   }
 
-  congruent_set_verification = float( clock () - verification_start ) /  CLOCKS_PER_SEC;
   total_time = float( clock () - start_time ) /  CLOCKS_PER_SEC;
 
   ofstream pFile;
@@ -1943,18 +2183,23 @@ bool Match4PCSBase::ExtractCongruentSet(Super4PCS::BaseGraph* baseIt) {
   invariant1 = baseIt->invariant1_;
   invariant2 = baseIt->invariant2_;
 
-  base_3D_[0] = sampled_P_3D_[base_id1];
-  base_3D_[1] = sampled_P_3D_[base_id2];
-  base_3D_[2] = sampled_P_3D_[base_id3];
-  base_3D_[3] = sampled_P_3D_[base_id4];
+  std::vector<Point3D> base(4);
+  base[0] = sampled_P_3D_[base_id1];
+  base[1] = sampled_P_3D_[base_id2];
+  base[2] = sampled_P_3D_[base_id3];
+  base[3] = sampled_P_3D_[base_id4];
+
+  // ExtractPairs reads the base from base_3D_, those modes run serially
+  if(operMode != 1)
+    base_3D_ = base;
 
   // Computes distance between pairs.
-  distance1 = (base_3D_[0].pos()- base_3D_[1].pos()).norm();
-  distance6 = (base_3D_[2].pos()- base_3D_[3].pos()).norm();
+  distance1 = (base[0].pos()- base[1].pos()).norm();
+  distance6 = (base[2].pos()- base[3].pos()).norm();
 
   // Compute normal angles.
-  normal_angle1 = (base_3D_[0].normal() - base_3D_[1].normal()).norm();
-  normal_angle6 = (base_3D_[2].normal() - base_3D_[3].normal()).norm();
+  normal_angle1 = (base[0].normal() - base[1].normal()).norm();
+  normal_angle6 = (base[2].normal() - base[3].normal()).norm();
 
   // computing point pair features
   computePPF(base_id1, base_id2, ppf_1);
@@ -1990,20 +2235,21 @@ bool Match4PCSBase::ExtractCongruentSet(Super4PCS::BaseGraph* baseIt) {
                                      distance_factor * options_.delta,
                                      pairs1,
                                      pairs6,
+                                     base,
                                      &baseIt->congruent_quads)) {
       return false;
     }
   }
   else {
-    distance2 = (base_3D_[0].pos()- base_3D_[2].pos()).norm();
-    distance3 = (base_3D_[0].pos()- base_3D_[3].pos()).norm();
-    distance4 = (base_3D_[1].pos()- base_3D_[2].pos()).norm();
-    distance5 = (base_3D_[1].pos()- base_3D_[3].pos()).norm();
-
-    normal_angle2 = (base_3D_[0].normal() - base_3D_[2].normal()).norm();
-    normal_angle3 = (base_3D_[0].normal() - base_3D_[3].normal()).norm();
-    normal_angle4 = (base_3D_[1].normal() - base_3D_[2].normal()).norm();
-    normal_angle5 = (base_3D_[1].normal() - base_3D_[3].normal()).norm();
+    distance2 = (base[0].pos()- base[2].pos()).norm();
+    distance3 = (base[0].pos()- base[3].pos()).norm();
+    distance4 = (base[1].pos()- base[2].pos()).norm();
+    distance5 = (base[1].pos()- base[3].pos()).norm();
+
+    normal_angle2 = (base[0].normal() - base[2].normal()).norm();
+    normal_angle3 = (base[0].normal() - base[3].normal()).norm();
+    normal_angle4 = (base[1].normal() - base[2].normal()).norm();
+    normal_angle5 = (base[1].normal() - base[3].normal()).norm();
 
     computePPF(base_id1, base_id3, ppf_2);
     computePPF(base_id1, base_id4, ppf_3);
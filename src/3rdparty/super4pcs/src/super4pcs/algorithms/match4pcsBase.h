@@ -44,13 +44,22 @@
 #ifndef _MATCH_4PCS_BASE_
 #define _MATCH_4PCS_BASE_
 
+#include <deque>
+#include <memory>
 #include <vector>
 #include <map>
 #include "shared4pcs.h"
+#include "modelContext.h"
 #include "sampling.h"
 #include "accelerators/kdtree.h"
+#include "accelerators/staticKdTree.h"
+#include "accelerators/voxelHashGrid.h"
+#include "accelerators/ppfCompatibility.h"
+#include "accelerators/ppfHashTable.h"
 #include "Eigen/Dense"
 
+#include <random>
+
 #ifdef TEST_GLOBAL_TIMINGS
 #   include "utils/timer.h"
 #endif
@@ -74,6 +83,7 @@ class BaseGraph{
 
         std::vector<match_4pcs::Quadrilateral> congruent_quads;
 
+        BaseGraph() {}
         BaseGraph(std::vector<int> baseIds, float invariant1, float invariant2, float baseProbability);
         ~BaseGraph(){}
 }; // class BaseGraph
@@ -85,6 +95,14 @@ class Compare{
         }
 }; // class Compare
 
+// Counters of the coarse-to-fine verification (Match4PCSBase::WeightedVerify)
+struct VerificationStats {
+    // transforms scored
+    int num_verified = 0;
+    // transforms discarded after each coarse level, the others were fully scored
+    std::vector<int> pruned_at_level;
+};
+
 class Match4PCSBase {
 
 public:
@@ -95,6 +113,14 @@ public:
     using MatrixType = Eigen::Matrix<Scalar, 4, 4>;
 
     static constexpr int kNumberOfDiameterTrials = 1000;
+    // number of validation points transformed at once by Verify
+    static constexpr int kVerifyChunk = 64;
+    // WeightedVerify scores 1/8, 1/4, 1/2 then all of the validation points
+    static constexpr int kVerifyLevels = 4;
+    // number of transforms scored together by the block WeightedVerify
+    static constexpr int kVerifyBlock = 8;
+    // Hough voting: bins of 12 degrees for the rotation around the normal
+    static constexpr int kAlphaBins = 30;
     static constexpr Scalar kLargeNumber = 1e9;
     static constexpr Scalar distance_factor = 1.0;
 
@@ -108,6 +134,11 @@ public:
         return sampled_Q_3D_;
     }
 
+    // Pruning counters of the last ComputeTransformation
+    inline const VerificationStats& getVerificationStats() const {
+        return verification_stats_;
+    }
+
     // Computes an approximation of the best LCP (directional) from Q to P
     // and the rigid transformation that realizes it. The input sets may or may
     // not contain normal information for any point.
@@ -127,7 +158,19 @@ public:
                           Eigen::Isometry3d &bestPose,
                           std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
                           std::string probImagePath, std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf,
-                          Eigen::Matrix3f camIntrinsic, std::string objName, std::string scenePath, std::vector<int> &registered_points);
+                          Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath, std::vector<int> &registered_points);
+
+    // Same as above with the model side prepared once per object, the clouds, the
+    // diameter and the point pair features of Q come from model. probImage is the
+    // CV_32FC1 probability map of the segmentation in [0, 1], it covers the image
+    // region starting at pixel probOrigin and is zero outside.
+    Scalar
+    ComputeTransformation(const std::vector<Point3D>& P,
+                          std::shared_ptr<const ModelContext> model,
+                          Eigen::Isometry3d &bestPose,
+                          std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
+                          const cv::Mat& probImage, cv::Point probOrigin,
+                          Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath, std::vector<int> &registered_points);
 
 protected:
     // Number of trials. Every trial picks random base from P.
@@ -155,6 +198,8 @@ protected:
 
     // Sampled P (3D coordinates).
     std::vector<Point3D> sampled_P_3D_;
+    // Model side of the registration, shared with the other requests of the model
+    std::shared_ptr<const ModelContext> model_;
     // Sampled Q (3D coordinates).
     std::vector<Point3D> sampled_Q_3D_;
     // Sampled Q (3D coordinates) for verification stage
@@ -172,11 +217,18 @@ protected:
     // Current trial.
     int current_trial_;
     // KdTree used to compute the LCP
-    Super4PCS::KdTree<Scalar> kd_tree_;
+    Super4PCS::StaticKdTree kd_tree_;
+    // Hashed grid used instead of kd_tree_ when options_.use_voxel_hash_verification
+    Super4PCS::VoxelHashGrid voxel_grid_;
+    // validation_Q_3D positions as columns, transformed a chunk at a time in Verify
+    Eigen::Matrix<Scalar, 3, Eigen::Dynamic> validation_Q_pos_;
     // Parameters.
     match_4pcs::Match4PCSOptions options_;
     // point probabilities for sampled_P_3D
     std::vector<float> orig_probabilities_;
+    // largest of orig_probabilities_, the most a validation point adds to WeightedVerify
+    float max_probability_;
+    VerificationStats verification_stats_;
     // corresponding 2d pixels of sampled_P_3D
     std::vector<std::pair<int, int> > corr_pixels;
     // mode of operation: 0->super4pcs, 1->stoCS
@@ -191,15 +243,26 @@ protected:
     float total_time;
 
     // hashmap of point pair features to the count on model
-    std::map<std::vector<int>, std::vector<std::pair<int,int> > > *PPFMap; 
+    const std::map<std::vector<int>, std::vector<std::pair<int,int> > > *PPFMap;
     // maximum count of any ppf on model
     int max_count_ppf;
     // translational discretization for point pair features
     int trans_disc;
     // rotational discretization for point pair features
     int rot_disc;
-    // set of all bases sampled from P
+    // StoCS: PPFMap membership of the pair features of sampled_P_3D_, built once in init
+    Super4PCS::PPFCompatibilityMatrix ppf_compat_;
+    // StoCS: points with a non-zero probability, one bit per point of sampled_P_3D_
+    std::vector<uint64_t> probable_points_;
+    // StoCS: sampler for the first base point, over orig_probabilities_
+    Super4PCS::AliasTable first_point_sampler_;
+    // Hough voting: PPFMap with the model alpha of every pair, owned by model_
+    const Super4PCS::PPFHashTable* ppf_table_;
+    // seed of the per-task random streams, options_.random_seed or drawn from the clock
+    unsigned int random_seed_;
+    // set of all bases sampled from P, pointing into base_pool_
     std::vector<Super4PCS::BaseGraph*> baseSet;
+    std::deque<Super4PCS::BaseGraph> base_pool_;
     std::vector<int> registered_indices;
 protected:
 
@@ -220,6 +283,10 @@ protected:
     // of the base base_3D_.
     bool TryQuadrilateral(Scalar &invariant1, Scalar &invariant2,
                           int &base1, int &base2, int &base3, int &base4);
+    // Same as above, on the given base instead of base_3D_.
+    bool TryQuadrilateral(std::vector<Point3D> &base,
+                          Scalar &invariant1, Scalar &invariant2,
+                          int &base1, int &base2, int &base3, int &base4);
 
 
     // Computes the best rigid transformation between three corresponding pairs.
@@ -246,6 +313,16 @@ protected:
     // the translation vector and (cx,cy,cz) is the center of transformation.template <class MatrixDerived>
     Scalar Verify(const Eigen::Ref<const MatrixType> & mat);
     Scalar WeightedVerify(const Eigen::Ref<const MatrixType> &mat, std::vector<int> &temp_registered_indices);
+    // Scores the count <= kVerifyBlock transforms mats in a single sweep over the
+    // validation points, lcps[k] and temp_registered_indices[k] are the results of mats[k]
+    void WeightedVerify(const MatrixType *mats, int count, Scalar *lcps,
+                        std::vector<int> *temp_registered_indices);
+    // Verify and WeightedVerify against the given spatial index of sampled_P_3D_
+    template <typename SpatialIndex>
+    Scalar Verify(const SpatialIndex &index, const Eigen::Ref<const MatrixType> & mat);
+    template <typename SpatialIndex>
+    void WeightedVerify(const SpatialIndex &index, const MatrixType *mats, int count, Scalar *lcps,
+                        std::vector<int> *temp_registered_indices);
     Scalar verifyRigidTransform(Eigen::Matrix<Scalar, 4, 4> transform, std::vector<int> &temp_registered_indices);
     
     // Performs n RANSAC iterations, each one of them containing base selection,
@@ -254,7 +331,7 @@ protected:
     // been reached), false otherwise.
     bool Perform_N_steps(std::vector<Point3D>* Q,
                          std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
-                         std::string scenePath, std::string objName);
+                         std::string debugPath, std::string objName);
     bool ExtractCongruentSet(Super4PCS::BaseGraph* baseIt);
 
     // Initializes the data structures and needed values before the match
@@ -277,11 +354,9 @@ protected:
     // Set as public for testing and debug purpose.
 public:
     void init(const std::vector<Point3D>& P,
-                         const std::vector<Point3D>& Q,
-                         const std::vector<Point3D>& Q_validation,
-                         std::string probImagePath,
-                         Eigen::Matrix3f camIntrinsic, std::string objName,
-                         std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf);
+                         std::shared_ptr<const ModelContext> model,
+                         const cv::Mat& probImage, cv::Point probOrigin,
+                         Eigen::Matrix3f camIntrinsic, std::string objName);
 
     // Selects a quadrilateral from P and returns the corresponding invariants
     // and point indices. Returns true if a quadrilateral has been found, false
@@ -293,14 +368,22 @@ public:
                                         int& base1, int& base2, int& base3,
                                         int& base4);
 
+    // Only reads the shared state, can be called concurrently with different generators
     bool SelectQuadrilateralStoCS(Scalar& invariant1, Scalar& invariant2,
                                         int& base1, int& base2, int& base3,
-                                        int& base4, float& baseProbability);
+                                        int& base4, float& baseProbability,
+                                        std::mt19937& generator);
+
+    // Random stream of task index of the given stage, a function of random_seed_ only
+    std::mt19937 RandomStream(int stage, int index) const;
 
     const std::vector<Point3D>& base3D() const { return base_3D_; }
 
     bool computePPF(int &pIdx1, int &pIdx2, std::vector<int> &ppf_);
 
+    // Builds ppf_compat_, probable_points_ and first_point_sampler_ for StoCS
+    void InitStoCSSampling();
+
     // Constructs pairs of points in Q, corresponding to a single pair in the
     // in basein P.
     // @param [in] pair_distance The distance between the pairs in P that we have
@@ -332,6 +415,7 @@ public:
     // to the invariants (See the paper for e1, e2).
     // @param [in] P_pairs The first set of pairs.
     // @param [in] Q_pairs The second set of pairs.
+    // @param [in] base The base in P the pairs were extracted for.
     // @param [out] quadrilaterals The set of congruent quadrilateral. In fact,
     // it's a super set from which we extract the real congruent set.
     virtual bool
@@ -340,6 +424,7 @@ public:
                                 Scalar distance_threshold2,
                                 const PairsVector& P_pairs,
                                 const PairsVector& Q_pairs,
+                                const std::vector<Point3D>& base,
                                 std::vector<match_4pcs::Quadrilateral>* quadrilaterals) const = 0;
 
     bool FindCongruentQuadrilateralsV4PCS(std::vector<std::pair<int, int>>& pairs1, 
@@ -357,20 +442,27 @@ public:
                           int base_id3,
                           int base_id4,
                           match_4pcs::Quadrilateral &congruent_quad,
-                          std::vector< std::pair <Eigen::Isometry3d, float> > &allPose);
+                          std::vector< std::pair <Eigen::Isometry3d, float> > &allPose,
+                          std::vector<Eigen::Matrix<Scalar, 4, 4> > &transforms);
 
-    void computeTransformRT(VectorType& p1, const VectorType& n1, Eigen::Matrix3d& R, Eigen::Vector3d& t);
-    double computeAlpha(VectorType& p1, const VectorType& n1, VectorType& p2);
+    void computeTransformRT(const VectorType& p1, const VectorType& n1, Eigen::Matrix3d& R, Eigen::Vector3d& t) const;
+    double computeAlpha(const VectorType& p1, const VectorType& n1, const VectorType& p2) const;
     bool ComputeRigidTransformFromCongruentPairHough(std::vector<Super4PCS::BaseGraph*> &baseSet,
         std::vector< std::pair <Eigen::Isometry3d, float> > &allPose);
     bool Perform_Hough_Voting(std::vector<Point3D>* Q,
                                     std::vector< std::pair <Eigen::Isometry3d, float> > &allPose, 
-                                    std::string scenePath, std::string objName);
+                                    std::string debugPath, std::string objName);
     bool SelectQuadrilateralStoCSVoting(Scalar& invariant1, Scalar& invariant2,
                                         int& base1, int& base2, int& base3,
                                         int& base4, float& baseProbability, int first_point_index);
-    bool ComputeRigidTransformFromPPF(int reference_point_index,
-                                      std::vector< std::pair <Eigen::Isometry3d, float> > &allPose);
+    // Votes of the pairs of reference_point_index in accumulator (model points x alpha
+    // bins, zero on input and on return), returns the pose of the peak and its votes.
+    // Only reads the shared state, can be called concurrently with different accumulators.
+    int ComputeRigidTransformFromPPF(int reference_point_index, std::vector<int> &accumulator,
+                                     Eigen::Matrix<Scalar, 4, 4> &transform) const;
+    // Greedy clustering of the voted poses by decreasing votes, the votes of the members
+    // are summed in their cluster
+    void ClusterVotedPoses(std::vector<std::pair<Eigen::Matrix<Scalar, 4, 4>, int> > &poses) const;
     void getRegisteredModel(const Eigen::Ref<const MatrixType> &mat);
 private:
     void initKdTree();
@@ -0,0 +1,46 @@
+#include "modelContext.h"
+
+namespace Super4PCS{
+
+ModelContext::ModelContext(const std::vector<Point3D>& sampled,
+                           const std::vector<Point3D>& validation,
+                           const std::vector<Point3D>& hull,
+                           const PPFMapType& PPFMap, int max_count_ppf)
+  : sampled_(sampled),
+    validation_(validation),
+    hull_(hull),
+    centroid_(VectorType::Zero()),
+    diameter_(0),
+    PPFMap_(&PPFMap),
+    max_count_ppf_(max_count_ppf) {
+
+  // The matcher rotates the model about the centroid of the sampled points
+  for (int i = 0; i < sampled_.size(); ++i) {
+    centroid_ += sampled_[i].pos();
+  }
+  if (!sampled_.empty())
+    centroid_ /= Scalar(sampled_.size());
+
+  for (int i = 0; i < sampled_.size(); ++i) {
+    sampled_[i].pos() -= centroid_;
+  }
+  for (int i = 0; i < validation_.size(); ++i) {
+    validation_[i].pos() -= centroid_;
+  }
+  for (int i = 0; i < hull_.size(); ++i) {
+    hull_[i].pos() -= centroid_;
+  }
+
+  // Exact diameter: computed once per model, it replaces the random estimate the
+  // matcher used to draw for every request
+  Scalar squared_diameter = 0;
+  for (int i = 0; i < sampled_.size(); ++i) {
+    for (int j = i + 1; j < sampled_.size(); ++j) {
+      squared_diameter = std::max(squared_diameter,
+                                  (sampled_[j].pos() - sampled_[i].pos()).squaredNorm());
+    }
+  }
+  diameter_ = std::sqrt(squared_diameter);
+}
+
+} // namespace Super4PCS
@@ -0,0 +1,72 @@
+// Model side of the registration, computed once per object and shared read-only by the
+// matchers of every request: the sampled, validation and hull clouds centered on the
+// centroid of the sampled cloud, the model diameter and the point pair feature map.
+// The Hough voting table is built by the first matcher that needs it.
+
+#ifndef _MODEL_CONTEXT_H_
+#define _MODEL_CONTEXT_H_
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include "shared4pcs.h"
+#include "accelerators/ppfHashTable.h"
+
+namespace Super4PCS{
+
+class ModelContext {
+
+public:
+    using Point3D = match_4pcs::Point3D;
+    using Scalar = typename Point3D::Scalar;
+    using VectorType = typename Point3D::VectorType;
+    using PPFMapType = PPFHashTable::PPFMapType;
+
+    // PPFMap is not copied and must outlive the context
+    ModelContext(const std::vector<Point3D>& sampled,
+                 const std::vector<Point3D>& validation,
+                 const std::vector<Point3D>& hull,
+                 const PPFMapType& PPFMap, int max_count_ppf);
+
+    ModelContext(const ModelContext&) = delete;
+    ModelContext& operator=(const ModelContext&) = delete;
+
+    // Clouds centered on centroid()
+    inline const std::vector<Point3D>& sampled() const { return sampled_; }
+    inline const std::vector<Point3D>& validation() const { return validation_; }
+    inline const std::vector<Point3D>& hull() const { return hull_; }
+
+    // Centroid of the sampled cloud, in model frame
+    inline const VectorType& centroid() const { return centroid_; }
+
+    // Largest distance between two sampled points
+    inline Scalar diameter() const { return diameter_; }
+
+    inline const PPFMapType& PPFMap() const { return *PPFMap_; }
+    inline int maxCountPPF() const { return max_count_ppf_; }
+
+    // PPFMap with value(first, second) stored for every model pair, built on the first
+    // call. The value must only depend on the sampled points.
+    template <typename ValueFunctor>
+    const PPFHashTable& votingTable(ValueFunctor value) const {
+        std::call_once(voting_table_built_, [&]() { voting_table_.build(*PPFMap_, value); });
+        return voting_table_;
+    }
+
+private:
+    std::vector<Point3D> sampled_;
+    std::vector<Point3D> validation_;
+    std::vector<Point3D> hull_;
+    VectorType centroid_;
+    Scalar diameter_;
+
+    const PPFMapType* PPFMap_;
+    int max_count_ppf_;
+
+    mutable std::once_flag voting_table_built_;
+    mutable PPFHashTable voting_table_;
+}; // class ModelContext
+
+} // namespace Super4PCS
+
+#endif
@@ -60,6 +60,7 @@
 #include <fstream>
 #include <array>
 #include <time.h>
+#include <thread>
 
 
 //#define MULTISCALE
@@ -83,6 +84,7 @@ MatchSuper4PCS::FindCongruentQuadrilaterals(
         Scalar distance_threshold2,
         const std::vector<std::pair<int, int>>& P_pairs,
         const std::vector<std::pair<int, int>>& Q_pairs,
+        const std::vector<Point3D>& base,
         std::vector<match_4pcs::Quadrilateral>* quadrilaterals) const {
 
     typedef PairCreationFunctor<Scalar>::Point Point;
@@ -105,8 +107,8 @@ MatchSuper4PCS::FindCongruentQuadrilaterals(
 
   // Compute the angle formed by the two vectors of the basis
   const Scalar alpha =
-          (base_3D_[1].pos() - base_3D_[0].pos()).normalized().dot(
-          (base_3D_[3].pos() - base_3D_[2].pos()).normalized());
+          (base[1].pos() - base[0].pos()).normalized().dot(
+          (base[3].pos() - base[2].pos()).normalized());
 
   // 1. Datastructure construction
   const Scalar eps = pcfunctor_.getNormalizedEpsilon(distance_threshold2);
@@ -228,11 +230,20 @@ MatchSuper4PCS::ExtractPairs(Scalar pair_distance,
 
   Scalar eps = pcfunctor_.getNormalizedEpsilon(pair_distance_epsilon);
 
+#ifdef MULTISCALE
   interFunctor.process(pcfunctor_.primitives,
                        pcfunctor_.points,
                        eps,
                        50,
                        pcfunctor_);
+#else
+  interFunctor.processParallel(pcfunctor_.primitives,
+                               pcfunctor_.points,
+                               eps,
+                               50,
+                               pcfunctor_,
+                               std::max(1u, std::thread::hardware_concurrency()));
+#endif
 }
 
 
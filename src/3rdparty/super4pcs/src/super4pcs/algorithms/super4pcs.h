@@ -116,6 +116,7 @@ public:
          Scalar distance_threshold2,
          const PairsVector& P_pairs,
          const PairsVector& Q_pairs,
+         const std::vector<Point3D>& base,
          std::vector<match_4pcs::Quadrilateral>* quadrilaterals) const override;
 
 protected:
@@ -163,8 +163,18 @@ public:
   inline void endPrimitiveCollect(int /*primId*/){ }
 
 
-  //! FIXME Pair filtering is the same than 4pcs. Need refactoring
   inline void process(int i, int j){
+    process(i, j, *pairs);
+  }
+
+  //! Pairs collected by a worker of IntersectionFunctor::processParallel
+  inline void appendPairs(const PairsVector& collected){
+    pairs->insert(pairs->end(), collected.begin(), collected.end());
+  }
+
+  //! FIXME Pair filtering is the same than 4pcs. Need refactoring
+  //! Only reads the functor state, the accepted pairs are appended to out
+  inline void process(int i, int j, PairsVector& out) const {
     if (i>j){
       const Point3D& p = Q_[j];
       const Point3D& q = Q_[i];
@@ -238,16 +248,16 @@ public:
       if (options_.max_angle > 0){
           VectorType segment2 = (q.pos() - p.pos()).normalized();
           if (std::acos(segment1.dot(segment2)) <= options_.max_angle * M_PI / 180.0) {
-              pairs->emplace_back(j, i);
+              out.emplace_back(j, i);
           }
 
           if (std::acos(segment1.dot(- segment2)) <= options_.max_angle * M_PI / 180.0) {
               // Add ordered pair.
-              pairs->emplace_back(i, j);
+              out.emplace_back(i, j);
           }
       }else {
-          pairs->emplace_back(j, i);
-          pairs->emplace_back(i, j);
+          out.emplace_back(j, i);
+          out.emplace_back(i, j);
       }
     }
   }
@@ -171,6 +171,15 @@ struct Match4PCSOptions {
   // an ANY TIME algorithm that can be stopped at any time, producing the best
   // solution so far.
   int max_time_seconds = 60;
+  // Seed of the random streams of the StoCS base selection and congruent set
+  // sampling. Set to 0 to draw a seed from the clock.
+  unsigned int random_seed = 0;
+  // Answer the LCP inlier queries with a hashed grid of cell size 4 * delta (at most
+  // 8 cell probes per point) instead of the kd-tree. Both give the same scores.
+  bool use_voxel_hash_verification = false;
+  // Generate the hypotheses by point pair feature Hough voting (one peak per reference
+  // point of the scene, then clustered) instead of the StoCS congruent sets.
+  bool use_ppf_hough_voting = false;
 };
 
 } // namespace match_4pcs
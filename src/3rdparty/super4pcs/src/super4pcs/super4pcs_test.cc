@@ -4,6 +4,7 @@
 
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
 
 #include "io/io.h"
@@ -36,56 +37,72 @@ int max_time_seconds = 2;
 
 bool use_super4pcs = true;
 
-void getProbableTransformsSuper4PCS(std::string input1, std::string input2, std::string input3, 
+bool use_voxel_hash = false;
+
+// Model clouds as rows of x, y, z, nx, ny, nz
+static vector<Point3D> toPointSet(const Eigen::MatrixXf& cloud) {
+  vector<Point3D> set(cloud.rows());
+  for (int i = 0; i < cloud.rows(); ++i) {
+    set[i] = Point3D(cloud(i, 0), cloud(i, 1), cloud(i, 2));
+    set[i].set_normal(cloud.block<1, 3>(i, 3).transpose());
+  }
+  return set;
+}
+
+// Model side of the matcher, built once per object and shared by all its requests.
+// PPFMap must outlive the returned context.
+std::shared_ptr<const Super4PCS::ModelContext> buildModelContextSuper4PCS(
+      const Eigen::MatrixXf& sampledModel, const Eigen::MatrixXf& validationModel, std::string hullPath,
+      std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf) {
+
+  vector<Point3D> set2 = toPointSet(validationModel), set3 = toPointSet(sampledModel), set4;
+  vector<Eigen::Matrix2f> tex_coords4;
+  vector<typename Point3D::VectorType> normals2, normals4;
+  vector<tripple> tris4;
+  vector<std::string> mtls4;
+
+  IOManager iomananger;
+  if (!iomananger.ReadObject((char *)hullPath.c_str(), set4, tex_coords4, normals4, tris4, mtls4)) {
+    perror("Can't read input set4");
+    exit(-1);
+  }
+
+  for (int i = 0; i < set2.size(); ++i)
+    normals2.push_back(set2[i].normal());
+  Super4PCS::Utils::CleanInvalidNormals(set2, normals2);
+
+  return std::make_shared<Super4PCS::ModelContext>(set3, set2, set4, PPFMap, max_count_ppf);
+}
+
+// Hypotheses from StoCS congruent sets, or from point pair feature voting with houghVoting
+static void getProbableTransforms(std::string input1, std::shared_ptr<const Super4PCS::ModelContext> model,
       std::pair <Eigen::Isometry3d, float> &bestHypothesis, 
       std::vector< std::pair <Eigen::Isometry3d, float> > &hypothesisSet,
-      std::string probImagePath, std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf, 
-      Eigen::Matrix3f camIntrinsic, std::string objName, std::string scenePath, std::vector<int> &registered_points) {
+      const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath,
+      std::vector<int> &registered_points, bool houghVoting) {
 
   using namespace Super4PCS;
 
-  vector<Point3D> set1, set2, set3, set4;
-  vector<Eigen::Matrix2f> tex_coords1, tex_coords2, tex_coords3,tex_coords4;
-  vector<typename Point3D::VectorType> normals1, normals2, normals3, normals4;
-  vector<tripple> tris1, tris2, tris3,tris4;
-  vector<std::string> mtls1, mtls2, mtls3,mtls4;
+  vector<Point3D> set1;
+  vector<Eigen::Matrix2f> tex_coords1;
+  vector<typename Point3D::VectorType> normals1;
+  vector<tripple> tris1;
+  vector<std::string> mtls1;
   Eigen::Isometry3d bestPose;
   float bestscore;
 
   IOManager iomananger;
 
-  // Read the inputs.
+  // Read the segment, the model side comes from the context.
   if (!iomananger.ReadObject((char *)input1.c_str(), set1, tex_coords1, normals1, tris1,
                   mtls1)) {
     perror("Can't read input set1");
     exit(-1);
   }
 
-  if (!iomananger.ReadObject((char *)input2.c_str(), set2, tex_coords2, normals2, tris2,
-                  mtls2)) {
-    perror("Can't read input set2");
-    exit(-1);
-  }
-
-  if (!iomananger.ReadObject((char *)input3.c_str(), set3, tex_coords3, normals3, tris3,
-                  mtls3)) {
-    perror("Can't read input set3");
-    exit(-1);
-  }
-
-  if (!iomananger.ReadObject(("/home/chaitanya/github/PhysimGlobalPose/src/physim_pose_estimation/models_search/" + objName + "/hull.ply").c_str(), 
-                  set4, tex_coords4, normals4, tris4, mtls4)) {
-    perror("Can't read input set4");
-    exit(-1);
-  }
-
   // clean only when we have pset to avoid wrong face to point indexation
   if (tris1.size() == 0)
     Utils::CleanInvalidNormals(set1, normals1);
-  if (tris2.size() == 0)
-    Utils::CleanInvalidNormals(set2, normals2);
-  if (tris3.size() == 0)
-    Utils::CleanInvalidNormals(set2, normals2);
 
   // Our matcher.
   Match4PCSOptions options;
@@ -97,15 +114,35 @@ void getProbableTransformsSuper4PCS(std::string input1, std::string input2, std:
   options.max_color_distance = max_color;
   options.max_time_seconds = max_time_seconds;
   options.delta = delta;
+  options.use_voxel_hash_verification = use_voxel_hash;
+  options.use_ppf_hough_voting = houghVoting;
 
   try {
     MatchSuper4PCS matcher(options);
-    bestscore = matcher.ComputeTransformation(set1, &set3, &set2, &set4, bestPose, hypothesisSet,
-     probImagePath, PPFMap, max_count_ppf, camIntrinsic, objName, scenePath, registered_points);
+    bestscore = matcher.ComputeTransformation(set1, model, bestPose, hypothesisSet,
+     probImage, probOrigin, camIntrinsic, objName, debugPath, registered_points);
   }
   catch (...) {
     std::cout << "[Unknown Error]: Aborting with code -3 ..." << std::endl;
   }
 
   bestHypothesis = std::make_pair(bestPose, bestscore);
-}
\ No newline at end of file
+}
+
+void getProbableTransformsSuper4PCS(std::string input1, std::shared_ptr<const Super4PCS::ModelContext> model,
+      std::pair <Eigen::Isometry3d, float> &bestHypothesis, 
+      std::vector< std::pair <Eigen::Isometry3d, float> > &hypothesisSet,
+      const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath,
+      std::vector<int> &registered_points) {
+  getProbableTransforms(input1, model, bestHypothesis, hypothesisSet, probImage, probOrigin,
+                        camIntrinsic, objName, debugPath, registered_points, false);
+}
+
+void getProbableTransformsPPFVoting(std::string input1, std::shared_ptr<const Super4PCS::ModelContext> model,
+      std::pair <Eigen::Isometry3d, float> &bestHypothesis, 
+      std::vector< std::pair <Eigen::Isometry3d, float> > &hypothesisSet,
+      const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath,
+      std::vector<int> &registered_points) {
+  getProbableTransforms(input1, model, bestHypothesis, hypothesisSet, probImage, probOrigin,
+                        camIntrinsic, objName, debugPath, registered_points, true);
+}
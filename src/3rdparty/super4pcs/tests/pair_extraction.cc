@@ -66,6 +66,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <utility> // pair
+#include <thread>
 
 #include "testing.h"
 
@@ -77,6 +78,7 @@ using namespace Super4PCS;
 
 struct MyPairCreationFunctor{
   typedef std::pair<unsigned int, unsigned int>ResPair;
+  typedef std::vector< ResPair > PairsVector;
   std::vector< ResPair >pairs;
 
   std::vector<unsigned int> ids;
@@ -91,6 +93,15 @@ struct MyPairCreationFunctor{
       if (primId>pointId)
         pairs.emplace_back(pointId, primId);
   }
+
+  // IntersectionFunctor::processParallel interface
+  inline void process(int primId, int pointId, PairsVector& out) const {
+      if (primId>pointId)
+        out.emplace_back(pointId, primId);
+  }
+  inline void appendPairs(const PairsVector& collected){
+    pairs.insert(pairs.end(), collected.begin(), collected.end());
+  }
 };
 
 
@@ -225,6 +236,64 @@ void callSubTests()
     }
 }
 
+/*!
+ * \brief Extract the pairs of a sphere cloud with IntersectionFunctor::process,
+   processParallel on a single thread and on numThreads, check that they all report
+   the same pairs in the same order and print the throughput of each.
+ */
+template<typename Scalar>
+void benchmarkParallelExtraction( Scalar r, Scalar epsilon,
+                                  unsigned int nbPoints,
+                                  unsigned int minNodeSize,
+                                  int numThreads){
+  using namespace Super4PCS::Accelerators::PairExtraction;
+
+  typedef Eigen::Matrix<Scalar, 3, 1> Point;
+  typedef HyperSphere< Point, 3, Scalar > Primitive;
+  typedef IntersectionFunctor<Primitive, Point, 3, Scalar> Functor;
+
+  std::vector<Point> points;
+  std::vector<Primitive> primitives;
+  Point half (Point::Ones()/2.f);
+  for(unsigned int i = 0; i != nbPoints; i++){
+    Point p (0.5f*Point::Random().normalized() + half);
+    points.push_back(p);
+    primitives.emplace_back(p, r);
+  }
+
+  Super4PCS::Utils::Timer t;
+  Functor IF;
+
+  MyPairCreationFunctor serial;
+  Scalar serialEpsilon = epsilon;
+  t.reset();
+  IF.process(primitives, points, serialEpsilon, minNodeSize, serial);
+  const double serialTime = t.elapsed().count() * 1e-9;
+
+  MyPairCreationFunctor single;
+  Scalar singleEpsilon = epsilon;
+  t.reset();
+  IF.processParallel(primitives, points, singleEpsilon, minNodeSize, single, 1);
+  const double singleTime = t.elapsed().count() * 1e-9;
+
+  MyPairCreationFunctor parallel;
+  Scalar parallelEpsilon = epsilon;
+  t.reset();
+  IF.processParallel(primitives, points, parallelEpsilon, minNodeSize, parallel, numThreads);
+  const double parallelTime = t.elapsed().count() * 1e-9;
+
+  std::cout << "Pairs/s (" << nbPoints << " points, " << serial.pairs.size() << " pairs): "
+            << "\t process: " << serial.pairs.size() / serialTime
+            << "\t processParallel 1 thread: " << single.pairs.size() / singleTime
+            << "\t processParallel " << numThreads << " threads: "
+            << parallel.pairs.size() / parallelTime << std::endl;
+
+  VERIFY( serial.pairs.size() == single.pairs.size() );
+  VERIFY( std::equal(serial.pairs.begin(), serial.pairs.end(), single.pairs.begin()));
+  VERIFY( serial.pairs.size() == parallel.pairs.size() );
+  VERIFY( std::equal(serial.pairs.begin(), serial.pairs.end(), parallel.pairs.begin()));
+}
+
 template <typename MatchType>
 void callMatchSubTests()
 {
@@ -349,6 +418,18 @@ int main(int argc, const char **argv) {
     callSubTests<long double, 4, IntersectionFunctor>();
     cout << "Ok..." << endl;
 
+    cout << "Parallel pair extraction in 3 dimensions (RENDERING)..." << endl;
+    {
+        const float eps = GetRoundedEpsilonValue(0.125f/16.f);
+        const int numThreads = std::max(1u, std::thread::hardware_concurrency());
+        for(int i = 0; i < Testing::g_repeat; ++i)
+        {
+            CALL_SUBTEST(( benchmarkParallelExtraction<float>(0.2f, eps, 2500, 50, numThreads) ));
+            CALL_SUBTEST(( benchmarkParallelExtraction<float>(0.2f, eps, 20000, 50, numThreads) ));
+        }
+    }
+    cout << "Ok..." << endl;
+
     cout << "Extract pairs using Match4PCS" << endl;
     callMatchSubTests<Match4PCS>();
     cout << "Ok..." << endl;
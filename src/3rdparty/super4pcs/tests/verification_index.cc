@@ -0,0 +1,148 @@
+// Compares the spatial indices used by the LCP verification (StaticKdTree and
+// VoxelHashGrid) against Super4PCS::KdTree: all must return the same restricted closest
+// point for every query, and the time spent on the queries of a verification pass is
+// reported for segment-sized clouds.
+
+#include <iostream>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include "accelerators/kdtree.h"
+#include "accelerators/staticKdTree.h"
+#include "accelerators/voxelHashGrid.h"
+#include "utils/timer.h"
+
+#include "testing.h"
+
+using namespace match_4pcs;
+using namespace Super4PCS;
+
+/*!
+ * \brief Run the closest point and the any hit queries of all the transforms on index,
+ * check them against the KdTree results and return the time of both passes.
+ */
+template <typename SpatialIndex>
+std::pair<long, long> checkIndex(const SpatialIndex& index,
+                                 const std::vector<Point3D>& cloud,
+                                 const std::vector<Eigen::Matrix<float, 3, Eigen::Dynamic> >& queries,
+                                 const std::vector<int>& kdIds,
+                                 float sq_eps){
+    const unsigned int nbQueries = queries.front().cols();
+    std::vector<int> ids(kdIds.size());
+    std::vector<int> hits(queries.size(), 0);
+    Utils::Timer t;
+
+    t.reset();
+    for (unsigned int j = 0; j < queries.size(); ++j)
+        index.queryRestrictedClosestIndices(queries[j], sq_eps, &ids[j * nbQueries]);
+    const auto closestTimestep = t.elapsed();
+
+    t.reset();
+    for (unsigned int j = 0; j < queries.size(); ++j)
+        for (unsigned int i = 0; i < nbQueries; ++i)
+            hits[j] += index.hasNeighbor(queries[j].col(i), sq_eps);
+    const auto anyTimestep = t.elapsed();
+
+    for (unsigned int j = 0; j < queries.size(); ++j) {
+        int kdHits = 0;
+        for (unsigned int i = 0; i < nbQueries; ++i) {
+            const int a = kdIds[j * nbQueries + i];
+            const int b = ids[j * nbQueries + i];
+            const Eigen::Vector3f q = queries[j].col(i);
+            VERIFY( (a == KdTree<float>::invalidIndex()) == (b == SpatialIndex::invalidIndex()) );
+            // ties may be broken differently
+            if (a != b)
+                VERIFY( (cloud[a].pos() - q).squaredNorm() == (cloud[b].pos() - q).squaredNorm() );
+            kdHits += a != KdTree<float>::invalidIndex();
+        }
+        // same LCP for every transform
+        VERIFY( hits[j] == kdHits );
+    }
+
+    return std::make_pair(long(closestTimestep.count()/1000), long(anyTimestep.count()/1000));
+}
+
+/*!
+ * \brief Query nbQueries transformed points nbTransforms times, as Match4PCSBase::Verify
+ * does for each candidate transform, and check that the verification indices agree
+ * with the KdTree.
+ */
+void testFunction(unsigned int nbPoints,
+                  unsigned int nbQueries,
+                  unsigned int nbTransforms,
+                  float epsilon){
+    typedef KdTree<float>::VectorType VectorType;
+
+    std::vector<Point3D> cloud, validation;
+    Testing::generateSphereCloud(cloud, nbPoints);
+    Testing::generateSphereCloud(validation, nbQueries);
+
+    KdTree<float> tree(nbPoints);
+    for (const auto& p : cloud)
+        tree.add(p.pos());
+    tree.finalize();
+
+    StaticKdTree staticTree;
+    staticTree.build(nbPoints, [&cloud](int i) { return cloud[i].pos(); });
+
+    VoxelHashGrid grid;
+    grid.build(nbPoints, [&cloud](int i) { return cloud[i].pos(); }, epsilon);
+
+    // small perturbations, as the transforms around a good registration
+    std::vector<Eigen::Matrix<float, 3, Eigen::Dynamic> > queries(nbTransforms);
+    for (auto& q : queries) {
+        Eigen::Matrix3f rot = Eigen::AngleAxisf(0.1f * Eigen::Vector3f::Random()(0),
+                                                Eigen::Vector3f::Random().normalized()).toRotationMatrix();
+        VectorType trans = 0.05f * VectorType::Random();
+        q.resize(3, nbQueries);
+        for (unsigned int i = 0; i < nbQueries; ++i)
+            q.col(i) = rot * validation[i].pos() + trans;
+    }
+
+    const float sq_eps = epsilon * epsilon;
+    std::vector<int> kdIds(nbTransforms * nbQueries);
+    Utils::Timer t;
+
+    t.reset();
+    for (unsigned int j = 0; j < nbTransforms; ++j)
+        for (unsigned int i = 0; i < nbQueries; ++i)
+            kdIds[j * nbQueries + i] = tree.doQueryRestrictedClosestIndex(queries[j].col(i), sq_eps);
+    const long KDtimestep = t.elapsed().count()/1000;
+
+    const std::pair<long, long> staticTimesteps = checkIndex(staticTree, cloud, queries, kdIds, sq_eps);
+    const std::pair<long, long> gridTimesteps = checkIndex(grid, cloud, queries, kdIds, sq_eps);
+
+    std::cout << "Timers (" << (staticTimesteps.first < KDtimestep && gridTimesteps.first < KDtimestep
+                                ? "PASSED" : "NOT PASSED")
+              << ") " << nbPoints << " points: \t KdTree: " << KDtimestep
+              << "\t StaticKdTree: " << staticTimesteps.first
+              << " (any: " << staticTimesteps.second << ")"
+              << "\t VoxelHashGrid: " << gridTimesteps.first
+              << " (any: " << gridTimesteps.second << ")" << std::endl;
+}
+
+int main(int argc, const char **argv) {
+    if(!Testing::init_testing(argc, argv))
+    {
+        return EXIT_FAILURE;
+    }
+
+    using std::cout;
+    using std::endl;
+
+    // sizes of the sampled segments and of the validation sets of the pose estimation
+    const unsigned int nbQueries = 400;
+    const unsigned int nbTransforms = 200;
+
+    cout << "Restricted closest point queries..." << endl;
+    for(int i = 0; i < Testing::g_repeat; ++i)
+    {
+        for (unsigned int nbPoints : {200, 500, 1000, 2000, 5000})
+            for (float epsilon : {0.02f, 0.05f})
+                CALL_SUBTEST(( testFunction(nbPoints, nbQueries, nbTransforms, epsilon) ));
+    }
+    cout << "Ok..." << endl;
+
+    return EXIT_SUCCESS;
+}
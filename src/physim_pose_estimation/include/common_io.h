@@ -12,6 +12,8 @@
 #include <climits>
 #include <boost/assign.hpp>
 #include <thread>
+#include <mutex>
+#include <memory>
 
 // Basic ROS
 #include <ros/ros.h>
@@ -52,6 +54,7 @@
 
 // For normal estimation
 #include <pcl/features/normal_3d.h>
+#include <pcl/features/integral_image_normal.h>
 #include <pcl/filters/radius_outlier_removal.h>
 #include <pcl/surface/mls.h>
 
@@ -77,6 +80,7 @@ namespace utilities{
 	// global variable
 	extern std::map<std::string, geometry_msgs::Pose> anyTimePoseArray;
 	extern PointCloudRGB::Ptr pc_viz;
+	extern std::mutex vizMutex;		// guards anyTimePoseArray and pc_viz across concurrent scenes
 
 	std::string type2str(int type);
 	void convert3dOrganized(cv::Mat &objDepth, Eigen::Matrix3f &camIntrinsic, PointCloud::Ptr objCloud);
@@ -84,12 +88,13 @@ namespace utilities{
 	void convert3dUnOrganized(cv::Mat &objDepth, Eigen::Matrix3f &camIntrinsic, PointCloud::Ptr objCloud);
 	void convert3dUnOrganizedRGB(cv::Mat &objDepth, cv::Mat &colorImage, Eigen::Matrix3f &camIntrinsic, PointCloudRGB::Ptr objCloud);
 	boost::shared_ptr<pcl::visualization::PCLVisualizer> simpleVis (pcl::PointCloud<pcl::PointXYZ>::ConstPtr cloud);
-	void readDepthImage(cv::Mat &depthImg, std::string path);
+	void readDepthImage(cv::Mat &depthImg, std::string path, bool rotateBits);
 	void readProbImage(cv::Mat &probImg, std::string path);
 	void writeDepthImage(cv::Mat &depthImg, std::string path);
 	void writeClassImage(cv::Mat &classImg, cv::Mat colorImage, std::string path);
 	void convert2d(cv::Mat &objDepth, Eigen::Matrix3f &camIntrinsic, PointCloud::Ptr objCloud);
 	void TransformPolyMesh(const pcl::PolygonMesh::Ptr &mesh_in, pcl::PolygonMesh::Ptr &mesh_out, Eigen::Matrix4f transform);
+	float decimateMesh(const pcl::PolygonMesh &mesh_in, float cellSize, pcl::PolygonMesh &mesh_out);
 	void convertToMatrix(Eigen::Isometry3d &from, Eigen::Matrix4f &to);
 	void convertToIsometry3d(Eigen::Matrix4f &from, Eigen::Isometry3d &to);
 	void invertTransformationMatrix(Eigen::Matrix4f &tform);
@@ -121,6 +126,8 @@ namespace utilities{
 	void performICP(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment, 
 		pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel, 
 		Eigen::Matrix4f &offsetTransform);
+	bool readMemoryUsage(long &rssKB, long &peakRssKB);
+	void sampleMemoryUsage(long &maxRssKB);
 }
 
 #endif
\ No newline at end of file
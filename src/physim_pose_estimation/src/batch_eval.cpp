@@ -0,0 +1,308 @@
+#include <GlobalCfg.hpp>
+#include <SceneCfg.hpp>
+#include <YamlCfg.hpp>
+#include <DepthRenderer.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+
+// Offline evaluation over a list of scene directories (same layout as test-scene/).
+// Models are loaded once and scenes are processed concurrently by a pool of num_threads workers
+// (hardware_concurrency() by default). The calls to the segmentation service are serialized;
+// with num_threads 1 the latency and memory numbers of a scene are not mixed with other scenes.
+//
+// usage: rosrun physim_pose_estimation batch_eval <scene_list.txt> <APC|YCB> <SegmentationMode>
+//                 <HypothesisGenerationMode> <HypothesisVerificationMode> [num_threads]
+
+// global config pointer
+GlobalCfg *pCfg;
+
+namespace utilities{
+  std::map<std::string, geometry_msgs::Pose> anyTimePoseArray;
+  PointCloudRGB::Ptr pc_viz;
+  std::mutex vizMutex;
+}
+
+// stages of the pipeline, in the order they are run by estimatePose. The table removal
+// overlaps the segmentation service and is timed with it
+enum { STAGE_SCENE_INFO, STAGE_SEGMENTATION, STAGE_HYPOTHESIS, STAGE_SELECTION, NUM_STAGES };
+static const char *stageNames[NUM_STAGES] = {"scene_info", "segmentation", "hypothesis_gen", "selection"};
+
+struct SceneResult{
+  std::string scenePath;
+  double stageTime[NUM_STAGES];
+  double totalTime;
+  double rssGrowth;     // MB retained after the scene is deleted
+  double peakRss;       // MB, largest resident set at the end of the stages of the scene
+  std::vector<std::string> objNames;
+  std::vector<float> rotErr;
+  std::vector<float> transErr;
+  std::vector<bool> hasGroundTruth;
+};
+
+/********************************* function: elapsedSince **********************************************
+********************************************************************************************************/
+
+static double elapsedSince(std::chrono::steady_clock::time_point &start){
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double secs = std::chrono::duration<double>(now - start).count();
+  start = now;
+  return secs;
+}
+
+/********************************* function: percentile ************************************************
+nearest-rank percentile of an already sorted sample
+********************************************************************************************************/
+
+static double percentile(const std::vector<double> &sorted, double pct){
+  if(sorted.empty())
+    return 0;
+  int rank = (int)std::ceil(pct/100.0 * sorted.size()) - 1;
+  rank = std::max(0, std::min(rank, (int)sorted.size() - 1));
+  return sorted[rank];
+}
+
+/********************************* function: evaluateScene *********************************************
+runs the estimatePose pipeline on one scene and compares against the ground truth poses
+(scene/object_%d/pose in gt_info.yml, [t q] in world frame) when they are available
+********************************************************************************************************/
+
+static void evaluateScene(std::string scenePath, std::string opMode, std::string segMode,
+                          std::string hypoGenMode, std::string HVMode, SceneResult &result){
+  std::chrono::steady_clock::time_point sceneStart = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point stageStart = sceneStart;
+  std::vector< std::vector<double> > gtPoses;
+  long startRssKB, endRssKB, peakRssKB;
+  utilities::readMemoryUsage(startRssKB, peakRssKB);
+  long stageMaxRssKB = startRssKB;
+
+  if(scenePath[scenePath.size() - 1] != '/')
+    scenePath += "/";
+  result.scenePath = scenePath;
+
+  std::unique_ptr<scene_cfg::SceneCfg> currScene;
+  if(!opMode.compare("APC"))
+    currScene.reset(new scene_cfg::APCSceneCfg(scenePath, segMode, hypoGenMode, HVMode));
+  else
+    currScene.reset(new scene_cfg::YCBSceneCfg(scenePath, segMode, hypoGenMode, HVMode));
+
+  currScene->initRequestContext(pCfg->debugOutput);
+  currScene->getSceneInfo(pCfg);
+
+  yaml_cfg::SceneInfo sceneInfo;
+  if(yaml_cfg::loadSceneInfo(scenePath + "gt_info.yml", sceneInfo))
+    gtPoses = sceneInfo.gtPoses7D;
+  result.stageTime[STAGE_SCENE_INFO] = elapsedSince(stageStart);
+  utilities::sampleMemoryUsage(stageMaxRssKB);
+
+  currScene->perfromSegmentation(pCfg);
+  result.stageTime[STAGE_SEGMENTATION] = elapsedSince(stageStart);
+  utilities::sampleMemoryUsage(stageMaxRssKB);
+
+  currScene->generateHypothesis();
+  result.stageTime[STAGE_HYPOTHESIS] = elapsedSince(stageStart);
+  utilities::sampleMemoryUsage(stageMaxRssKB);
+
+  currScene->performHypothesisSelection();
+  result.stageTime[STAGE_SELECTION] = elapsedSince(stageStart);
+  utilities::sampleMemoryUsage(stageMaxRssKB);
+
+  result.totalTime = elapsedSince(sceneStart);
+
+  // iterate over scene objects
+  for(int ii=0; ii<currScene->numObjects; ii++){
+    Eigen::Matrix4f finalPoseMat;
+    utilities::convertToMatrix(currScene->pSceneObjects[ii]->objPose, finalPoseMat);
+    utilities::convertToWorld(finalPoseMat, currScene->camPose);
+
+    float rotErr = 0, transErr = 0;
+    bool hasGroundTruth = ii < gtPoses.size() && !gtPoses[ii].empty();
+    if(hasGroundTruth){
+      Eigen::Matrix4f gtPoseMat = Eigen::Matrix4f::Zero(4,4);
+      utilities::toTransformationMatrix(gtPoseMat, gtPoses[ii]);
+      utilities::getPoseError(finalPoseMat, gtPoseMat, currScene->pSceneObjects[ii]->pObject->symInfo,
+        rotErr, transErr);
+    }
+
+    result.objNames.push_back(currScene->pSceneObjects[ii]->pObject->objName);
+    result.rotErr.push_back(rotErr);
+    result.transErr.push_back(transErr);
+    result.hasGroundTruth.push_back(hasGroundTruth);
+
+    // Write final result in the file result.txt, same format as the pose_estimation service
+    Eigen::Isometry3d finalPoseIsometric;
+    utilities::convertToIsometry3d(finalPoseMat, finalPoseIsometric);
+    Eigen::Vector3d trans = finalPoseIsometric.translation();
+    Eigen::Quaterniond rot(finalPoseIsometric.rotation());
+
+    std::ofstream pFile;
+    pFile.open (currScene->ctx->resultPath.c_str(), std::ofstream::out | std::ofstream::app);
+    pFile << result.objNames.back() << " " << trans[0] << " " << trans[1] << " " << trans[2]
+      << " " << rot.w() << " " << rot.x() << " " << rot.y() << " " << rot.z() << std::endl;
+    pFile.close();
+  }
+
+  currScene.reset();
+
+  utilities::readMemoryUsage(endRssKB, peakRssKB);
+  result.rssGrowth = (endRssKB - startRssKB)/1024.0;
+  result.peakRss = stageMaxRssKB/1024.0;
+}
+
+/********************************* function: printReport ***********************************************
+********************************************************************************************************/
+
+static void printReport(std::vector<SceneResult> &results, double wallTime, int numThreads){
+  std::cout << std::endl << "==================== batch evaluation ====================" << std::endl;
+  std::cout << "scenes: " << results.size() << ", threads: " << numThreads
+            << ", wall time: " << wallTime << " s, throughput: "
+            << (wallTime > 0 ? results.size()/wallTime : 0) << " scenes/s" << std::endl << std::endl;
+
+  std::cout << std::left << std::setw(16) << "stage (s)" << std::right
+            << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+
+  for(int stage=0; stage<=NUM_STAGES; stage++){
+    std::vector<double> samples;
+    double sum = 0;
+    for(int ii=0; ii<results.size(); ii++){
+      samples.push_back(stage == NUM_STAGES ? results[ii].totalTime : results[ii].stageTime[stage]);
+      sum += samples.back();
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::left << std::setw(16) << (stage == NUM_STAGES ? "total" : stageNames[stage]) << std::right
+              << std::fixed << std::setprecision(3)
+              << std::setw(10) << (samples.empty() ? 0 : sum/samples.size())
+              << std::setw(10) << percentile(samples, 50) << std::setw(10) << percentile(samples, 90)
+              << std::setw(10) << percentile(samples, 99) << std::setw(10) << percentile(samples, 100)
+              << std::endl;
+  }
+
+  // resident set retained after each scene and largest one at its stage ends. Both are process
+  // wide: with concurrent scenes they also count the allocations of the other scenes running
+  std::cout << std::endl << std::left << std::setw(16) << "memory (MB)" << std::right
+            << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p90"
+            << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+  for(int row=0; row<2; row++){
+    std::vector<double> samples;
+    double sum = 0;
+    for(int ii=0; ii<results.size(); ii++){
+      samples.push_back(row == 0 ? results[ii].rssGrowth : results[ii].peakRss);
+      sum += samples.back();
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::left << std::setw(16) << (row == 0 ? "rss_growth" : "stage_max_rss") << std::right
+              << std::fixed << std::setprecision(1)
+              << std::setw(10) << (samples.empty() ? 0 : sum/samples.size())
+              << std::setw(10) << percentile(samples, 50) << std::setw(10) << percentile(samples, 90)
+              << std::setw(10) << percentile(samples, 99) << std::setw(10) << percentile(samples, 100)
+              << std::endl;
+  }
+  std::cout.unsetf(std::ios_base::floatfield);
+  if(numThreads > 1)
+    std::cout << "memory is process wide, run with num_threads 1 for per scene numbers" << std::endl;
+
+  // pose error per object class
+  std::map<std::string, std::vector<std::pair<float, float> > > errors;
+  for(int ii=0; ii<results.size(); ii++)
+    for(int jj=0; jj<results[ii].objNames.size(); jj++)
+      if(results[ii].hasGroundTruth[jj])
+        errors[results[ii].objNames[jj]].push_back(std::make_pair(results[ii].rotErr[jj], results[ii].transErr[jj]));
+
+  if(errors.empty()){
+    std::cout << std::endl << "no ground truth poses found, skipping pose error" << std::endl;
+    return;
+  }
+
+  std::cout << std::endl << std::left << std::setw(40) << "object" << std::right << std::setw(8) << "count"
+            << std::setw(14) << "rot err (deg)" << std::setw(14) << "trans err (m)" << std::endl;
+  for(std::map<std::string, std::vector<std::pair<float, float> > >::iterator it = errors.begin();
+      it != errors.end(); it++){
+    float rotSum = 0, transSum = 0;
+    for(int ii=0; ii<it->second.size(); ii++){
+      rotSum += it->second[ii].first;
+      transSum += it->second[ii].second;
+    }
+    std::cout << std::left << std::setw(40) << it->first << std::right << std::setw(8) << it->second.size()
+              << std::setw(14) << rotSum/it->second.size() << std::setw(14) << transSum/it->second.size()
+              << std::endl;
+  }
+}
+
+/********************************* function: main *******************************************************
+********************************************************************************************************/
+
+int main(int argc, char **argv){
+  if(argc < 6){
+    std::cout << "usage: batch_eval <scene_list.txt> <APC|YCB> <SegmentationMode> "
+              << "<HypothesisGenerationMode> <HypothesisVerificationMode> [num_threads]" << std::endl;
+    return -1;
+  }
+
+  std::string opMode = argv[2];
+  std::string segMode = argv[3];
+  std::string hypoGenMode = argv[4];
+  std::string HVMode = argv[5];
+  int numThreads = argc > 6 ? atoi(argv[6]) : std::thread::hardware_concurrency();
+  if(numThreads < 1)
+    numThreads = 1;
+
+  std::vector<std::string> scenes;
+  std::ifstream sceneList(argv[1]);
+  std::string line;
+  while(std::getline(sceneList, line))
+    if(!line.empty() && line[0] != '#')
+      scenes.push_back(line);
+  if(scenes.empty()){
+    std::cout << "No scenes found in " << argv[1] << std::endl;
+    return -1;
+  }
+
+  pcl::console::setVerbosityLevel(pcl::console::L_ALWAYS);
+  ros::init(argc, argv, "physim_batch_eval");
+  pCfg = new GlobalCfg();
+
+  depth_renderer::start(); // Initialize openGL for rendering
+
+  pCfg->loadObjects();
+
+  // the pipeline updates these for visualization, keep them valid even though nothing is published
+  geometry_msgs::Pose identity_pose;
+  identity_pose.orientation.w = 1;
+  for(int ii=0; ii<pCfg->num_objects; ii++)
+    utilities::anyTimePoseArray.insert(std::make_pair(pCfg->gObjects[ii]->objName, identity_pose));
+  utilities::pc_viz = PointCloudRGB::Ptr(new PointCloudRGB);
+
+  numThreads = std::min(numThreads, (int)scenes.size());
+  std::vector<SceneResult> results(scenes.size());
+  std::atomic<int> nextScene(0);
+
+  std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> workers;
+  for(int tt=0; tt<numThreads; tt++)
+    workers.push_back(std::thread([&](){
+      int idx;
+      while((idx = nextScene++) < scenes.size()){
+        evaluateScene(scenes[idx], opMode, segMode, hypoGenMode, HVMode, results[idx]);
+        std::cout << "[batch_eval] finished " << results[idx].scenePath << " in "
+                  << results[idx].totalTime << " s" << std::endl;
+      }
+    }));
+  for(int tt=0; tt<numThreads; tt++)
+    workers[tt].join();
+
+  double wallTime = elapsedSince(batchStart);
+  printReport(results, wallTime, numThreads);
+
+  depth_renderer::stop();
+  delete pCfg;
+  return 0;
+}
+
+/********************************* end of functions ****************************************************
+*******************************************************************************************************/
@@ -1,4 +1,5 @@
 #include <GlobalCfg.hpp>
+#include <YamlCfg.hpp>
 
 /********************************* function: constructor ***********************************************
 *******************************************************************************************************/
@@ -13,6 +14,9 @@ GlobalCfg::GlobalCfg(){
 		std::cout<<"Please set PHYSIM_GLOBAL_POSE in bashrc"<<std::endl;
 	    exit(-1);
 	}
+
+	ros::param::param<bool>("~debug_output", debugOutput, true);
+	ros::param::param<std::string>("~segment_normals", segmentNormals, "MLS");
 }
 
 /********************************* function: destructor ***********************************************
@@ -28,36 +32,23 @@ Read objects from the config file and load them
 ********************************************************************************************************/
 
 void GlobalCfg::loadObjects(){
-	float modelDiscretization;
+	yaml_cfg::ObjectsInfo objInfo;
 
-	system(("rosparam load " + env_p + "/src/physim_pose_estimation/src/data_layer/obj_config.yml").c_str());
-	nh.getParam("/objects/num_objects", num_objects);
-	nh.getParam("/objects/modelDiscretization", modelDiscretization);
+	if(!yaml_cfg::loadObjectsInfo(env_p + "/src/physim_pose_estimation/src/data_layer/obj_config.yml", objInfo))
+		exit(-1);
+	num_objects = objInfo.num_objects;
 
 	for(int ii=0; ii<num_objects; ii++){
-		char objTopic[50];
-		std::string obj_name;
-		std::string obj_type;
-		int classId;
-		std::vector<float> symmetry(3);
-		std::string pcdLocation;
-		std::string objLocation;
-		
-		sprintf(objTopic, "/objects/object_%d", ii+1);
-		nh.getParam((std::string(objTopic) + "/name").c_str(), obj_name);
-		nh.getParam((std::string(objTopic) + "/type").c_str(), obj_type);
-		nh.getParam((std::string(objTopic) + "/classId").c_str(), classId);
-		nh.getParam((std::string(objTopic) + "/symmetry").c_str(), symmetry);
-		nh.getParam((std::string(objTopic) + "/location_obj").c_str(), objLocation);
-		nh.getParam((std::string(objTopic) + "/location_pcd").c_str(), pcdLocation);
+		yaml_cfg::ObjectInfo &obj = objInfo.objects[ii];
 
-		std::cout << "Loaded Object " << ii+1 << " : " << obj_name << ", " << obj_type << ", " << classId << std::endl;
-		Eigen::Vector3f symInfo(symmetry[0], symmetry[1], symmetry[2]);
+		std::cout << "Loaded Object " << ii+1 << " : " << obj.name << ", " << obj.type << ", " << obj.classId << std::endl;
 		
-		objects::Objects *tmpObj = new objects::Objects(env_p, obj_name, obj_type, symInfo, classId, 
-											modelDiscretization, pcdLocation, objLocation);
+		objects::Objects *tmpObj = new objects::Objects(env_p, obj.name, obj.type, obj.symmetry, obj.classId, 
+											objInfo.modelDiscretization, obj.location_pcd, obj.location_obj);
 
-		tmpObj->readPPFMap(env_p, obj_name);
+		tmpObj->readPPFMap(env_p, obj.name);
+		tmpObj->buildMatcherContext(env_p, obj.name);
+		tmpObj->buildSimplifiedModels(env_p, obj.location_obj, obj.hullVertices, obj.renderCell);
 
 		gObjects.push_back(tmpObj);
 	}
@@ -13,6 +13,9 @@ public:
 	std::string env_p;
 	ros::NodeHandle nh;
 
+	bool debugOutput;	// keep per-request scratch folders in the scene directory
+	std::string segmentNormals;	// normals of the segments: "MLS" or "INTEGRAL_IMAGE"
+
 	int num_objects;
 	std::vector<objects::Objects*> gObjects;
 };
@@ -1,4 +1,10 @@
 #include <Objects.hpp>
+#include <PhySim.hpp>
+
+// Super4PCS package
+std::shared_ptr<const Super4PCS::ModelContext> buildModelContextSuper4PCS(
+			const Eigen::MatrixXf& sampledModel, const Eigen::MatrixXf& validationModel, std::string hullPath,
+			std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf);
 
 namespace objects{
 
@@ -47,4 +53,41 @@ namespace objects{
 		}
 		std::cout << "PPFMap size is: " << PPFMap.size() << std::endl;
 	}
-}
\ No newline at end of file
+
+	/********************************* function: buildMatcherContext **************************************
+	Centers the model clouds and prepares the point pair features for the matcher once, the
+	requests only prepare their segment. Call after readPPFMap, the context keeps a reference
+	to PPFMap.
+	*******************************************************************************************************/
+
+	static Eigen::MatrixXf toMatrix(pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr cloud){
+		Eigen::MatrixXf points(cloud->points.size(), 6);
+		for(int ii=0; ii<cloud->points.size(); ii++){
+			const pcl::PointXYZRGBNormal &pt = cloud->points[ii];
+			points.row(ii) << pt.x, pt.y, pt.z, pt.normal[0], pt.normal[1], pt.normal[2];
+		}
+		return points;
+	}
+
+	void Objects::buildMatcherContext(std::string env_p, std::string objName){
+		matcherContext = buildModelContextSuper4PCS(toMatrix(pclModelSampled), toMatrix(pclModel),
+			env_p + "/src/physim_pose_estimation/models_search/" + objName + "/hull.ply", PPFMap, max_count_ppf);
+	}
+
+	/********************************* function: buildSimplifiedModels ************************************
+	Reduces the collision hull and the render mesh once at startup, as selected in obj_config.yml,
+	and reports how far each one may deviate from the full model.
+	*******************************************************************************************************/
+
+	void Objects::buildSimplifiedModels(std::string env_p, std::string objLocation, int hullVertices, float renderCell){
+		float hullError = physim::buildCollisionHull(env_p + "/src/physim_pose_estimation/models/" + objLocation,
+			hullVertices, collisionHull);
+
+		renderModel = pcl::PolygonMesh::Ptr(new pcl::PolygonMesh);
+		float renderError = utilities::decimateMesh(objModel, renderCell, *renderModel);
+
+		std::cout << objName << ": collision hull " << collisionHull.size() << " vertices, max shrinkage " 
+				  << hullError << " m; render mesh " << objModel.polygons.size() << " -> " << renderModel->polygons.size() 
+				  << " polygons, max vertex shift " << renderError << " m" << std::endl;
+	}
+}
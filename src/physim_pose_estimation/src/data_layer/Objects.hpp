@@ -5,6 +5,9 @@
 #include <physim_pose_estimation/EstimateObjectPose.h>
 #include <physim_pose_estimation/ObjectPose.h>
 
+// model side of the Super4PCS matcher
+namespace Super4PCS{ class ModelContext; }
+
 namespace objects{
 
 	class Objects{
@@ -13,15 +16,21 @@ namespace objects{
 				 Eigen::Vector3f symInfo, uchar classId, float modelDiscretization,
 				 std::string pcdLocation, std::string objLocation);
 		void readPPFMap(std::string env_p, std::string objName);
+		void buildMatcherContext(std::string env_p, std::string objName);
+		void buildSimplifiedModels(std::string env_p, std::string objLocation, int hullVertices, float renderCell);
 
 		int objIdx;
 		std::string objName;
 		pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel;
 		pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled;
 		pcl::PolygonMesh objModel;
+		pcl::PolygonMesh::Ptr renderModel;			// depth only, decimated mesh for the renderer
+		std::vector<Eigen::Vector3f> collisionHull;	// points of the physics convex hull
 		Eigen::Vector3f symInfo;
 		std::map<std::vector<int>, std::vector<std::pair<int,int> > > PPFMap;
 		int max_count_ppf;
+		// preprocessed model shared by the hypothesis generation of every request
+		std::shared_ptr<const Super4PCS::ModelContext> matcherContext;
 	};
 }
 #endif
\ No newline at end of file
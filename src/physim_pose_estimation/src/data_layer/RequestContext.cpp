@@ -0,0 +1,79 @@
+#include <RequestContext.hpp>
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace request_ctx{
+
+	static std::atomic<int> nextRequestId(0);
+
+	// scenes whose result.txt, debug_search/ and debug_super4PCS/ are in use by a request
+	static std::mutex activeScenesMutex;
+	static std::set<std::string> activeScenes;
+
+	/********************************* function: resetDirectory ********************************************
+	*******************************************************************************************************/
+
+	static void resetDirectory(std::string path){
+		boost::system::error_code ec;
+		fs::remove_all(path, ec);
+		fs::create_directories(path, ec);
+		if(ec){
+			std::cout << "Failed to create " << path << ": " << ec.message() << std::endl;
+			exit(-1);
+		}
+	}
+
+	/********************************* function: constructor ***********************************************
+	*******************************************************************************************************/
+
+	RequestContext::RequestContext(std::string scenePath, bool debugOutput){
+		this->requestId = nextRequestId++;
+		this->debugOutput = debugOutput;
+		this->scenePath = scenePath;
+
+		// the first request on a scene owns its result file and debug folders, requests that
+		// run concurrently on the same scene only return their poses
+		{
+			std::lock_guard<std::mutex> activeLock(activeScenesMutex);
+			ownsScene = activeScenes.insert(scenePath).second;
+		}
+		if(debugOutput && !ownsScene)
+			std::cout << "Scene " << scenePath << " is in use by another request, the debug output of request "
+					  << requestId << " is not kept" << std::endl;
+
+		if(debugOutput && ownsScene)
+			rootDir = scenePath;
+		else
+			rootDir = (fs::temp_directory_path() / fs::unique_path("physim_%%%%-%%%%-%%%%-%%%%")).string() + "/";
+		searchDir = rootDir + "debug_search/";
+		super4PCSDir = rootDir + "debug_super4PCS/";
+
+		resultPath = (ownsScene ? scenePath : rootDir) + "result.txt";
+		boost::system::error_code ec;
+		fs::remove(resultPath, ec);
+
+		resetDirectory(searchDir);
+		resetDirectory(super4PCSDir);
+	}
+
+	/********************************* function: destructor ************************************************
+	*******************************************************************************************************/
+
+	RequestContext::~RequestContext(){
+		if(rootDir != scenePath){
+			boost::system::error_code ec;
+			fs::remove_all(rootDir, ec);
+		}
+		if(ownsScene){
+			std::lock_guard<std::mutex> activeLock(activeScenesMutex);
+			activeScenes.erase(scenePath);
+		}
+	}
+
+}// namespace
@@ -0,0 +1,33 @@
+#ifndef REQUEST_CONTEXT
+#define REQUEST_CONTEXT
+
+#include <string>
+
+// Scratch locations of a single pose estimation request. The pipeline stages exchange
+// segments, probability maps and renderings through these directories, so two requests
+// in flight must never share them.
+namespace request_ctx{
+
+	class RequestContext{
+		public:
+			// debugOutput: keep the scratch directories in the scene folder after the request,
+			// otherwise they are created in the system temp directory and removed on destruction.
+			// A request on a scene already in use always works in the temp directory.
+			RequestContext(std::string scenePath, bool debugOutput);
+			~RequestContext();
+
+			int requestId;
+			bool debugOutput;
+
+			std::string scenePath;
+			std::string rootDir;		// removed on destruction unless it is the scene folder
+			std::string searchDir;		// was scenePath + "debug_search/"
+			std::string super4PCSDir;	// was scenePath + "debug_super4PCS/"
+			std::string resultPath;		// scenePath + "result.txt" for the owner of the scene
+
+		private:
+			bool ownsScene;
+	};
+
+}//namespace
+#endif
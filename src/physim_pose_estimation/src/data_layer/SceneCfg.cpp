@@ -1,135 +1,302 @@
 #include <SceneCfg.hpp>
 #include <Segmentation.hpp>
 #include <HypothesisSelection.hpp>
+#include <YamlCfg.hpp>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
 
 #include <cv_bridge/cv_bridge.h>
 
-clock_t preprocess_begin_time;
-
 namespace scene_cfg{
 
+	static std::mutex segmentationServiceMutex;
+
+	// Support plane of each camera calibration, in camera frame. The cameras are mounted
+	// rigidly: the plane is fitted once and only re-validated on the following frames.
+	struct CachedPlane{
+		Eigen::Matrix<float, 4, 1, Eigen::DontAlign> coefficients;	// unit normal and offset
+		float inlierFraction;			// of the sampled pixels when it was fitted
+	};
+	static std::map<std::string, CachedPlane> planeCache;
+	static std::mutex planeCacheMutex;
+
+	// Table model of each scene folder and table pose of each camera calibration and table,
+	// the pose only changes with the camera for a rigidly mounted camera
+	static std::map<std::string, PointCloudRGB::Ptr> tableModelCache;
+	static std::map<std::string, std::vector<float> > tablePoseCache;
+	static std::mutex tableCacheMutex;
+
+	static const int planeSampleStride = 4;
+	static const float planeDistThreshold = 0.005;
+	static const int minPlaneSamples = 100;				// valid sampled pixels needed for a fit
+	static const float minPlaneInlierFraction = 0.2;	// of the sampled pixels, for any plane
+
 	/********************************* function: constructor ***********************************************
 	*******************************************************************************************************/
 
 	SceneCfg::SceneCfg(std::string SceneFiles, std::string SegmentationMode, 
 						std::string HypothesisGenerationMode, std::string HypothesisVerificationMode){
 		srand (time(NULL));
-		
-		preprocess_begin_time = clock();
 
 		scenePath = SceneFiles;
 		segMode = SegmentationMode;
 		hypoGenMode = HypothesisGenerationMode;
 		HVMode = HypothesisVerificationMode;
+		ctx = NULL;
+		depthBitRotation = false;
+		tablePlane.setZero();
 	}
 
 	/********************************* function: destructor ************************************************
 	*******************************************************************************************************/
 
 	SceneCfg::~SceneCfg(){
+		for(int ii=0; ii<pSceneObjects.size(); ii++)
+			delete pSceneObjects[ii];
+		delete ctx;
 	}
 
-	/********************************* function: removeTable ***********************************************
-	References: http://pointclouds.org/documentation/tutorials/planar_segmentation.php,
-	http://pointclouds.org/documentation/tutorials/extract_indices.php
+	/********************************* function: initRequestContext ****************************************
+	Sets up the scratch folders used by the pipeline stages for this request
 	*******************************************************************************************************/
 
-	void SceneCfg::removeTable(){
-		PointCloudRGB::Ptr SampledSceneCloud(new PointCloudRGB);
-		sceneCloud = PointCloudRGB::Ptr(new PointCloudRGB);
-		utilities::convert3dOrganizedRGB(depthImage, colorImage, camIntrinsic, sceneCloud);
-		
-		utilities::pc_viz->resize(sceneCloud->width*sceneCloud->height);
-		copyPointCloud(*sceneCloud, *utilities::pc_viz);
+	void SceneCfg::initRequestContext(bool debugOutput){
+		delete ctx;
+		ctx = new request_ctx::RequestContext(scenePath, debugOutput);
+	}
 
-		// Creating the filtering object: downsample the dataset using a leaf size of 0.5cm
-		pcl::VoxelGrid<pcl::PointXYZRGB> sor;
-		sor.setInputCloud (sceneCloud);
-		sor.setLeafSize (0.005f, 0.005f, 0.005f);
-		sor.filter (*SampledSceneCloud);
+	/********************************* function: getCameraKey **********************************************
+	Camera calibration the cached table plane belongs to
+	*******************************************************************************************************/
 
-		pcl::io::savePLYFile(scenePath + "debug_super4PCS/scene.ply", *SampledSceneCloud);
+	static std::string getCameraKey(const Eigen::Matrix3f &camIntrinsic, const Eigen::Matrix4f &camPose){
+		std::ostringstream key;
+		key << std::fixed << std::setprecision(4);
+		for(int ii=0; ii<9; ii++)
+			key << camIntrinsic(ii) << " ";
+		for(int ii=0; ii<16; ii++)
+			key << camPose(ii) << " ";
+		return key.str();
+	}
+
+	/********************************* function: getPlaneInlierFraction ***********************************
+	Fraction of the sampled valid pixels within planeDistThreshold of the plane
+	*******************************************************************************************************/
+
+	static float getPlaneInlierFraction(const cv::Mat &depthImage, const Eigen::Matrix3f &camIntrinsic,
+					const Eigen::Vector4f &plane){
+		int numValid = 0, numInliers = 0;
+		for(int u=0; u<depthImage.rows; u+=planeSampleStride){
+			const float *depthRow = depthImage.ptr<float>(u);
+			float rowTerm = plane[1]*(u - camIntrinsic(1,2))/camIntrinsic(1,1) + plane[2];
+			for(int v=0; v<depthImage.cols; v+=planeSampleStride){
+				float depth = depthRow[v];
+				if(depth > 0.1 && depth < 2.0){
+					numValid++;
+					float dist = depth*(plane[0]*(v - camIntrinsic(0,2))/camIntrinsic(0,0) + rowTerm) + plane[3];
+					if(fabs(dist) < planeDistThreshold)
+						numInliers++;
+				}
+			}
+		}
+		return numValid ? float(numInliers)/numValid : 0;
+	}
+
+	/********************************* function: fitTablePlane *********************************************
+	MSAC plane fit on the valid pixels of a planeSampleStride grid of the depth image, the
+	organized sampling replaces the voxel grid of the full scene cloud. Returns a zero plane
+	when the fit fails.
+	*******************************************************************************************************/
+
+	static Eigen::Vector4f fitTablePlane(const cv::Mat &depthImage, const Eigen::Matrix3f &camIntrinsic){
+		PointCloud::Ptr samples(new PointCloud);
+		for(int u=0; u<depthImage.rows; u+=planeSampleStride)
+			for(int v=0; v<depthImage.cols; v+=planeSampleStride){
+				float depth = depthImage.at<float>(u,v);
+				if(depth > 0.1 && depth < 2.0)
+					samples->points.push_back(pcl::PointXYZ((v - camIntrinsic(0,2)) * depth / camIntrinsic(0,0),
+						(u - camIntrinsic(1,2)) * depth / camIntrinsic(1,1), depth));
+			}
+		samples->width = samples->points.size();
+		samples->height = 1;
+		if(int(samples->points.size()) < minPlaneSamples)
+			return Eigen::Vector4f::Zero();
 
-		// Plane Fitting
 		pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
 		pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-		pcl::SACSegmentation<pcl::PointXYZRGB> seg;
+		pcl::SACSegmentation<pcl::PointXYZ> seg;
 		seg.setOptimizeCoefficients (true);
 		seg.setModelType (pcl::SACMODEL_PLANE);
 		seg.setMethodType (pcl::SAC_MSAC);
-		seg.setDistanceThreshold (0.005);
+		seg.setDistanceThreshold (planeDistThreshold);
 		seg.setMaxIterations (1000);
-		seg.setInputCloud (SampledSceneCloud);
+		seg.setInputCloud (samples);
 		seg.segment (*inliers, *coefficients);
 
+		if(coefficients->values.size() != 4)
+			return Eigen::Vector4f::Zero();
+		Eigen::Vector4f plane(coefficients->values[0], coefficients->values[1],
+							  coefficients->values[2], coefficients->values[3]);
+		float normalLength = plane.head<3>().norm();
+		if(!std::isfinite(normalLength) || normalLength < 1e-6 || !std::isfinite(plane[3]))
+			return Eigen::Vector4f::Zero();
+		return plane / normalLength;
+	}
+
+	/********************************* function: removeTable ***********************************************
+	Zeroes the depth of the pixels on the support plane. The plane of the camera is reused
+	while it still explains enough of the sampled pixels, otherwise it is fitted again. When
+	the fit fails the depth image is left untouched and tablePlane stays zero.
+	References: http://pointclouds.org/documentation/tutorials/planar_segmentation.php
+	*******************************************************************************************************/
+
+	void SceneCfg::removeTable(){
+		sceneCloud = PointCloudRGB::Ptr(new PointCloudRGB);
+		utilities::convert3dOrganizedRGB(depthImage, colorImage, camIntrinsic, sceneCloud);
+		
+		{
+			std::lock_guard<std::mutex> vizLock(utilities::vizMutex);
+			utilities::pc_viz->resize(sceneCloud->width*sceneCloud->height);
+			copyPointCloud(*sceneCloud, *utilities::pc_viz);
+		}
+
+		// the table may be partly occluded by the objects of the new frame
+		const float minInlierRatio = 0.7;
+		std::string cameraKey = getCameraKey(camIntrinsic, camPose);
+		Eigen::Vector4f plane;
+		bool validPlane = false;
+		{
+			std::lock_guard<std::mutex> cacheLock(planeCacheMutex);
+			std::map<std::string, CachedPlane>::iterator it = planeCache.find(cameraKey);
+			if(it != planeCache.end()){
+				plane = it->second.coefficients;
+				float inlierFraction = getPlaneInlierFraction(depthImage, camIntrinsic, plane);
+				validPlane = inlierFraction >= minPlaneInlierFraction &&
+							 inlierFraction >= minInlierRatio*it->second.inlierFraction;
+			}
+		}
+		if(!validPlane){
+			plane = fitTablePlane(depthImage, camIntrinsic);
+			if(plane.head<3>().isZero()){
+				std::cout << "table plane fit failed, the depth image is kept" << std::endl;
+				tablePlane.setZero();
+				if(ctx->debugOutput)
+					utilities::writeDepthImage(depthImage, ctx->searchDir + "scene.png");
+				return;
+			}
+
+			// a weak plane is still removed from this frame, but not offered to the next ones
+			CachedPlane cached = {plane, getPlaneInlierFraction(depthImage, camIntrinsic, plane)};
+			if(cached.inlierFraction >= minPlaneInlierFraction){
+				std::lock_guard<std::mutex> cacheLock(planeCacheMutex);
+				planeCache[cameraKey] = cached;
+			}
+		}
+		std::cout << "table plane " << (validPlane ? "reused" : "fitted") << ": " << plane.transpose() << std::endl;
+		tablePlane = plane;
+
+		// signed distance of pixel (u,v) at depth z: z*(colTerm[v] + rowTerm[u]) + d, a
+		// branch free pass over each row
 		int imgWidth = depthImage.cols;
 		int imgHeight = depthImage.rows;
-
-		for(int u=0; u<imgHeight; u++)
+		std::vector<float> colTerm(imgWidth);
+		for(int v=0; v<imgWidth; v++)
+			colTerm[v] = plane[0]*(v - camIntrinsic(0,2))/camIntrinsic(0,0);
+
+		for(int u=0; u<imgHeight; u++){
+			float *depthRow = depthImage.ptr<float>(u);
+			const float rowTerm = plane[1]*(u - camIntrinsic(1,2))/camIntrinsic(1,1) + plane[2];
+			const float offset = plane[3];
 			for(int v=0; v<imgWidth; v++){
-				float depth = depthImage.at<float>(u,v);
-				pcl::PointXYZRGB pt;
-				pt.x = (float)((v - camIntrinsic(0,2)) * depth / camIntrinsic(0,0));
-				pt.y = (float)((u - camIntrinsic(1,2)) * depth / camIntrinsic(1,1));
-				pt.z = depth;
-				double dist = pcl::pointToPlaneDistance(pt, coefficients->values[0], coefficients->values[1],
-														coefficients->values[2], coefficients->values[3]);
-				if(dist<0.005)
-					depthImage.at<float>(u,v) = 0;
+				float dist = depthRow[v]*(colTerm[v] + rowTerm) + offset;
+				depthRow[v] = fabs(dist) < planeDistThreshold ? 0.f : depthRow[v];
+			}
 		}
-		utilities::writeDepthImage(depthImage, scenePath + "debug_search/scene.png");
+
+		if(ctx->debugOutput)
+			utilities::writeDepthImage(depthImage, ctx->searchDir + "scene.png");
+	}
+
+	/********************************* function: getTableModel *********************************************
+	Table model point cloud, read once per file
+	*******************************************************************************************************/
+
+	static PointCloudRGB::Ptr getTableModel(std::string tablePath){
+		std::lock_guard<std::mutex> cacheLock(tableCacheMutex);
+		std::map<std::string, PointCloudRGB::Ptr>::iterator it = tableModelCache.find(tablePath);
+		if(it != tableModelCache.end())
+			return it->second;
+
+		PointCloudRGB::Ptr tableModel(new PointCloudRGB);
+		pcl::io::loadPLYFile(tablePath, *tableModel);
+		tableModelCache[tablePath] = tableModel;
+		return tableModel;
 	}
 
 	/********************************* function: getTableParams ********************************************
+	Table pose in world frame for the physics engine: the table model is placed at the height
+	of the inliers of the plane found by removeTable, then aligned to the scene with ICP. The
+	pose is cached per camera calibration and table model, later requests skip the ICP. Returns
+	false, without caching, when there is no table plane or the alignment fails.
 	*******************************************************************************************************/
 
-	void SceneCfg::getTableParams(){
+	bool SceneCfg::getTableParams(){
+		std::string tablePath = scenePath + "../table.ply";
+		std::string poseKey = getCameraKey(camIntrinsic, camPose) + tablePath;
+		{
+			std::lock_guard<std::mutex> cacheLock(tableCacheMutex);
+			std::map<std::string, std::vector<float> >::iterator it = tablePoseCache.find(poseKey);
+			if(it != tablePoseCache.end()){
+				tableParams = it->second;
+				std::cout << "table pose reused" << std::endl;
+				return true;
+			}
+		}
 
 		PointCloudRGB::Ptr SampledSceneCloud(new PointCloudRGB);
-		PointCloudRGB::Ptr SampledTableCloud(new PointCloudRGB);
 		PointCloudRGB::Ptr tableCloudTrans (new PointCloudRGB);
 		PointCloudRGB::Ptr sceneCloudTrans (new PointCloudRGB);
 
-		pcl::ModelCoefficients::Ptr coefficients (new pcl::ModelCoefficients);
-		pcl::PointIndices::Ptr inliers (new pcl::PointIndices);
-		pcl::SACSegmentation<pcl::PointXYZRGB> seg;
-
-		PointCloudRGB::Ptr cloud_p(new PointCloudRGB);
-		pcl::ExtractIndices<pcl::PointXYZRGB> extract;
-
 		pcl::IterativeClosestPoint<pcl::PointXYZRGB, pcl::PointXYZRGB> icp;
 		PointCloudRGB Final;
 
 		float mean_z = 0;
+		int numInliers = 0;
 		Eigen::Matrix4f tablePose;
 		Eigen::Matrix4f icpTransform;
 
-		pcl::io::loadPLYFile(scenePath + "debug_super4PCS/scene.ply", *SampledSceneCloud);
-		pcl::io::loadPLYFile(scenePath + "../table.ply", *SampledTableCloud);
+		// downsample the scene cloud using a leaf size of 0.5cm
+		pcl::VoxelGrid<pcl::PointXYZRGB> sor;
+		sor.setInputCloud (sceneCloud);
+		sor.setLeafSize (0.005f, 0.005f, 0.005f);
+		sor.filter (*SampledSceneCloud);
+		if(ctx->debugOutput)
+			pcl::io::savePLYFile(ctx->super4PCSDir + "scene.ply", *SampledSceneCloud);
 
-		// get table inlier points
 		pcl::transformPointCloud(*SampledSceneCloud, *sceneCloudTrans, camPose);
-		seg.setOptimizeCoefficients (true);
-		seg.setModelType (pcl::SACMODEL_PLANE);
-		seg.setMethodType (pcl::SAC_MSAC);
-		seg.setDistanceThreshold (0.005);
-		seg.setMaxIterations (1000);
-		seg.setInputCloud (sceneCloudTrans);
-		seg.segment (*inliers, *coefficients);
-		extract.setInputCloud (sceneCloudTrans);
-	    extract.setIndices (inliers);
-	    extract.setNegative (false);
-	    extract.filter (*cloud_p);
-
-	    // get estimated table pose
-		for(int ii=0; ii<cloud_p->points.size(); ii++)
-			mean_z += cloud_p->points[ii].z;
-		mean_z /= cloud_p->points.size();
+
+		// get estimated table pose, from the world height of the table plane inliers
+		if(tablePlane.head<3>().isZero()){
+			std::cout << "no table plane, table pose not estimated" << std::endl;
+			return false;
+		}
+		for(int ii=0; ii<SampledSceneCloud->points.size(); ii++){
+			float dist = tablePlane.head<3>().dot(SampledSceneCloud->points[ii].getVector3fMap()) + tablePlane[3];
+			if(fabs(dist) < planeDistThreshold){
+				mean_z += sceneCloudTrans->points[ii].z;
+				numInliers++;
+			}
+		}
+		if(numInliers == 0){
+			std::cout << "no table plane inliers, table pose not estimated" << std::endl;
+			return false;
+		}
+		mean_z /= numInliers;
 		tablePose.setIdentity();
 		tablePose(0,3) = 0.7;
 		tablePose(2,3) = mean_z - 0.2/*table height*/; 
-		pcl::transformPointCloud(*SampledTableCloud, *tableCloudTrans, tablePose);
+		pcl::transformPointCloud(*getTableModel(tablePath), *tableCloudTrans, tablePose);
 
 		// performing icp
 		icp.setInputSource(sceneCloudTrans);
@@ -138,59 +305,60 @@ namespace scene_cfg{
 		icp.setMaximumIterations(50);
 		icp.setTransformationEpsilon (1e-9);
 		icp.align(Final);
+		if(!icp.hasConverged()){
+			std::cout << "table icp did not converge, table pose not estimated" << std::endl;
+			return false;
+		}
 		icpTransform = icp.getFinalTransformation();
 		utilities::invertTransformationMatrix(icpTransform);
 		tablePose = icpTransform*tablePose;
+		if(!tablePose.allFinite()){
+			std::cout << "table pose is not finite" << std::endl;
+			return false;
+		}
 
-		tableParams.push_back(tablePose(0,0));
-		tableParams.push_back(tablePose(0,1));
-		tableParams.push_back(tablePose(0,2));
-		tableParams.push_back(tablePose(0,3));
-		tableParams.push_back(tablePose(1,0));
-		tableParams.push_back(tablePose(1,1));
-		tableParams.push_back(tablePose(1,2));
-		tableParams.push_back(tablePose(1,3));
-		tableParams.push_back(tablePose(2,0));
-		tableParams.push_back(tablePose(2,1));
-		tableParams.push_back(tablePose(2,2));
-		tableParams.push_back(tablePose(2,3));
+		tableParams.clear();
+		for(int row=0; row<3; row++)
+			for(int col=0; col<4; col++)
+				tableParams.push_back(tablePose(row,col));
+
+		std::lock_guard<std::mutex> cacheLock(tableCacheMutex);
+		tablePoseCache[poseKey] = tableParams;
+		return true;
 	}
 
-	/********************************* getSceneInfo ********************************************************
+	/********************************* function: loadSceneFiles ********************************************
+	Reads gt_info.yml and the RGB-D frame from the scene directory
 	*******************************************************************************************************/
 
-	void APCSceneCfg::getSceneInfo(GlobalCfg *gCfg){
-		std::vector<double> camPose7D;
-		XmlRpc::XmlRpcValue camIntr;
+	void SceneCfg::loadSceneFiles(GlobalCfg *gCfg){
+		yaml_cfg::SceneInfo sceneInfo;
 
 		// Loading params from the yaml file
-		system(("rosparam load " + scenePath + "gt_info.yml").c_str());
-
-		gCfg->nh.getParam("/camera/camera_pose", camPose7D);
-		gCfg->nh.getParam("/scene/num_objects", numObjects);
+		if(!yaml_cfg::loadSceneInfo(scenePath + "gt_info.yml", sceneInfo))
+			exit(-1);
+		numObjects = sceneInfo.numObjects;
 
 		camPose = Eigen::Matrix4f::Zero(4,4);
-		utilities::toTransformationMatrix(camPose, camPose7D);
+		utilities::toTransformationMatrix(camPose, sceneInfo.camPose7D);
 
-		// Loading RGB and depth images
+		// Loading RGB and depth images, gt_info.yml may override the dataset's depth encoding
+		if(sceneInfo.depthBitRotation >= 0)
+			depthBitRotation = sceneInfo.depthBitRotation;
 		colorImage = cv::imread(scenePath + "frame-000000.color.png", CV_LOAD_IMAGE_COLOR);
-	    utilities::readDepthImage(depthImage, scenePath + "frame-000000.depth.png");
+	    utilities::readDepthImage(depthImage, scenePath + "frame-000000.depth.png", depthBitRotation);
 
 		// Loading scene objects
 		for(int ii=0; ii<numObjects; ii++){
-			std::string currObject;
-			char objTopic[50];
-			sprintf(objTopic, "/scene/object_%d/name", ii+1);
-			gCfg->nh.getParam(objTopic, currObject);
+			std::string currObject = sceneInfo.objNames[ii];
 
-			for(int jj=0; jj< gCfg->num_objects; jj++){\
+			for(int jj=0; jj< gCfg->num_objects; jj++){
 				if(!currObject.compare(gCfg->gObjects[jj]->objName)) {
 
 					std::cout << "Loading object: " << currObject << std::endl;
 
 					scene_cfg::SceneObjects *tSceneObj = new scene_cfg::SceneObjects();
 					tSceneObj->pObject = gCfg->gObjects[jj];
-					tSceneObj->objMask = cv::Mat::zeros(colorImage.rows, colorImage.cols, CV_32FC1);
 					tSceneObj->objPose.matrix().setIdentity();
 					pSceneObjects.push_back(tSceneObj);
 				}
@@ -198,63 +366,21 @@ namespace scene_cfg{
 		}
 
 	  	// Reading camera intrinsic matrix
-		camIntrinsic = Eigen::Matrix3f::Zero(3,3);
-		gCfg->nh.getParam("/camera/camera_intrinsics", camIntr);
-		for(int32_t ii = 0; ii < camIntr.size(); ii++)
-			for(int32_t jj = 0; jj < camIntr[ii].size(); jj++)
-				camIntrinsic(ii, jj) = static_cast<double>(camIntr[ii][jj]);
+		camIntrinsic = sceneInfo.camIntrinsic;
 	}
 
-	void YCBSceneCfg::getSceneInfo(GlobalCfg *gCfg){
-		std::vector<double> camPose7D;
-		XmlRpc::XmlRpcValue camIntr;
-
-		// Loading params from the yaml file
-		system(("rosparam load " + scenePath + "gt_info.yml").c_str());
-
-		gCfg->nh.getParam("/camera/camera_pose", camPose7D);
-		gCfg->nh.getParam("/scene/num_objects", numObjects);
-
-		camPose = Eigen::Matrix4f::Zero(4,4);
-		utilities::toTransformationMatrix(camPose, camPose7D);
-
-		// Loading RGB and depth images
-		colorImage = cv::imread(scenePath + "frame-000000.color.png", CV_LOAD_IMAGE_COLOR);
-	    utilities::readDepthImage(depthImage, scenePath + "frame-000000.depth.png");
-
-		// Loading scene objects
-		for(int ii=0; ii<numObjects; ii++){
-			std::string currObject;
-			char objTopic[50];
-			sprintf(objTopic, "/scene/object_%d/name", ii+1);
-			gCfg->nh.getParam(objTopic, currObject);
-
-			for(int jj=0; jj< gCfg->num_objects; jj++){\
-				if(!currObject.compare(gCfg->gObjects[jj]->objName)) {
-
-					std::cout << "Loading object: " << currObject << std::endl;
+	/********************************* getSceneInfo ********************************************************
+	*******************************************************************************************************/
 
-					scene_cfg::SceneObjects *tSceneObj = new scene_cfg::SceneObjects();
-					tSceneObj->pObject = gCfg->gObjects[jj];
-					tSceneObj->objMask = cv::Mat::zeros(colorImage.rows, colorImage.cols, CV_32FC1);
-					tSceneObj->objPose.matrix().setIdentity();
-					pSceneObjects.push_back(tSceneObj);
-				}
-			}
-		}
+	void APCSceneCfg::getSceneInfo(GlobalCfg *gCfg){
+		loadSceneFiles(gCfg);
+	}
 
-	  	// Reading camera intrinsic matrix
-		camIntrinsic = Eigen::Matrix3f::Zero(3,3);
-		gCfg->nh.getParam("/camera/camera_intrinsics", camIntr);
-		for(int32_t ii = 0; ii < camIntr.size(); ii++)
-			for(int32_t jj = 0; jj < camIntr[ii].size(); jj++)
-				camIntrinsic(ii, jj) = static_cast<double>(camIntr[ii][jj]);
+	void YCBSceneCfg::getSceneInfo(GlobalCfg *gCfg){
+		loadSceneFiles(gCfg);
 	}
 
 	void CAMSceneCfg::getSceneInfo(GlobalCfg *gCfg){
-		std::vector<double> camPose7D;
-		XmlRpc::XmlRpcValue camIntr;
-
 		sensor_msgs::Image::ConstPtr msg_color;
       	sensor_msgs::Image::ConstPtr msg_depth;
 
@@ -275,79 +401,7 @@ namespace scene_cfg{
 	        exit(-1);
 	    }
 
-		// Loading params from the yaml file
-		system(("rosparam load " + scenePath + "gt_info.yml").c_str());
-
-		gCfg->nh.getParam("/camera/camera_pose", camPose7D);
-		gCfg->nh.getParam("/scene/num_objects", numObjects);
-
-		camPose = Eigen::Matrix4f::Zero(4,4);
-		utilities::toTransformationMatrix(camPose, camPose7D);
-
-		// Loading RGB and depth images
-		colorImage = cv::imread(scenePath + "frame-000000.color.png", CV_LOAD_IMAGE_COLOR);
-	    utilities::readDepthImage(depthImage, scenePath + "frame-000000.depth.png");
-
-		// Loading scene objects
-		for(int ii=0; ii<numObjects; ii++){
-			std::string currObject;
-			char objTopic[50];
-			sprintf(objTopic, "/scene/object_%d/name", ii+1);
-			gCfg->nh.getParam(objTopic, currObject);
-
-			for(int jj=0; jj< gCfg->num_objects; jj++){\
-				if(!currObject.compare(gCfg->gObjects[jj]->objName)) {
-
-					std::cout << "Loading object: " << currObject << std::endl;
-
-					scene_cfg::SceneObjects *tSceneObj = new scene_cfg::SceneObjects();
-					tSceneObj->pObject = gCfg->gObjects[jj];
-					tSceneObj->objMask = cv::Mat::zeros(colorImage.rows, colorImage.cols, CV_32FC1);
-					tSceneObj->objPose.matrix().setIdentity();
-					pSceneObjects.push_back(tSceneObj);
-				}
-			}
-		}
-
-	  	// Reading camera intrinsic matrix
-		camIntrinsic = Eigen::Matrix3f::Zero(3,3);
-		gCfg->nh.getParam("/camera/camera_intrinsics", camIntr);
-		for(int32_t ii = 0; ii < camIntr.size(); ii++)
-			for(int32_t jj = 0; jj < camIntr[ii].size(); jj++)
-				camIntrinsic(ii, jj) = static_cast<double>(camIntr[ii][jj]);
-	}
-	
-	/********************************* cleanDebugLocations *************************************************
-	*******************************************************************************************************/
-
-	void APCSceneCfg::cleanDebugLocations(){
-		system(("rm -rf " + scenePath + "debug_search").c_str());
-		system(("mkdir " + scenePath + "debug_search").c_str());
-
-		system(("rm -rf " + scenePath + "debug_super4PCS").c_str());
-		system(("mkdir " + scenePath + "debug_super4PCS").c_str());
-
-		system(("rm " + scenePath + "result.txt").c_str());
-	}
-
-	void YCBSceneCfg::cleanDebugLocations(){
-		system(("rm -rf " + scenePath + "debug_search").c_str());
-		system(("mkdir " + scenePath + "debug_search").c_str());
-
-		system(("rm -rf " + scenePath + "debug_super4PCS").c_str());
-		system(("mkdir " + scenePath + "debug_super4PCS").c_str());
-
-		system(("rm " + scenePath + "result.txt").c_str());
-	}
-
-	void CAMSceneCfg::cleanDebugLocations(){
-		system(("rm -rf " + scenePath + "debug_search").c_str());
-		system(("mkdir " + scenePath + "debug_search").c_str());
-
-		system(("rm -rf " + scenePath + "debug_super4PCS").c_str());
-		system(("mkdir " + scenePath + "debug_super4PCS").c_str());
-
-		system(("rm " + scenePath + "result.txt").c_str());
+		loadSceneFiles(gCfg);
 	}
 	
 	/********************************* perfromSegmentation *************************************************
@@ -355,20 +409,29 @@ namespace scene_cfg{
 
 	void SceneCfg::perfromSegmentation(GlobalCfg *pCfg){
 		// if nothing is specified, it uses the ground truth segmentation
-		segmentation::Segmentation *pSegmentation;
+		std::unique_ptr<segmentation::Segmentation> pSegmentation;
 		if(!segMode.compare("RCNN"))
-			pSegmentation = new segmentation::RCNNSegmentation();
-		if(!segMode.compare("RCNNThreshold"))
-			pSegmentation = new segmentation::RCNNThresholdSegmentation();
+			pSegmentation.reset(new segmentation::RCNNSegmentation());
+		else if(!segMode.compare("RCNNThreshold"))
+			pSegmentation.reset(new segmentation::RCNNThresholdSegmentation());
 		else if(!segMode.compare("FCN"))
-			pSegmentation = new segmentation::FCNSegmentation();
+			pSegmentation.reset(new segmentation::FCNSegmentation());
 		else if(!segMode.compare("FCNThreshold"))
-			pSegmentation = new segmentation::FCNThresholdSegmentation();
+			pSegmentation.reset(new segmentation::FCNThresholdSegmentation());
 		else
-			pSegmentation = new segmentation::GTSegmentation();
-
-		pSegmentation->compute2dSegment(pCfg, this);
-		pSegmentation->compute3dSegment(this);
+			pSegmentation.reset(new segmentation::GTSegmentation());
+
+		// the table is removed on the depth image while the segmentation service runs
+		std::thread segThread([this, pCfg, &pSegmentation](){
+			// the segmentation services keep the active object list between calls, so a
+			// request must finish its sequence of calls before another one starts
+			std::lock_guard<std::mutex> segLock(segmentationServiceMutex);
+			pSegmentation->compute2dSegment(pCfg, this);
+		});
+		removeTable();
+		segThread.join();
+
+		pSegmentation->compute3dSegment(pCfg, this);
 	}
 
 	/********************************* generateHypothesis **************************************************
@@ -379,16 +442,24 @@ namespace scene_cfg{
 		for(int ii=0; ii<numObjects; ii++){
 
 			if(!hypoGenMode.compare("PCS"))
-				pSceneObjects[ii]->hypotheses = new pose_candidates::CongruentSetMatching();
+				pSceneObjects[ii]->hypotheses.reset(new pose_candidates::CongruentSetMatching());
 			else if(!hypoGenMode.compare("PPF_HOUGH"))
-				pSceneObjects[ii]->hypotheses = new pose_candidates::PPFVoting();
+				pSceneObjects[ii]->hypotheses.reset(new pose_candidates::PPFVoting());
 			else
-				pSceneObjects[ii]->hypotheses = new pose_candidates::CongruentSetMatching();
+				pSceneObjects[ii]->hypotheses.reset(new pose_candidates::CongruentSetMatching());
+
+			// the segmentation keeps the probability map in memory, except the FCN argmax mode
+			if(pSceneObjects[ii]->probImage.empty()){
+				utilities::readProbImage(pSceneObjects[ii]->probImage, ctx->super4PCSDir + pSceneObjects[ii]->pObject->objName + ".png");
+				pSceneObjects[ii]->probBox = cv::Rect(0, 0, pSceneObjects[ii]->probImage.cols, pSceneObjects[ii]->probImage.rows);
+			}
 
-			pSceneObjects[ii]->hypotheses->generate(pSceneObjects[ii]->pObject->objName, scenePath, 
+			pSceneObjects[ii]->hypotheses->generate(pSceneObjects[ii]->pObject->objName, ctx->super4PCSDir, 
 				pSceneObjects[ii]->pclSegment, pSceneObjects[ii]->pObject->pclModel, pSceneObjects[ii]->pObject->pclModelSampled,
-				pSceneObjects[ii]->pObject->PPFMap, pSceneObjects[ii]->pObject->max_count_ppf , camPose, camIntrinsic/*, pcs_threads[ii]*/);
+				pSceneObjects[ii]->pObject->matcherContext, pSceneObjects[ii]->probImage, pSceneObjects[ii]->probBox.tl(), 
+				camPose, camIntrinsic/*, pcs_threads[ii]*/);
 
+			std::lock_guard<std::mutex> vizLock(utilities::vizMutex);
 			std::map<std::string, geometry_msgs::Pose>::iterator it = utilities::anyTimePoseArray.find(pSceneObjects[ii]->pObject->objName);
 			Eigen::Vector3d trans = pSceneObjects[ii]->hypotheses->bestHypothesis.first.translation();
     		Eigen::Quaterniond rot(pSceneObjects[ii]->hypotheses->bestHypothesis.first.rotation());
@@ -408,14 +479,14 @@ namespace scene_cfg{
 	*******************************************************************************************************/
 
 	void SceneCfg::performHypothesisSelection(){
-		hypothesis_selection::HypothesisSelection *hSelect;
+		std::unique_ptr<hypothesis_selection::HypothesisSelection> hSelect;
 
 		if(!HVMode.compare("LCP"))
-			hSelect = new hypothesis_selection::LCPSelection();
+			hSelect.reset(new hypothesis_selection::LCPSelection());
 		else if(!HVMode.compare("MCTS"))
-			hSelect = new hypothesis_selection::MCTSSelection();
+			hSelect.reset(new hypothesis_selection::MCTSSelection());
 		else
-			hSelect = new hypothesis_selection::LCPSelection();
+			hSelect.reset(new hypothesis_selection::LCPSelection());
 
 		hSelect->selectBestPoses(this);
 	}
@@ -4,15 +4,19 @@
 #include <GlobalCfg.hpp>
 #include <ObjectPoseCandidateSet.hpp>
 #include <Objects.hpp>
+#include <RequestContext.hpp>
 
 namespace scene_cfg{
 	
 	class SceneObjects{
 		public:
 			objects::Objects *pObject;
-			cv::Mat objMask;
+			cv::Rect maskBox;		// bounding box of the segment in the image
+			cv::Mat objMask;		// CV_8UC1 over maskBox, non-zero on the segment
+			cv::Rect probBox;		// image region of probImage
+			cv::Mat probImage;		// CV_32FC1 segmentation probability in [0, 1] over probBox, zero outside
 			pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment;
-			pose_candidates::ObjectPoseCandidateSet *hypotheses;
+			std::unique_ptr<pose_candidates::ObjectPoseCandidateSet> hypotheses;
 			Eigen::Isometry3d objPose;
 
 			SceneObjects(){}
@@ -22,66 +26,66 @@ namespace scene_cfg{
 		public:
 			SceneCfg(std::string SceneFiles, std::string SegmentationMode, 
 						std::string HypothesisGenerationMode, std::string HypothesisVerificationMode);
-			~SceneCfg();
+			virtual ~SceneCfg();
 
+			void initRequestContext(bool debugOutput);
 			void removeTable();
-			void getTableParams();
+			bool getTableParams();
 			void perfromSegmentation(GlobalCfg *pCfg);
 			void generateHypothesis();
 			void performHypothesisSelection();
 
 			virtual void getSceneInfo(GlobalCfg *pCfg){}
-			virtual void cleanDebugLocations(){}
 
 			int numObjects;
-			std::vector<SceneObjects*> pSceneObjects;
+			std::vector<SceneObjects*> pSceneObjects;	// owned, deleted with the scene
 
 			std::string scenePath;
+			request_ctx::RequestContext *ctx;
 
 			cv::Mat colorImage;
 			cv::Mat depthImage;
+			bool depthBitRotation;	// depth png stored as (d << 3 | d >> 13), see depth_codec.h
 			PointCloudRGB::Ptr sceneCloud;
 
 			Eigen::Matrix4f camPose;
 			Eigen::Matrix3f camIntrinsic;
+			Eigen::Vector4f tablePlane;		// support plane in camera frame, set by removeTable
 			std::vector< float> tableParams;
 
 			std::string segMode;
 			std::string hypoGenMode;
 			std::string HVMode;
+
+		protected:
+			void loadSceneFiles(GlobalCfg *pCfg);
 	};
 
 	class APCSceneCfg : public SceneCfg{
 		public:
 			APCSceneCfg(std::string SceneFiles, std::string SegmentationMode, 
 						std::string HypothesisGenerationMode, std::string HypothesisVerificationMode) : 
-						SceneCfg(SceneFiles, SegmentationMode, HypothesisGenerationMode, HypothesisVerificationMode){};
+						SceneCfg(SceneFiles, SegmentationMode, HypothesisGenerationMode, HypothesisVerificationMode){ depthBitRotation = true; }
 
 			void getSceneInfo(GlobalCfg *pCfg);
-			void cleanDebugLocations();
-
 	};
 
 	class YCBSceneCfg : public SceneCfg{
 		public:
 			YCBSceneCfg(std::string SceneFiles, std::string SegmentationMode, 
 						std::string HypothesisGenerationMode, std::string HypothesisVerificationMode) : 
-						SceneCfg(SceneFiles, SegmentationMode, HypothesisGenerationMode, HypothesisVerificationMode){};
+						SceneCfg(SceneFiles, SegmentationMode, HypothesisGenerationMode, HypothesisVerificationMode){ depthBitRotation = false; }
 			
 			void getSceneInfo(GlobalCfg *pCfg);
-			void cleanDebugLocations();
-
 	};
 
 	class CAMSceneCfg : public SceneCfg{
 		public:
 			CAMSceneCfg(std::string SceneFiles, std::string SegmentationMode, 
 						std::string HypothesisGenerationMode, std::string HypothesisVerificationMode) :
-						SceneCfg(SceneFiles, SegmentationMode, HypothesisGenerationMode, HypothesisVerificationMode){};
+						SceneCfg(SceneFiles, SegmentationMode, HypothesisGenerationMode, HypothesisVerificationMode){ depthBitRotation = false; }
 
 			void getSceneInfo(GlobalCfg *pCfg);
-
-			void cleanDebugLocations();
 	};
 
 }//namespace
@@ -0,0 +1,107 @@
+#include <YamlCfg.hpp>
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <yaml-cpp/yaml.h>
+
+namespace yaml_cfg{
+
+	static std::mutex objectsCacheMutex;
+	static std::map<std::string, ObjectsInfo> objectsCache;
+
+	/********************************* function: loadObjectsInfo *******************************************
+	*******************************************************************************************************/
+
+	bool loadObjectsInfo(std::string path, ObjectsInfo &objInfo){
+		std::lock_guard<std::mutex> cacheLock(objectsCacheMutex);
+
+		std::map<std::string, ObjectsInfo>::iterator it = objectsCache.find(path);
+		if(it != objectsCache.end()){
+			objInfo = it->second;
+			return true;
+		}
+
+		try{
+			YAML::Node objects = YAML::LoadFile(path)["objects"];
+			ObjectsInfo parsed;
+
+			parsed.num_objects = objects["num_objects"].as<int>();
+			parsed.modelDiscretization = objects["modelDiscretization"].as<float>();
+
+			// model simplification defaults, overridden per object
+			int hullVertices = objects["hull_vertices"] ? objects["hull_vertices"].as<int>() : 0;
+			float renderCell = objects["render_cell"] ? objects["render_cell"].as<float>() : 0;
+
+			for(int ii=0; ii<parsed.num_objects; ii++){
+				char objTopic[50];
+				sprintf(objTopic, "object_%d", ii+1);
+				YAML::Node obj = objects[objTopic];
+
+				ObjectInfo tmpObj;
+				tmpObj.name = obj["name"].as<std::string>();
+				tmpObj.type = obj["type"].as<std::string>();
+				tmpObj.classId = obj["classId"].as<int>();
+				std::vector<float> symmetry = obj["symmetry"].as< std::vector<float> >();
+				tmpObj.symmetry = Eigen::Vector3f(symmetry[0], symmetry[1], symmetry[2]);
+				tmpObj.location_obj = obj["location_obj"].as<std::string>();
+				tmpObj.location_pcd = obj["location_pcd"].as<std::string>();
+				tmpObj.hullVertices = obj["hull_vertices"] ? obj["hull_vertices"].as<int>() : hullVertices;
+				tmpObj.renderCell = obj["render_cell"] ? obj["render_cell"].as<float>() : renderCell;
+				parsed.objects.push_back(tmpObj);
+			}
+
+			objectsCache[path] = parsed;
+			objInfo = parsed;
+		}
+		catch(YAML::Exception &e){
+			std::cout << "Failed to parse " << path << ": " << e.what() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	/********************************* function: loadSceneInfo *********************************************
+	*******************************************************************************************************/
+
+	bool loadSceneInfo(std::string path, SceneInfo &sceneInfo){
+		try{
+			YAML::Node gtInfo = YAML::LoadFile(path);
+			YAML::Node camera = gtInfo["camera"];
+			YAML::Node scene = gtInfo["scene"];
+
+			sceneInfo.camPose7D = camera["camera_pose"].as< std::vector<double> >();
+
+			YAML::Node camIntr = camera["camera_intrinsics"];
+			sceneInfo.camIntrinsic = Eigen::Matrix3f::Zero(3,3);
+			for(int ii = 0; ii < camIntr.size(); ii++)
+				for(int jj = 0; jj < camIntr[ii].size(); jj++)
+					sceneInfo.camIntrinsic(ii, jj) = camIntr[ii][jj].as<double>();
+
+			sceneInfo.depthBitRotation = -1;
+			if(camera["depth_bit_rotation"])
+				sceneInfo.depthBitRotation = camera["depth_bit_rotation"].as<bool>() ? 1 : 0;
+
+			sceneInfo.numObjects = scene["num_objects"].as<int>();
+			sceneInfo.objNames.clear();
+			sceneInfo.gtPoses7D.clear();
+			for(int ii=0; ii<sceneInfo.numObjects; ii++){
+				char objTopic[50];
+				sprintf(objTopic, "object_%d", ii+1);
+				YAML::Node obj = scene[objTopic];
+
+				sceneInfo.objNames.push_back(obj["name"].as<std::string>());
+				if(obj["pose"] && obj["pose"].size() == 7)
+					sceneInfo.gtPoses7D.push_back(obj["pose"].as< std::vector<double> >());
+				else
+					sceneInfo.gtPoses7D.push_back(std::vector<double>());
+			}
+		}
+		catch(YAML::Exception &e){
+			std::cout << "Failed to parse " << path << ": " << e.what() << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+}// namespace
@@ -0,0 +1,48 @@
+#ifndef YAML_CFG
+#define YAML_CFG
+
+#include <string>
+#include <vector>
+#include <Eigen/Dense>
+
+// Parses the object and scene configuration files in-process, so that a request
+// does not need to round-trip through the ROS parameter server.
+namespace yaml_cfg{
+
+	class ObjectInfo{
+		public:
+			std::string name;
+			std::string type;
+			int classId;
+			Eigen::Vector3f symmetry;
+			std::string location_obj;
+			std::string location_pcd;
+			int hullVertices;		// vertex cap of the collision hull, 0 keeps the full hull
+			float renderCell;		// vertex clustering cell of the render mesh in m, 0 keeps the full mesh
+	};
+
+	class ObjectsInfo{
+		public:
+			int num_objects;
+			float modelDiscretization;
+			std::vector<ObjectInfo> objects;
+	};
+
+	class SceneInfo{
+		public:
+			std::vector<double> camPose7D;		// [t q]; where, t = [x y z] and q = [w x y z]
+			Eigen::Matrix3f camIntrinsic;
+			int depthBitRotation;		// camera/depth_bit_rotation: 1 or 0, -1 when not specified
+			int numObjects;
+			std::vector<std::string> objNames;
+			std::vector< std::vector<double> > gtPoses7D;	// [t q] per object, empty when not annotated
+	};
+
+	// obj_config.yml, parsed once per path and cached for the lifetime of the process
+	bool loadObjectsInfo(std::string path, ObjectsInfo &objInfo);
+
+	// gt_info.yml of a scene
+	bool loadSceneInfo(std::string path, SceneInfo &sceneInfo);
+
+}//namespace
+#endif
@@ -1,12 +1,15 @@
 #include <ObjectPoseCandidateSet.hpp>
-// #include <PPFMap/ppf_common.hpp>
 
 // Super4PCS package
-void getProbableTransformsSuper4PCS(std::string input1, std::string input2, std::string input3, 
+void getProbableTransformsSuper4PCS(std::string input1, std::shared_ptr<const Super4PCS::ModelContext> model, 
 			std::pair<Eigen::Isometry3d, float> &bestHypothesis, 
-            std::vector< std::pair <Eigen::Isometry3d, float> > &hypothesisSet, std::string probImagePath, 
-            std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, 
-            int max_count_ppf, Eigen::Matrix3f camIntrinsic, std::string objName, std::string scenePath, std::vector<int> &registered_points);
+            std::vector< std::pair <Eigen::Isometry3d, float> > &hypothesisSet, const cv::Mat &probImage, cv::Point probOrigin, 
+            Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath, std::vector<int> &registered_points);
+
+void getProbableTransformsPPFVoting(std::string input1, std::shared_ptr<const Super4PCS::ModelContext> model, 
+			std::pair<Eigen::Isometry3d, float> &bestHypothesis, 
+            std::vector< std::pair <Eigen::Isometry3d, float> > &hypothesisSet, const cv::Mat &probImage, cv::Point probOrigin, 
+            Eigen::Matrix3f camIntrinsic, std::string objName, std::string debugPath, std::vector<int> &registered_points);
 
 namespace pose_candidates{
 
@@ -20,10 +23,11 @@ namespace pose_candidates{
 
 	}
 
-	void CongruentSetMatching::generate(std::string objName, std::string scenePath, 
+	void CongruentSetMatching::generate(std::string objName, std::string debugPath, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, 
-				std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, int max_count_ppf, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic/*, std::thread &th_id*/){
+				std::shared_ptr<const Super4PCS::ModelContext> matcherContext, const cv::Mat &probImage, cv::Point probOrigin, 
+				Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic/*, std::thread &th_id*/){
 
 		pcl::RadiusOutlierRemoval<pcl::PointXYZRGBNormal> outrem;
 	    outrem.setInputCloud(pclSegment);
@@ -36,36 +40,17 @@ namespace pose_candidates{
 			return;
 		}
 
-	    for (int ii=0; ii< pclSegment->points.size(); ii++) {
-	    	pcl::flipNormalTowardsViewpoint (pclSegment->points[ii], 
-	    		0, 0, 0, 
-		        pclSegment->points[ii].normal[0], 
-		        pclSegment->points[ii].normal[1], 
-		        pclSegment->points[ii].normal[2]);
-	    	float magnitude = std::sqrt(pclSegment->points[ii].normal[0]*pclSegment->points[ii].normal[0] + 
-	    						pclSegment->points[ii].normal[1]*pclSegment->points[ii].normal[1] + 
-	    						pclSegment->points[ii].normal[2]*pclSegment->points[ii].normal[2]);
-	    	pclSegment->points[ii].normal[0] /= magnitude;
-	    	pclSegment->points[ii].normal[1] /= magnitude;
-	    	pclSegment->points[ii].normal[2] /= magnitude;
-	    }
+	    // the normals were oriented towards the camera and normalized by Segmentation::compute3dSegment
 	    
-		std::string input1 = scenePath + "debug_super4PCS/pclSegment_" + objName + ".ply";
+		std::string input1 = debugPath + "pclSegment_" + objName + ".ply";
 		pcl::io::savePLYFile(input1, *pclSegment);
 
-		std::string input2 = scenePath + "debug_super4PCS/pclModel_" + objName + ".ply";
-		pcl::io::savePLYFile(input2, *pclModel);
-
-		std::string input3 = scenePath + "debug_super4PCS/pclModelSampled_" + objName + ".ply";
-		pcl::io::savePLYFile(input3, *pclModelSampled);
-
-		std::string probImagePath = scenePath + "debug_super4PCS/" + objName + ".png";
-
 		// multi threading
-		// th_id = std::thread(getProbableTransformsSuper4PCS, input1, input2, input3, std::ref(bestHypothesis), std::ref(hypothesisSet), probImagePath, PPFMap, max_count_ppf, camIntrinsic, objName);
-		getProbableTransformsSuper4PCS(input1, input2, input3, 
-			bestHypothesis, hypothesisSet, probImagePath, 
-			PPFMap, max_count_ppf, camIntrinsic, objName, scenePath, registered_points);
+		// th_id = std::thread(getProbableTransformsSuper4PCS, input1, matcherContext, std::ref(bestHypothesis), std::ref(hypothesisSet), probImage, probOrigin, camIntrinsic, objName);
+		// the model side was prepared once in objects::Objects::buildMatcherContext
+		getProbableTransformsSuper4PCS(input1, matcherContext, 
+			bestHypothesis, hypothesisSet, probImage, probOrigin, 
+			camIntrinsic, objName, debugPath, registered_points);
 
 		std::cout << "registered pts: " << registered_points.size() << std::endl;
 		
@@ -73,11 +58,11 @@ namespace pose_candidates{
 		
 	}
 
-	void PPFVoting::generate(std::string objName, std::string scenePath, 
+	void PPFVoting::generate(std::string objName, std::string debugPath, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, 
-				std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, 
-				int max_count_ppf, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic){
+				std::shared_ptr<const Super4PCS::ModelContext> matcherContext, 
+				const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic){
 
 		pcl::RadiusOutlierRemoval<pcl::PointXYZRGBNormal> outrem;
 	    outrem.setInputCloud(pclSegment);
@@ -90,29 +75,20 @@ namespace pose_candidates{
 			return;
 		}
 
-	    for (int ii=0; ii< pclSegment->points.size(); ii++) {
-	    	pcl::flipNormalTowardsViewpoint (pclSegment->points[ii], 
-	    		0, 0, 0, 
-		        pclSegment->points[ii].normal[0], 
-		        pclSegment->points[ii].normal[1], 
-		        pclSegment->points[ii].normal[2]);
-	    	float magnitude = std::sqrt(pclSegment->points[ii].normal[0]*pclSegment->points[ii].normal[0] + 
-	    						pclSegment->points[ii].normal[1]*pclSegment->points[ii].normal[1] + 
-	    						pclSegment->points[ii].normal[2]*pclSegment->points[ii].normal[2]);
-	    	pclSegment->points[ii].normal[0] /= magnitude;
-	    	pclSegment->points[ii].normal[1] /= magnitude;
-	    	pclSegment->points[ii].normal[2] /= magnitude;
-	    }
+	    // the normals were oriented towards the camera and normalized by Segmentation::compute3dSegment
 	    
-	    pcl::PointCloud<pcl::PointNormal>::Ptr model(new pcl::PointCloud<pcl::PointNormal>);
-	    pcl::PointCloud<pcl::PointNormal>::Ptr scene(new pcl::PointCloud<pcl::PointNormal>);
+		std::string input1 = debugPath + "pclSegment_" + objName + ".ply";
+		pcl::io::savePLYFile(input1, *pclSegment);
 
-		copyPointCloud(*pclModel, *model);
-		copyPointCloud(*pclSegment, *scene);
+		// multithreaded voting over the segment points, the clustered peaks are scored
+		// with the same weighted LCP as the congruent set hypotheses
+		getProbableTransformsPPFVoting(input1, matcherContext, 
+			bestHypothesis, hypothesisSet, probImage, probOrigin, 
+			camIntrinsic, objName, debugPath, registered_points);
 
-	    // getPPFPoseEstimate(scene, model, bestHypothesis, hypothesisSet);
+		std::cout << "registered pts: " << registered_points.size() << std::endl;
 
-		std::cout << bestHypothesis.first.matrix() << std::endl;
+		std::cout << "best voting hypothesis: " << bestHypothesis.first.matrix() << std::endl;
 		
 	}
 
@@ -3,17 +3,20 @@
 
 #include <common_io.h>
 
+// model side of the Super4PCS matcher
+namespace Super4PCS{ class ModelContext; }
+
 namespace pose_candidates{
 	
 	class ObjectPoseCandidateSet{
 	public:
 		ObjectPoseCandidateSet();
-		~ObjectPoseCandidateSet();
+		virtual ~ObjectPoseCandidateSet();
 
-		virtual void generate(std::string objName, std::string scenePath, 
+		virtual void generate(std::string objName, std::string debugPath, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel, 
-				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, 
-				int max_count_ppf, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic){}
+				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, std::shared_ptr<const Super4PCS::ModelContext> matcherContext, 
+				const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic){}
 
 		std::vector< std::pair <Eigen::Isometry3d, float> > hypothesisSet;
 		std::vector< std::pair <Eigen::Isometry3d, float> > clusteredHypothesisSet;
@@ -23,18 +26,18 @@ namespace pose_candidates{
 
 	class CongruentSetMatching: public ObjectPoseCandidateSet{
 
-		void generate(std::string objName, std::string scenePath, 
+		void generate(std::string objName, std::string debugPath, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel, 
-				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, 
-				int max_count_ppf, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic);
+				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, std::shared_ptr<const Super4PCS::ModelContext> matcherContext, 
+				const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic);
 	};
 
 	class PPFVoting: public ObjectPoseCandidateSet{
 
-		void generate(std::string objName, std::string scenePath, 
+		void generate(std::string objName, std::string debugPath, 
 				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclSegment, pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModel, 
-				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, std::map<std::vector<int>, std::vector<std::pair<int,int> > > &PPFMap, 
-				int max_count_ppf, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic);
+				pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr pclModelSampled, std::shared_ptr<const Super4PCS::ModelContext> matcherContext, 
+				const cv::Mat &probImage, cv::Point probOrigin, Eigen::Matrix4f camPose, Eigen::Matrix3f camIntrinsic);
 	};
 }
 
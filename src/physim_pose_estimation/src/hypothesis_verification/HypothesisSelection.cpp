@@ -86,30 +86,8 @@ namespace hypothesis_selection{
 		std::cout << "Clustering..." << std::endl;
 
 		// 3: Cluster
-		for(auto candidate_it: prunedHypotheses) {
-			bool inValid = false;
-			// std::cout << "LCP score: " << candidate_it.second << std::endl;
-			for(auto cluster_it: pCfg->pSceneObjects[objId]->hypotheses->clusteredHypothesisSet) {
-				float meanrotErr, transErr;
-				Eigen::Matrix4f candidatePose, clusterPose;
-				utilities::convertToMatrix(candidate_it.first, candidatePose);
-				utilities::convertToMatrix(cluster_it.first, clusterPose);
-				utilities::getPoseError(candidatePose, clusterPose, pCfg->pSceneObjects[objId]->pObject->symInfo, 
-								meanrotErr, transErr);
-				if(meanrotErr < 10 && transErr < 0.02) {
-					inValid = true;
-					cluster_it.second += candidate_it.second;
-					break;
-				}
-			}
-
-			if(inValid == false){
-				pCfg->pSceneObjects[objId]->hypotheses->clusteredHypothesisSet.push_back(candidate_it);
-			}
-		}
-
-		std::sort(pCfg->pSceneObjects[objId]->hypotheses->clusteredHypothesisSet.begin(), 
-					pCfg->pSceneObjects[objId]->hypotheses->clusteredHypothesisSet.end(), sortPoses);
+		pose_clustering::PoseClustering clustering(pCfg->pSceneObjects[objId]->pObject->symInfo, 10, 0.02);
+		clustering.cluster(prunedHypotheses, pCfg->pSceneObjects[objId]->hypotheses->clusteredHypothesisSet);
 
 		std::cout << "Clustered set size: " << pCfg->pSceneObjects[objId]->hypotheses->clusteredHypothesisSet.size() << std::endl;
 	}
@@ -156,9 +134,12 @@ namespace hypothesis_selection{
 
 			std::cout << "hypothesis size: " << pCfg->pSceneObjects[ii]->hypotheses->hypothesisSet.size() << std::endl;
 
-			// clock_t clustering_start = clock();
+			clock_t clustering_start = clock();
 
-			// greedyClustering(pCfg, ii);
+			greedyClustering(pCfg, ii);
+
+			float clustering_time = float( clock () - clustering_start ) /  CLOCKS_PER_SEC;
+			std::cout << "clustering time: " << clustering_time << std::endl;
 
 			// START: select best hough pose
 			// pCfg->pSceneObjects[ii]->objPose = pCfg->pSceneObjects[ii]->hypotheses->clusteredHypothesisSet[0].first;
@@ -188,7 +169,6 @@ namespace hypothesis_selection{
 			// pCfg->pSceneObjects[ii]->objPose = bestposeIsometry;
 			// END: perform ICP on best lcp pose
 
-			// float clustering_time = float( clock () - clustering_start ) /  CLOCKS_PER_SEC;
 			// ofstream pFile;
 			// pFile.open ("/media/chaitanya/DATADRIVE0/datasets/YCB_Video_Dataset/time_clustering.txt", std::ofstream::out | std::ofstream::app);
 			// pFile << clustering_time << " " << pCfg->pSceneObjects[ii]->hypotheses->clusteredHypothesisSet.size() << std::endl;
@@ -227,7 +207,7 @@ namespace hypothesis_selection{
 			    Eigen::Quaterniond rot(finalPoseIsometric.rotation());
 			    
 			    ofstream pFile;
-			    pFile.open ((pCfg->scenePath + "debug_super4PCS/" + pCfg->pSceneObjects[ii]->pObject->objName + "_result.txt").c_str(),
+			    pFile.open ((pCfg->ctx->super4PCSDir + pCfg->pSceneObjects[ii]->pObject->objName + "_result.txt").c_str(),
 			    		 std::ofstream::out | std::ofstream::app);
 			    pFile << trans[0] << " " << trans[1] << " " << trans[2] 
 			      << " " << rot.w() << " " << rot.x() << " " << rot.y() << " " << rot.z() << std::endl;
@@ -242,7 +222,14 @@ namespace hypothesis_selection{
 		std::vector<std::vector<scene_cfg::SceneObjects*> > independentTrees;
 		independentTrees.push_back(pCfg->pSceneObjects);
 
-  		pCfg->getTableParams();
+		// the search needs the table in the physics world, without it the best LCP pose of
+		// each object is kept
+		if(!pCfg->getTableParams()){
+			std::cout << "table pose unavailable, keeping the best LCP poses" << std::endl;
+			for(int ii=0; ii<pCfg->numObjects; ii++)
+				pCfg->pSceneObjects[ii]->objPose = pCfg->pSceneObjects[ii]->hypotheses->bestHypothesis.first;
+			return;
+		}
 
 		for(int treeIdx=0; treeIdx<independentTrees.size(); treeIdx++){
 		    std::vector< std::vector< std::pair <Eigen::Isometry3d, float> > > hypothesis;
@@ -252,14 +239,18 @@ namespace hypothesis_selection{
 		      hypothesis.push_back(pCfg->pSceneObjects[jj]->hypotheses->hypothesisSet);
 		    }
 
-		    uct_search::UCTSearch *UCTSearch = new uct_search::UCTSearch(independentTrees[treeIdx], pCfg->tableParams, hypothesis,
-		                                pCfg->scenePath, pCfg->camPose, pCfg->depthImage, treeIdx);
+		    std::unique_ptr<uct_search::UCTSearch> UCTSearch(new uct_search::UCTSearch(independentTrees[treeIdx], pCfg->tableParams, hypothesis,
+		                                pCfg->ctx->searchDir, pCfg->camPose, pCfg->depthImage, treeIdx));
 		    UCTSearch->performSearch();
 
-		    for(int ii=0; ii < independentTrees[treeIdx].size(); ii++)
-		    	independentTrees[treeIdx][ii]->objPose = UCTSearch->bestState->objects[ii].second;
+		    // no rollout found a feasible placement for every object
+		    bool searchFailed = UCTSearch->bestState->objects.size() < independentTrees[treeIdx].size();
+		    if(searchFailed)
+		    	std::cout << "no feasible scene found by the search, keeping the best LCP poses" << std::endl;
 
-		    delete UCTSearch;
+		    for(int ii=0; ii < independentTrees[treeIdx].size(); ii++)
+		    	independentTrees[treeIdx][ii]->objPose = searchFailed ? independentTrees[treeIdx][ii]->hypotheses->bestHypothesis.first :
+		    														UCTSearch->bestState->objects[ii].second;
 		 }
 	}	
 
@@ -4,13 +4,14 @@
 #include <common_io.h>
 #include <SceneCfg.hpp>
 #include <mcts/UCTSearch.hpp>
+#include <PoseClustering.hpp>
 
 namespace hypothesis_selection{
 	
 	class HypothesisSelection{
 	public:
 		HypothesisSelection();
-		~HypothesisSelection();
+		virtual ~HypothesisSelection();
 
 		virtual void selectBestPoses(scene_cfg::SceneCfg *pCfg){}
 		void greedyClustering(scene_cfg::SceneCfg *pCfg, int objId);
@@ -0,0 +1,212 @@
+#include <PoseClustering.hpp>
+
+namespace pose_clustering{
+
+	/********************************* function: constructor **********************************************
+	The rotation test passes only if the summed euler errors of the relative rotation are below
+	3*rotThreshold. The folded (symmetric) axes can take any value, so the rotation key must not
+	depend on them:
+	- no folded axis: the relative rotation is below 3*rotThreshold, the unit quaternions (up to
+	  sign) are within 2sin(angle/4)
+	- folded yaw only: the yaw does not move the model z axis, which stays within 3*rotThreshold
+	  (chord 2sin(angle/2)) in camera frame. Same for the x axis with a folded roll only.
+	- otherwise the poses are only binned by translation
+	*******************************************************************************************************/
+
+	PoseClustering::PoseClustering(Eigen::Vector3f symInfo, float rotThreshold, float transThreshold):
+		symInfo(symInfo), rotThreshold(rotThreshold), transThreshold(transThreshold){
+
+		bool folded[3];
+		for(int dim = 0; dim < 3; dim++)
+			folded[dim] = symInfo(dim) == 90 || symInfo(dim) == 180 || symInfo(dim) == 360;
+
+		float maxAngle = std::min(3*rotThreshold*M_PI/180, M_PI);
+		keyAxis = -1;
+		// unit vectors are at most 2 apart
+		for(int ii = 3; ii < MAX_COORDS; ii++)
+			radius[ii] = 2;
+		if(!folded[0] && !folded[1] && !folded[2]){
+			rotKey = QUATERNION_KEY;
+			for(int ii = 3; ii < MAX_COORDS; ii++)
+				radius[ii] = 2*sin(maxAngle/4);
+		}
+		else if(!folded[0] && !folded[1]){
+			rotKey = AXIS_KEY;
+			keyAxis = 2;
+		}
+		else if(!folded[1] && !folded[2]){
+			rotKey = AXIS_KEY;
+			keyAxis = 0;
+		}
+		else
+			rotKey = NO_KEY;
+
+		if(rotKey == AXIS_KEY)
+			for(int ii = 3; ii < 6; ii++)
+				radius[ii] = 2*sin(maxAngle/2);
+		for(int ii = 0; ii < 3; ii++)
+			radius[ii] = transThreshold;
+
+		// cells 4 times the radius: along each axis a pose overlaps 1.5 cells on average.
+		// The margin covers the float rounding of getPoseError.
+		for(int ii = 0; ii < MAX_COORDS; ii++){
+			radius[ii] *= 1.01;
+			cellSize[ii] = 4*radius[ii];
+		}
+	}
+
+	PoseClustering::~PoseClustering(){
+
+	}
+
+	/********************************* function: getCoordinates *******************************************
+	translation followed by the rotation key, returns the number of coordinates
+	*******************************************************************************************************/
+
+	int PoseClustering::getCoordinates(const Eigen::Matrix4f &pose, bool flipQuaternion, float *coords){
+		for(int ii = 0; ii < 3; ii++)
+			coords[ii] = pose(ii, 3);
+
+		if(rotKey == QUATERNION_KEY){
+			Eigen::Quaternionf q(Eigen::Matrix3f(pose.block<3,3>(0,0)));
+			float sign = (q.w() < 0) != flipQuaternion ? -1 : 1;
+			coords[3] = sign*q.w();
+			coords[4] = sign*q.x();
+			coords[5] = sign*q.y();
+			coords[6] = sign*q.z();
+			return 7;
+		}
+		else if(rotKey == AXIS_KEY){
+			for(int ii = 0; ii < 3; ii++)
+				coords[3 + ii] = pose(ii, keyAxis);
+			return 6;
+		}
+		return 3;
+	}
+
+	/********************************* function: getBin ***************************************************
+	mixes the cell coordinates in the bin key, collisions only add seeds to test
+	*******************************************************************************************************/
+
+	uint64_t PoseClustering::getBin(const float *coords, int numCoords){
+		uint64_t key = 0;
+		for(int ii = 0; ii < numCoords; ii++)
+			key = (key ^ uint32_t(int(floor(coords[ii]/cellSize[ii])))) * 0x9E3779B97F4A7C15ull;
+		return key;
+	}
+
+	/********************************* function: getCandidateBins *****************************************
+	bins of the seeds that may be within the thresholds of pose
+	*******************************************************************************************************/
+
+	void PoseClustering::getCandidateBins(const Eigen::Matrix4f &pose, std::vector<uint64_t> &bins){
+		bins.clear();
+		for(int flip = 0; flip < 2; flip++){
+			float coords[MAX_COORDS];
+			int numCoords = getCoordinates(pose, flip == 1, coords);
+
+			// q and -q are the same rotation: close to w = 0 the seed may have the other sign
+			if(flip == 1 && (rotKey != QUATERNION_KEY || fabs(coords[3]) >= radius[3]))
+				break;
+
+			// along each axis, the cell of the pose and its neighbor when the pose is closer
+			// than the radius to the boundary
+			float lo[MAX_COORDS], hi[MAX_COORDS], cell[MAX_COORDS];
+			for(int ii = 0; ii < numCoords; ii++){
+				float base = floor(coords[ii]/cellSize[ii])*cellSize[ii];
+				float offset = coords[ii] - base;
+				lo[ii] = offset < radius[ii] ? base - cellSize[ii] : base;
+				hi[ii] = cellSize[ii] - offset < radius[ii] ? base + cellSize[ii] : base;
+				cell[ii] = lo[ii] + 0.5*cellSize[ii];
+			}
+
+			while(true){
+				bins.push_back(getBin(cell, numCoords));
+				int ii = 0;
+				for(; ii < numCoords && cell[ii] > hi[ii]; ii++)
+					cell[ii] = lo[ii] + 0.5*cellSize[ii];
+				if(ii == numCoords)
+					break;
+				cell[ii] += cellSize[ii];
+			}
+		}
+		std::sort(bins.begin(), bins.end());
+		bins.erase(std::unique(bins.begin(), bins.end()), bins.end());
+	}
+
+	/********************************* function: isNeighbor ***********************************************
+	necessary conditions of the thresholds on the coordinates, cheaper than getPoseError
+	*******************************************************************************************************/
+
+	bool PoseClustering::isNeighbor(const float *coords, const float *seed, int numCoords){
+		float transDist = 0;
+		for(int ii = 0; ii < 3; ii++)
+			transDist += pow(coords[ii] - seed[ii], 2);
+		if(transDist >= radius[0]*radius[0])
+			return false;
+
+		// the quaternions may have opposite signs
+		float rotDist = 0, flipDist = 0;
+		for(int ii = 3; ii < numCoords; ii++){
+			rotDist += pow(coords[ii] - seed[ii], 2);
+			flipDist += pow(coords[ii] + seed[ii], 2);
+		}
+		if(rotKey == QUATERNION_KEY)
+			rotDist = std::min(rotDist, flipDist);
+		return rotDist < radius[3]*radius[3];
+	}
+
+	/********************************* function: cluster **************************************************
+	*******************************************************************************************************/
+
+	void PoseClustering::cluster(const std::vector< std::pair <Eigen::Isometry3d, float> > &hypotheses,
+				std::vector< std::pair <Eigen::Isometry3d, float> > &clusters){
+		clusters.clear();
+		grid.clear();
+		seedPoses.clear();
+		seedCoords.clear();
+
+		std::vector<uint64_t> bins;
+		for(auto candidate_it : hypotheses) {
+			Eigen::Matrix4f candidatePose;
+			utilities::convertToMatrix(candidate_it.first, candidatePose);
+			float coords[MAX_COORDS];
+			int numCoords = getCoordinates(candidatePose, false, coords);
+
+			// first cluster within the thresholds, as with a scan over all the clusters
+			int match = -1;
+			getCandidateBins(candidatePose, bins);
+			for(auto bin : bins){
+				auto bin_it = grid.find(bin);
+				if(bin_it == grid.end())
+					continue;
+				for(int seedId : bin_it->second){
+					if(match >= 0 && seedId >= match)
+						break;
+					if(!isNeighbor(coords, &seedCoords[seedId*MAX_COORDS], numCoords))
+						continue;
+					float meanrotErr, transErr;
+					utilities::getPoseError(candidatePose, seedPoses[seedId], symInfo, meanrotErr, transErr);
+					if(meanrotErr < rotThreshold && transErr < transThreshold)
+						match = seedId;
+				}
+			}
+
+			if(match >= 0){
+				clusters[match].second += candidate_it.second;
+			}
+			else{
+				grid[getBin(coords, numCoords)].push_back(seedPoses.size());
+				seedPoses.push_back(candidatePose);
+				seedCoords.insert(seedCoords.end(), coords, coords + MAX_COORDS);
+				clusters.push_back(candidate_it);
+			}
+		}
+
+		std::stable_sort(clusters.begin(), clusters.end(),
+			[](const std::pair <Eigen::Isometry3d, float> &a, const std::pair <Eigen::Isometry3d, float> &b) {
+				return a.second > b.second;
+			});
+	}
+
+}// namespace
@@ -0,0 +1,48 @@
+#ifndef POSE_CLUSTERING
+#define POSE_CLUSTERING
+
+#include <common_io.h>
+#include <unordered_map>
+
+// Greedy clustering of pose hypotheses: visited by decreasing score, each hypothesis joins
+// the first cluster whose seed is within the thresholds of utilities::getPoseError, or seeds
+// a new cluster. The seeds are binned in a hash grid over their translation and a rotation
+// key chosen from the object symmetry, so a hypothesis is only tested against the seeds of
+// the few bins that can pass the thresholds instead of against every cluster.
+namespace pose_clustering{
+
+	class PoseClustering{
+	public:
+		PoseClustering(Eigen::Vector3f symInfo, float rotThreshold, float transThreshold);
+		~PoseClustering();
+
+		// hypotheses sorted by decreasing score; clusters get the seed poses with the summed
+		// scores of their members, sorted by decreasing score
+		void cluster(const std::vector< std::pair <Eigen::Isometry3d, float> > &hypotheses,
+					std::vector< std::pair <Eigen::Isometry3d, float> > &clusters);
+
+	private:
+		enum RotationKey { NO_KEY, QUATERNION_KEY, AXIS_KEY };
+		static const int MAX_COORDS = 7;
+
+		int getCoordinates(const Eigen::Matrix4f &pose, bool flipQuaternion, float *coords);
+		uint64_t getBin(const float *coords, int numCoords);
+		void getCandidateBins(const Eigen::Matrix4f &pose, std::vector<uint64_t> &bins);
+		bool isNeighbor(const float *coords, const float *seed, int numCoords);
+
+		Eigen::Vector3f symInfo;
+		float rotThreshold;
+		float transThreshold;
+
+		RotationKey rotKey;
+		int keyAxis;
+		float radius[MAX_COORDS];
+		float cellSize[MAX_COORDS];
+
+		std::unordered_map<uint64_t, std::vector<int> > grid;
+		std::vector<Eigen::Matrix4f> seedPoses;
+		std::vector<float> seedCoords;
+	};
+
+}// namespace
+#endif
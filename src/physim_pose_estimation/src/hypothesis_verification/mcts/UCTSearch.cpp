@@ -1,21 +1,25 @@
 #include <UCTSearch.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 bool operator<(const uct_state::UCTState& lhs, const uct_state::UCTState& rhs) {
 	return lhs.qval < rhs.qval;
 }
 
 namespace uct_search{
-	clock_t search_begin_time;
-	float trimICPthreshold = 0.5;
-	int maxSearchTime = 60;
-	int numExpansionsSearch;
+	const float trimICPthreshold = 0.5;
+	const int maxSearchTime = 60;
+	const float stableTranslation = 0.01;		// a presettled hypothesis moving less than this is stable
+	const float stableRotation = 10*M_PI/180;
 	
 	/********************************* function: constructor ***********************************************
 	*******************************************************************************************************/
 
 	UCTSearch::UCTSearch(std::vector<scene_cfg::SceneObjects*> objOrder, std::vector<float> tableParams,
 					std::vector< std::vector< std::pair <Eigen::Isometry3d, float> > > unconditionedHypothesis,
-					std::string scenePath, Eigen::Matrix4f camPose, cv::Mat depthImage, int rootId){
+					std::string debugPath, Eigen::Matrix4f camPose, cv::Mat depthImage, int rootId){
 
 		// initialize the root state
 		int numChildNodesRoot = unconditionedHypothesis[0].size();
@@ -28,7 +32,7 @@ namespace uct_search{
 		// get scene information
 		this->objOrder = objOrder;
 		this->unconditionedHypothesis = unconditionedHypothesis;
-		this->scenePath = scenePath;
+		this->debugPath = debugPath;
 		this->camPose = camPose;
 		this->depthImage = depthImage;
 
@@ -36,13 +40,17 @@ namespace uct_search{
 		bestState = new uct_state::UCTState(0, numChildNodesRoot, NULL);
 		bestRenderScore = INT_MAX;
 
+		// every pixel unexplained, the score of a rollout without a feasible placement
+		rejectedScore = depthImage.rows*depthImage.cols;
+
 		// initialize physics engine
 		pSim = new physim::PhySim(tableParams);
 		pSim->addTable(tableParams);
 		for(int ii=0; ii<objOrder.size(); ii++)
-			pSim->initRigidBody(objOrder[ii]->pObject->objName);
+			pSim->initRigidBody(objOrder[ii]->pObject->objName, objOrder[ii]->pObject->collisionHull);
+
+		presettleHypotheses(tableParams);
 
-		search_begin_time = clock();
 		numExpansionsSearch = 0;
 	}
 
@@ -54,6 +62,74 @@ namespace uct_search{
 		for(int ii=0; ii<allStatePtrs.size(); ii++){
 			delete allStatePtrs[ii];
 		}
+		delete bestState;
+		delete pSim;
+	}
+
+	/********************************* function: UCTSearch::presettleHypotheses ****************************
+	Drops every hypothesis alone on the table before the search. The hypotheses are split over threads,
+	each with its own physics world, since a bullet world can not be stepped from several threads.
+	*******************************************************************************************************/
+
+	void UCTSearch::presettleHypotheses(std::vector<float> tableParams){
+		// wall clock, the cpu time of clock() adds up over the threads
+		std::chrono::steady_clock::time_point begin_time = std::chrono::steady_clock::now();
+
+		std::vector< std::pair<int, int> > jobs;
+		presettled.resize(unconditionedHypothesis.size());
+		for(int ii=0; ii<unconditionedHypothesis.size(); ii++){
+			presettled[ii].resize(unconditionedHypothesis[ii].size());
+			for(int jj=0; jj<unconditionedHypothesis[ii].size(); jj++)
+				jobs.push_back(std::make_pair(ii, jj));
+		}
+
+		std::atomic<int> nextJob(0);
+		auto worker = [&](){
+			physim::PhySim sim(tableParams);
+			sim.addTable(tableParams);
+			for(int ii=0; ii<objOrder.size(); ii++)
+				sim.initRigidBody(objOrder[ii]->pObject->objName, objOrder[ii]->pObject->collisionHull);
+
+			for(int job = nextJob++; job < jobs.size(); job = nextJob++){
+				std::string objName = objOrder[jobs[job].first]->pObject->objName;
+				Eigen::Isometry3d camPoseHyp = unconditionedHypothesis[jobs[job].first][jobs[job].second].first;
+
+				Eigen::Matrix4f tform;
+				Eigen::Isometry3d worldPose;
+				utilities::convertToMatrix(camPoseHyp, tform);
+				utilities::convertToWorld(tform, camPose);
+				utilities::convertToIsometry3d(tform, worldPose);
+
+				sim.addObject(objName, worldPose, 10.0f);
+				sim.simulate(60);
+				sim.getTransform(objName, worldPose);
+				sim.removeObject(objName);
+
+				physim::SettledPose &settled = presettled[jobs[job].first][jobs[job].second];
+				utilities::convertToMatrix(worldPose, tform);
+				utilities::convertToCamera(tform, camPose);
+				utilities::convertToIsometry3d(tform, settled.pose);
+
+				Eigen::Isometry3d delta = camPoseHyp.inverse() * settled.pose;
+				settled.stable = delta.translation().norm() < stableTranslation &&
+								 Eigen::AngleAxisd(delta.rotation()).angle() < stableRotation;
+			}
+		};
+
+		int numThreads = std::max(1, std::min<int>(std::thread::hardware_concurrency(), jobs.size()));
+		std::vector<std::thread> threads;
+		for(int ii=0; ii<numThreads; ii++)
+			threads.push_back(std::thread(worker));
+		for(int ii=0; ii<numThreads; ii++)
+			threads[ii].join();
+
+		int numStable = 0;
+		for(int ii=0; ii<presettled.size(); ii++)
+			for(int jj=0; jj<presettled[ii].size(); jj++)
+				numStable += presettled[ii][jj].stable;
+		std::cout << "UCTSearch::presettleHypotheses:: settled " << jobs.size() << " hypotheses on " << numThreads 
+				  << " threads, stable: " << numStable << ", time: " 
+				  << std::chrono::duration<float>(std::chrono::steady_clock::now() - begin_time).count() << std::endl;
 	}
 
 	/********************************* function: UCTSearch::backupReward ***********************************
@@ -67,6 +143,19 @@ namespace uct_search{
 		}
 	}
 
+	/********************************* function: UCTSearch::tryPlacement ***********************************
+	Adds hypothesis hypIdx of the next object to the rollout state, unless its placement is rejected
+	*******************************************************************************************************/
+
+	physim::Placement UCTSearch::tryPlacement(uct_state::UCTState *state, int hypIdx){
+		int level = state->numObjects-1;
+		state->updateNewObject(objOrder[level], unconditionedHypothesis[level][hypIdx], objOrder.size());
+		physim::Placement placement = state->checkPlacement(pSim, camPose);
+		if(placement == physim::PLACEMENT_REJECT)
+			state->objects.pop_back();
+		return placement;
+	}
+
 	/********************************* function: UCTSearch::LCPPolicy **************************************
 	*******************************************************************************************************/
 
@@ -84,27 +173,38 @@ namespace uct_search{
 		while(tmpState->numObjects < maxDepth){
 			tmpState->numObjects++;
 
+			// hypotheses by decreasing LCP score, a rejected placement falls to the next one
+			const std::vector< std::pair <Eigen::Isometry3d, float> > &levelHypotheses = unconditionedHypothesis[tmpState->numObjects-1];
+			std::vector<int> candidates(levelHypotheses.size());
+			for(int ii=0; ii<candidates.size(); ii++)
+				candidates[ii] = ii;
+			std::stable_sort(candidates.begin(), candidates.end(), [&](int a, int b){
+				return levelHypotheses[a].second > levelHypotheses[b].second; });
+
 			int bestIdx = -1;
-			float bestScoreLCP = 0;
-			for(int ii=0; ii< unconditionedHypothesis[tmpState->numObjects-1].size(); ii++){
-				if(unconditionedHypothesis[tmpState->numObjects-1][ii].second > bestScoreLCP){
-					bestScoreLCP = unconditionedHypothesis[tmpState->numObjects-1][ii].second;
-					bestIdx = ii;
-				}
+			physim::Placement placement = physim::PLACEMENT_REJECT;
+			for(int ii=0; ii<candidates.size() && placement == physim::PLACEMENT_REJECT; ii++){
+				bestIdx = candidates[ii];
+				placement = tryPlacement(tmpState, bestIdx);
+			}
+
+			// no feasible placement for this object
+			if(placement == physim::PLACEMENT_REJECT){
+				delete tmpState;
+				return rejectedScore;
 			}
 
 			tmpState->updateStateId(bestIdx);
-			tmpState->updateNewObject(objOrder[tmpState->numObjects-1], unconditionedHypothesis[tmpState->numObjects-1][bestIdx], maxDepth);
-			// tmpState->performTrICP(scenePath, trimICPthreshold);
-			tmpState->correctPhysics(pSim, camPose, scenePath);
-			tmpState->render(camPose, scenePath);
+			// tmpState->performTrICP(debugPath, trimICPthreshold);
+			tmpState->correctPhysics(pSim, camPose, debugPath, placement, &presettled[tmpState->numObjects-1][bestIdx]);
+			tmpState->render(camPose, debugPath);
 		}
 
 		tmpState->computeCost(depthImage);
 		unsigned int currScore = tmpState->renderScore;
 
 		ofstream pFile;
-	    pFile.open ((scenePath + "debug_search/debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
+	    pFile.open ((debugPath + "debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
 		pFile << "UCTSearch::LCPPolicy:: renderedState: " << tmpState->stateId << ", renderScore: " << currScore << std::endl;
 		pFile.close();
 
@@ -120,10 +220,10 @@ namespace uct_search{
 		      Eigen::Matrix4f tform;
 		      utilities::convertToMatrix(bestState->objects[ii].second, tform);
 		      utilities::convertToWorld(tform, camPose);
-		      utilities::writePoseToFile(tform, bestState->objects[ii].first->pObject->objName, scenePath, "debug_search/after_search");
+		      utilities::writePoseToFile(tform, bestState->objects[ii].first->pObject->objName, debugPath, "after_search");
 
 		      ofstream pFile;
-		      pFile.open ((scenePath + "debug_search/times_" + bestState->objects[ii].first->pObject->objName + ".txt").c_str(), std::ofstream::out | std::ofstream::app);
+		      pFile.open ((debugPath + "times_" + bestState->objects[ii].first->pObject->objName + ".txt").c_str(), std::ofstream::out | std::ofstream::app);
 			  pFile << numExpansionsSearch << " " << bestRenderScore << " " << tmpState->stateId  << std::endl;
 			  pFile.close();
 		    } 
@@ -150,20 +250,39 @@ namespace uct_search{
 		while(tmpState->numObjects < maxDepth){
 			tmpState->numObjects++;
 
-			// random policy
-			int randHypothesis = rand() % unconditionedHypothesis[tmpState->numObjects-1].size();
+			// random policy, a rejected placement is replaced by another hypothesis drawn among
+			// the ones not tried yet
+			std::vector<int> candidates(unconditionedHypothesis[tmpState->numObjects-1].size());
+			for(int ii=0; ii<candidates.size(); ii++)
+				candidates[ii] = ii;
+
+			int randHypothesis = -1;
+			physim::Placement placement = physim::PLACEMENT_REJECT;
+			while(placement == physim::PLACEMENT_REJECT && !candidates.empty()){
+				int pick = rand() % candidates.size();
+				randHypothesis = candidates[pick];
+				candidates[pick] = candidates.back();
+				candidates.pop_back();
+				placement = tryPlacement(tmpState, randHypothesis);
+			}
+
+			// no feasible placement for this object
+			if(placement == physim::PLACEMENT_REJECT){
+				delete tmpState;
+				return rejectedScore;
+			}
+
 			tmpState->updateStateId(randHypothesis);
-			tmpState->updateNewObject(objOrder[tmpState->numObjects-1], unconditionedHypothesis[tmpState->numObjects-1][randHypothesis], maxDepth);
-			// tmpState->performTrICP(scenePath, trimICPthreshold);
-			tmpState->correctPhysics(pSim, camPose, scenePath);
-			tmpState->render(camPose, scenePath);
+			// tmpState->performTrICP(debugPath, trimICPthreshold);
+			tmpState->correctPhysics(pSim, camPose, debugPath, placement, &presettled[tmpState->numObjects-1][randHypothesis]);
+			tmpState->render(camPose, debugPath);
 		}
 
 		tmpState->computeCost(depthImage);
 		unsigned int currScore = tmpState->renderScore;
 
 		ofstream pFile;
-	    pFile.open ((scenePath + "debug_search/debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
+	    pFile.open ((debugPath + "debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
 		pFile << "UCTSearch::defaultPolicy:: randomState: " << tmpState->stateId << ", renderScore: " << currScore << std::endl;
 		pFile.close();
 
@@ -179,10 +298,10 @@ namespace uct_search{
 		      Eigen::Matrix4f tform;
 		      utilities::convertToMatrix(bestState->objects[ii].second, tform);
 		      utilities::convertToWorld(tform, camPose);
-		      utilities::writePoseToFile(tform, bestState->objects[ii].first->pObject->objName, scenePath, "debug_search/after_search");
+		      utilities::writePoseToFile(tform, bestState->objects[ii].first->pObject->objName, debugPath, "after_search");
 
 		      ofstream pFile;
-		      pFile.open ((scenePath + "debug_search/times_" + bestState->objects[ii].first->pObject->objName + ".txt").c_str(), std::ofstream::out | std::ofstream::app);
+		      pFile.open ((debugPath + "times_" + bestState->objects[ii].first->pObject->objName + ".txt").c_str(), std::ofstream::out | std::ofstream::app);
 			  pFile << numExpansionsSearch << " " << bestRenderScore << " " << tmpState->stateId  << std::endl;
 			  pFile.close();
 		    } 
@@ -200,31 +319,53 @@ namespace uct_search{
 	uct_state::UCTState* UCTSearch::expand(uct_state::UCTState *currState){
 		unsigned int maxDepth = objOrder.size();
 
-		// find a non-expanded node with the best heuristic value.
-		int bestChildIdx = -1;
-		float bestHval = 0;
-		for(int ii=0; ii<currState->numChildren; ii++){
-			if(currState->isExpanded[ii] == 0 && currState->hval[ii] >= bestHval){
-				bestHval = currState->hval[ii];
-				bestChildIdx = ii;
-			}
-		}
-
 		int numObjectsChildNode = currState->numObjects + 1;
 
 		int numChildNodesForChildNode = 0;
 		if(numObjectsChildNode < maxDepth)
 			numChildNodesForChildNode = unconditionedHypothesis[numObjectsChildNode].size();
 
-		uct_state::UCTState* childState = new uct_state::UCTState(numObjectsChildNode, numChildNodesForChildNode, currState);
+		// find a non-expanded node with the best heuristic value. The nodes whose placement
+		// is rejected by the collision query are marked and the next best one is tried.
+		uct_state::UCTState* childState = NULL;
+		physim::Placement placement;
+		int bestChildIdx;
+		float bestHval;
+		while(!childState){
+			bestChildIdx = -1;
+			bestHval = 0;
+			for(int ii=0; ii<currState->numChildren; ii++){
+				if(currState->isExpanded[ii] == uct_state::NOT_EXPANDED && currState->hval[ii] >= bestHval){
+					bestHval = currState->hval[ii];
+					bestChildIdx = ii;
+				}
+			}
+
+			// every remaining child is rejected, the rollout starts from the current state. Without
+			// any expanded child the state is a dead end.
+			if(bestChildIdx < 0){
+				currState->deadEnd = currState->children.empty();
+				return currState;
+			}
+
+			childState = new uct_state::UCTState(numObjectsChildNode, numChildNodesForChildNode, currState);
+			childState->copyParent(currState);
+			childState->updateStateId(bestChildIdx);
+			childState->updateNewObject(objOrder[currState->numObjects], unconditionedHypothesis[currState->numObjects][bestChildIdx], maxDepth);
+
+			placement = childState->checkPlacement(pSim, camPose);
+			if(placement == physim::PLACEMENT_REJECT){
+				currState->isExpanded[bestChildIdx] = uct_state::REJECTED;
+				delete childState;
+				childState = NULL;
+			}
+		}
+
 		allStatePtrs.push_back(childState);
-		childState->copyParent(currState);
-		childState->updateStateId(bestChildIdx);
-		childState->updateNewObject(objOrder[currState->numObjects], unconditionedHypothesis[currState->numObjects][bestChildIdx], maxDepth);
 		childState->updateChildHval(unconditionedHypothesis[currState->numObjects]);
-		// childState->performTrICP(scenePath, trimICPthreshold);
-		childState->correctPhysics(pSim, camPose, scenePath);
-		childState->render(camPose, scenePath);
+		// childState->performTrICP(debugPath, trimICPthreshold);
+		childState->correctPhysics(pSim, camPose, debugPath, placement, &presettled[currState->numObjects][bestChildIdx]);
+		childState->render(camPose, debugPath);
 		childState->computeCost(depthImage);
 
 		// if the expanded node is the leaf node
@@ -240,23 +381,23 @@ namespace uct_search{
 		      Eigen::Matrix4f tform;
 		      utilities::convertToMatrix(bestState->objects[ii].second, tform);
 		      utilities::convertToWorld(tform, camPose);
-		      utilities::writePoseToFile(tform, bestState->objects[ii].first->pObject->objName, scenePath, "debug_search/after_search");
+		      utilities::writePoseToFile(tform, bestState->objects[ii].first->pObject->objName, debugPath, "after_search");
 
 		      ofstream pFile;
-		      pFile.open ((scenePath + "debug_search/times_" + bestState->objects[ii].first->pObject->objName + ".txt").c_str(), std::ofstream::out | std::ofstream::app);
+		      pFile.open ((debugPath + "times_" + bestState->objects[ii].first->pObject->objName + ".txt").c_str(), std::ofstream::out | std::ofstream::app);
 			  pFile << numExpansionsSearch << " " << bestRenderScore << " " << childState->stateId  << std::endl;
 			  pFile.close();
 		    } 
 		}
 
 		currState->children.push_back(childState);
-		currState->isExpanded[bestChildIdx] = 1;
+		currState->isExpanded[bestChildIdx] = uct_state::EXPANDED;
 
 		numExpansionsSearch++;
 
 		// write into the debug file
 		ofstream pFile;
-	    pFile.open ((scenePath + "debug_search/debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
+	    pFile.open ((debugPath + "debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
 		pFile << "UCTSearch::expand:: numExpansionsSearch: " << numExpansionsSearch << 
 					", currState: " << currState->stateId << ", childState: " << childState->stateId <<
 					", bestHval: " << bestHval<< ", renderScore: " << childState->renderScore <<std::endl;
@@ -274,8 +415,14 @@ namespace uct_search{
 		while(currState->numObjects < maxDepth){
 			if(!currState->isFullyExpanded())
 				return expand(currState);
-			else
-				currState = currState->getBestChild(scenePath);
+
+			// all the placements of the children were rejected or lead to dead ends
+			uct_state::UCTState *bestChild = currState->getBestChild(debugPath);
+			if(!bestChild){
+				currState->deadEnd = true;
+				return currState;
+			}
+			currState = bestChild;
 		}
 		return currState;
 	}
@@ -299,11 +446,23 @@ namespace uct_search{
 					(float( clock () - begin_time ) /  CLOCKS_PER_SEC) > maxSearchTime)
 				break;
 			
+			// no feasible placement is left anywhere in the tree
+			if(rootState->deadEnd)
+				break;
+			
 			std::cout << "UCTSearch::performSearch:: Number of states expanded: " << numExpansionsSearch << std::endl;
 			uct_state::UCTState *selState = treePolicy(rootState);
-			float reward = defaultPolicy(selState);
+
+			// a dead end gets the worst score and is not selected again
+			float reward = selState->deadEnd ? rejectedScore : defaultPolicy(selState);
 			backupReward(selState, reward);
 		}
+
+		const physim::PlacementStats &stats = pSim->placementStats;
+		std::cout << "UCTSearch::performSearch:: placements checked: " << stats.checked 
+				  << ", rejected: " << stats.rejected << ", resting: " << stats.resting
+				  << ", presettled: " << stats.presettled << ", simulated: " << stats.simulated 
+				  << ", simulations avoided: " << stats.rejected + stats.resting + stats.presettled << std::endl;
 	}
 
 	/********************************* end of functions ****************************************************
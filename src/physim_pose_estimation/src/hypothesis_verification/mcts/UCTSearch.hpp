@@ -11,7 +11,7 @@ namespace uct_search{
 		public:
 			UCTSearch(std::vector<scene_cfg::SceneObjects*> objOrder, std::vector<float> tableParams,
 					std::vector< std::vector< std::pair <Eigen::Isometry3d, float> > > unconditionedHypothesis,
-					std::string scenePath, Eigen::Matrix4f camPose, cv::Mat depthImage, int rootId);
+					std::string debugPath, Eigen::Matrix4f camPose, cv::Mat depthImage, int rootId);
 			~UCTSearch();
 			void performSearch();
 			uct_state::UCTState* expand(uct_state::UCTState *currState);
@@ -19,19 +19,22 @@ namespace uct_search{
 			float defaultPolicy(uct_state::UCTState *selState);
 			void backupReward(uct_state::UCTState *selState, float reward);
 			float LCPPolicy(uct_state::UCTState *selState);
+			void presettleHypotheses(std::vector<float> tableParams);
 
 			uct_state::UCTState *rootState;
 
 			std::vector<scene_cfg::SceneObjects*> objOrder;
 			std::vector< std::vector< std::pair <Eigen::Isometry3d, float> > > unconditionedHypothesis;
-			std::string scenePath;
+			std::string debugPath;
 			Eigen::Matrix4f camPose;
 			cv::Mat depthImage;
 
 			uct_state::UCTState *bestState;
 			unsigned int bestRenderScore;
+			int numExpansionsSearch;
 
 			physim::PhySim *pSim;
+			std::vector< std::vector<physim::SettledPose> > presettled;	// [object level][hypothesis]
 			std::vector<uct_state::UCTState* > allStatePtrs;
 	};
 }// namespace
@@ -1,13 +1,11 @@
 #include <UCTState.hpp>
-
-void addObjects(pcl::PolygonMesh::Ptr mesh);
-void renderDepth(Eigen::Matrix4f pose, cv::Mat &depth_image, std::string path);
-void clearScene();
+#include <DepthRenderer.hpp>
 
 namespace uct_state{
 	float explanationThreshold = 0.01;
 	float pointRemovalThreshold = 0.008;
 	float alpha = 5000;
+	float contactClearance = 0.01;	// distance to the other objects under which the settled pose alone is not reused
 
 	/********************************* function: constructor ***********************************************
 	*******************************************************************************************************/
@@ -17,6 +15,7 @@ namespace uct_state{
 		this->numObjects = numObjects;
 		qval = 0;
 		numExpansions = 0;
+		deadEnd = false;
 		renderScore = INT_MAX;
 		numChildren = numChildNodes;
 		parentState = parent;
@@ -41,22 +40,20 @@ namespace uct_state{
 	/********************************* function: render ****************************************************
 	*******************************************************************************************************/
 
-	void UCTState::render(Eigen::Matrix4f cam_pose, std::string scenePath){
+	void UCTState::render(Eigen::Matrix4f cam_pose, std::string debugPath){
 		cv::Mat depth_image;
 
 		// perform rendering for the last added object
-		clearScene();
 		int finalObjectIdx = objects.size()-1;
 
 		if(finalObjectIdx >= 0) {
-			pcl::PolygonMesh::Ptr mesh_in (new pcl::PolygonMesh (objects[finalObjectIdx].first->pObject->objModel));
-			pcl::PolygonMesh::Ptr mesh_out (new pcl::PolygonMesh (objects[finalObjectIdx].first->pObject->objModel));
+			pcl::PolygonMesh::Ptr mesh_in = objects[finalObjectIdx].first->pObject->renderModel;
+			pcl::PolygonMesh::Ptr mesh_out (new pcl::PolygonMesh);
 			Eigen::Matrix4f transform;
 			utilities::convertToMatrix(objects[finalObjectIdx].second, transform);
 			utilities::convertToWorld(transform, cam_pose);
 			utilities::TransformPolyMesh(mesh_in, mesh_out, transform);
-			addObjects(mesh_out);
-			renderDepth(cam_pose, depth_image, scenePath + "debug_search/render" + stateId + ".png");
+			depth_renderer::renderMesh(mesh_out, cam_pose, depth_image, debugPath + "render" + stateId + ".png");
 
 			// copy the rendering of the current object over parent state render
 			for(int u=0; u<renderedImg.rows; u++)
@@ -68,7 +65,7 @@ namespace uct_state{
 				}
 		}
 
-		utilities::writeDepthImage(renderedImg, scenePath + "debug_search/render" + stateId + ".png");
+		utilities::writeDepthImage(renderedImg, debugPath + "render" + stateId + ".png");
 	}
 
 	/********************************* function: updateNewObject *******************************************
@@ -118,7 +115,7 @@ namespace uct_state{
 	/********************************* function: performTrICP **********************************************
 	*******************************************************************************************************/
 
-	void UCTState::performTrICP(std::string scenePath, float trimPercentage){
+	void UCTState::performTrICP(std::string debugPath, float trimPercentage){
 		if(!numObjects)
 			return;
 		PointCloud::Ptr transformedCloud (new PointCloud);
@@ -142,7 +139,7 @@ namespace uct_state{
 		copyPointCloud(*objects[numObjects-1].first->pclSegment, *unexplainedSegment);
 		
 		#ifdef DBG_ICP
-		std::string input1 = scenePath + "debug_search/render" + stateId + "_Presegment.ply";
+		std::string input1 = debugPath + "render" + stateId + "_Presegment.ply";
 		pcl::io::savePLYFile(input1, *unexplainedSegment);
 		#endif
 
@@ -174,7 +171,7 @@ namespace uct_state{
 		}
 
 		#ifdef DBG_ICP
-		std::string input2 = scenePath + "debug_search/render" + stateId + "_Postsegment.ply";
+		std::string input2 = debugPath + "render" + stateId + "_Postsegment.ply";
 		pcl::io::savePLYFile(input2, *unexplainedSegment);
 		#endif
 
@@ -187,7 +184,7 @@ namespace uct_state{
 		#ifdef DBG_ICP
 		std::cout<< "size of cloud: "<<abs(numPoints)<<std::endl;
 		pcl::transformPointCloud(*modelCloud, *transformedCloud, tform.inverse().eval());
-		std::string input3 = scenePath + "debug_search/render" + stateId + "_Premodel.ply";
+		std::string input3 = debugPath + "render" + stateId + "_Premodel.ply";
 		pcl::io::savePLYFile(input3, *transformedCloud);
 		#endif
 
@@ -196,18 +193,83 @@ namespace uct_state{
 
 		#ifdef DBG_ICP
 		pcl::transformPointCloud(*modelCloud, *transformedCloud, tform);
-		std::string input4 = scenePath + "debug_search/render" + stateId + "_Postmodel.ply";
+		std::string input4 = debugPath + "render" + stateId + "_Postmodel.ply";
 		pcl::io::savePLYFile(input4, *transformedCloud);
 		#endif
 
 		utilities::convertToIsometry3d(tform, objects[numObjects-1].second);
 	}
 
-	/********************************* function: correctPhysics ********************************************
+	/********************************* function: checkPlacement ********************************************
+	Collision query of the last object against the table and the objects placed before it
 	*******************************************************************************************************/
-	void UCTState::correctPhysics(physim::PhySim* pSim, Eigen::Matrix4f cam_pose, std::string scenePath){
+	physim::Placement UCTState::checkPlacement(physim::PhySim* pSim, Eigen::Matrix4f cam_pose){
 		if(!numObjects)
+			return physim::PLACEMENT_RESTING;
+
+		std::vector<std::pair<std::string, Eigen::Isometry3d> > worldPoses(numObjects);
+		for(int ii=0; ii<numObjects; ii++){
+			Eigen::Matrix4f camTform;
+			utilities::convertToMatrix(objects[ii].second, camTform);
+			utilities::convertToWorld(camTform, cam_pose);
+			worldPoses[ii].first = objects[ii].first->pObject->objName;
+			utilities::convertToIsometry3d(camTform, worldPoses[ii].second);
+		}
+
+		std::pair<std::string, Eigen::Isometry3d> newObject = worldPoses.back();
+		worldPoses.pop_back();
+		return pSim->classifyPlacement(newObject.first, newObject.second, worldPoses);
+	}
+
+	/********************************* function: correctPhysics ********************************************
+	Settles the last object, the rejected placements keep their pose without simulation. A resting
+	placement keeps its pose when its hypothesis is also stable alone on the table, an object balanced
+	on an edge is settled like the others. When the last object stays clear of the others, from its
+	hypothesis to its pose settled alone on the table (presettled), that pose is used instead of simulating.
+	*******************************************************************************************************/
+	void UCTState::correctPhysics(physim::PhySim* pSim, Eigen::Matrix4f cam_pose, std::string debugPath,
+			physim::Placement placement, const physim::SettledPose *presettled){
+		if(!numObjects || placement == physim::PLACEMENT_REJECT)
 			return;
+		if(placement == physim::PLACEMENT_RESTING && (!presettled || presettled->stable)){
+			pSim->placementStats.resting++;
+			return;
+		}
+
+		if(presettled){
+			bool onTableOnly = numObjects == 1;
+			if(!onTableOnly){
+				std::vector<std::pair<std::string, Eigen::Isometry3d> > worldPoses(numObjects - 1);
+				for(int ii=0; ii<numObjects-1; ii++){
+					Eigen::Matrix4f camTform;
+					utilities::convertToMatrix(objects[ii].second, camTform);
+					utilities::convertToWorld(camTform, cam_pose);
+					worldPoses[ii].first = objects[ii].first->pObject->objName;
+					utilities::convertToIsometry3d(camTform, worldPoses[ii].second);
+				}
+
+				std::string objName = objects[numObjects-1].first->pObject->objName;
+				Eigen::Matrix4f startTform, settledTform;
+				Eigen::Isometry3d startPose, settledPose;
+				utilities::convertToMatrix(objects[numObjects-1].second, startTform);
+				utilities::convertToWorld(startTform, cam_pose);
+				utilities::convertToIsometry3d(startTform, startPose);
+				Eigen::Isometry3d presettledPose = presettled->pose;
+				utilities::convertToMatrix(presettledPose, settledTform);
+				utilities::convertToWorld(settledTform, cam_pose);
+				utilities::convertToIsometry3d(settledTform, settledPose);
+
+				onTableOnly = pSim->distanceToObjects(objName, startPose, worldPoses) > contactClearance &&
+							  pSim->distanceToObjects(objName, settledPose, worldPoses) > contactClearance;
+			}
+
+			if(onTableOnly){
+				objects[numObjects-1].second = presettled->pose;
+				pSim->placementStats.presettled++;
+				return;
+			}
+		}
+		pSim->placementStats.simulated++;
 
 		for(int ii=0; ii<numObjects-1; ii++){
 			Eigen::Matrix4f camTform, worldTform;
@@ -228,7 +290,7 @@ namespace uct_state{
 
 		#ifdef DBG_PHYSICS
 		std::ofstream cfg_in;
-		std::string path_in = scenePath + "debug_search/render" + stateId + "_in.txt";
+		std::string path_in = debugPath + "render" + stateId + "_in.txt";
 		cfg_in.open (path_in.c_str(), std::ofstream::out | std::ofstream::app);
 		Eigen::Isometry3d pose_in;
 		for(int ii=0; ii<numObjects; ii++){
@@ -245,7 +307,7 @@ namespace uct_state{
 
 		#ifdef DBG_PHYSICS
 		std::ofstream cfg_out;
-		std::string path_out = scenePath + "debug_search/render" + stateId + "_out.txt";
+		std::string path_out = debugPath + "render" + stateId + "_out.txt";
 		cfg_out.open (path_out.c_str(), std::ofstream::out | std::ofstream::app);
 		Eigen::Isometry3d pose_out;
 		for(int ii=0; ii<numObjects; ii++){
@@ -272,11 +334,18 @@ namespace uct_state{
 	/******************************** function: getBestChild ************************************************
 	/*******************************************************************************************************/
 
-	uct_state::UCTState* UCTState::getBestChild(std::string scenePath){
+	uct_state::UCTState* UCTState::getBestChild(std::string debugPath){
 		int bestChildIdx = -1;
 		float bestVal = INT_MAX;
 
-		for(int ii=0; ii<numChildren; ii++){			
+		// the rejected placements have no child state, the dead ends are skipped
+		if(children.empty())
+			return NULL;
+
+		for(int ii=0; ii<children.size(); ii++){			
+			if(children[ii]->deadEnd)
+				continue;
+
 			// needs to be changed when modifying optimization direction
 			float tmpVal = (children[ii]->qval/children[ii]->numExpansions) - alpha*sqrt(2*log(numExpansions)/children[ii]->numExpansions);
 			if (tmpVal < bestVal){
@@ -287,12 +356,12 @@ namespace uct_state{
 
 		// write into the debug file
 		ofstream pFile;
-	    pFile.open ((scenePath + "debug_search/debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
+	    pFile.open ((debugPath + "debug.txt").c_str(), std::ofstream::out | std::ofstream::app);
 		pFile << "UCTState::getBestChild:: state:" << stateId << 
 					", bestChildIdx: " << bestChildIdx << ", bestVal: " << bestVal<< std::endl;
 		pFile.close();
 
-		return children[bestChildIdx];
+		return bestChildIdx < 0 ? NULL : children[bestChildIdx];
 	}
 
 	/******************************** function: isFullyExpanded *********************************************
@@ -300,7 +369,7 @@ namespace uct_state{
 
 	bool UCTState::isFullyExpanded(){
 		for(int ii=0; ii<numChildren; ii++)
-			if(isExpanded[ii] == 0)return false;
+			if(isExpanded[ii] == NOT_EXPANDED)return false;
 
 		return true;
 	}
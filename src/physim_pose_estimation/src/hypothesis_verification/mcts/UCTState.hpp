@@ -5,6 +5,9 @@
 #include <PhySim.hpp>
 
 namespace uct_state{
+
+	// values of UCTState::isExpanded
+	enum { NOT_EXPANDED = 0, EXPANDED = 1, REJECTED = 2 };
 	
 	class UCTState{
 		public:
@@ -15,9 +18,11 @@ namespace uct_state{
 			void render(Eigen::Matrix4f, std::string);
 			void updateStateId(int num);
 			void computeCost(cv::Mat obsImg);
-			void performTrICP(std::string scenePath, float trimPercentage);
-			void correctPhysics(physim::PhySim*, Eigen::Matrix4f, std::string);
-			UCTState* getBestChild(std::string scenePath);
+			void performTrICP(std::string debugPath, float trimPercentage);
+			physim::Placement checkPlacement(physim::PhySim*, Eigen::Matrix4f);
+			void correctPhysics(physim::PhySim*, Eigen::Matrix4f, std::string, physim::Placement,
+				const physim::SettledPose *presettled);
+			UCTState* getBestChild(std::string debugPath);
 			bool isFullyExpanded();
 			void updateChildHval(std::vector< std::pair <Eigen::Isometry3d, float> > childStates);
 
@@ -28,8 +33,9 @@ namespace uct_state{
 			std::vector<std::pair<scene_cfg::SceneObjects*, Eigen::Isometry3d> > objects;
 			UCTState* parentState;
 			std::vector<UCTState*> children;
-			std::vector<int> isExpanded;
+			std::vector<int> isExpanded;	// per child, the rejected children have no state
 			std::vector<float> hval;
+			bool deadEnd;					// no feasible placement below this state, not selected anymore
 
 			cv::Mat renderedImg;
 			int numExpansions;
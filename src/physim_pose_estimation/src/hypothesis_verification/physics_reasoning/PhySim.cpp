@@ -2,17 +2,144 @@
 
 int gravityVal = -2;
 
+// penetration depth beyond which a placement is rejected, and contact distance under which
+// it is resting
+const float rejectPenetration = 0.02;
+const float restingDistance = 0.002;
+
+// smallest z of the table normal at the contact for the object to be resting on top of the table
+const float minSupportNormalZ = 0.94;
+
+// directions over which the reduced collision hull is compared with the full one
+const int hullErrorDirections = 1024;
+
 namespace physim{
 
+	/********************************* function: toBtTransform *********************************************
+	*******************************************************************************************************/
+
+	static btTransform toBtTransform(const Eigen::Isometry3d &tform){
+		Eigen::Vector3d trans = tform.translation();
+		Eigen::Quaterniond rot(tform.rotation());
+		btTransform btform;
+		btform.setIdentity();
+		btform.setOrigin(btVector3(trans[0], trans[1], trans[2]));
+		btform.setRotation(btQuaternion(rot.x(), rot.y(), rot.z(), rot.w()));
+		return btform;
+	}
+
+	/********************************* function: signedDistance ********************************************
+	Distance between two convex shapes with GJK, negative penetration depth from EPA when they overlap.
+	normalOnB is the contact normal on shapeB in world frame, pointing towards shapeA.
+	*******************************************************************************************************/
+
+	static btScalar signedDistance(btCollisionShape* shapeA, const btTransform &tformA,
+		btCollisionShape* shapeB, const btTransform &tformB, btVector3 *normalOnB = NULL){
+		btVoronoiSimplexSolver simplexSolver;
+		btGjkEpaPenetrationDepthSolver epaSolver;
+		btGjkPairDetector detector(static_cast<btConvexShape*>(shapeA), static_cast<btConvexShape*>(shapeB),
+			&simplexSolver, &epaSolver);
+
+		btGjkPairDetector::ClosestPointInput input;
+		input.m_transformA = tformA;
+		input.m_transformB = tformB;
+		btPointCollector result;
+		detector.getClosestPoints(input, result, 0);
+		if(normalOnB)
+			*normalOnB = result.m_hasResult ? result.m_normalOnBInWorld : btVector3(0,0,0);
+		return result.m_hasResult ? result.m_distance : BT_LARGE_FLOAT;
+	}
+
+	/********************************* function: sphereDirections ******************************************
+	Fibonacci lattice of nearly uniform unit directions
+	*******************************************************************************************************/
+
+	static std::vector<Eigen::Vector3f> sphereDirections(int num){
+		std::vector<Eigen::Vector3f> dirs(num);
+		const float golden = M_PI * (3 - std::sqrt(5.0f));
+		for(int ii=0; ii<num; ii++){
+			float z = 1 - (2*ii + 1) / float(num);
+			float r = std::sqrt(1 - z*z);
+			dirs[ii] = Eigen::Vector3f(r*std::cos(golden*ii), r*std::sin(golden*ii), z);
+		}
+		return dirs;
+	}
+
+	/********************************* function: supportValue **********************************************
+	*******************************************************************************************************/
+
+	static float supportValue(const std::vector<Eigen::Vector3f> &points, const Eigen::Vector3f &dir, int &bestIdx){
+		float best = -FLT_MAX;
+		for(int ii=0; ii<points.size(); ii++){
+			float val = points[ii].dot(dir);
+			if(val > best){
+				best = val;
+				bestIdx = ii;
+			}
+		}
+		return best;
+	}
+
+	/********************************* function: buildCollisionHull ****************************************
+	The mesh at objPath may be an .obj or a .ply file, both are read through pcl::io::loadPolygonFile
+	*******************************************************************************************************/
+
+	float buildCollisionHull(std::string objPath, int maxVertices, std::vector<Eigen::Vector3f> &hullPoints){
+		std::string extension = objPath.substr(std::min(objPath.size(), objPath.rfind('.')));
+		if(extension != ".obj" && extension != ".ply"){
+			std::cout << "buildCollisionHull: " << objPath << " is not an .obj or .ply mesh, check location_obj in the object config" << std::endl;
+			exit(-1);
+		}
+
+		pcl::PolygonMesh mesh;
+		pcl::PointCloud<pcl::PointXYZ> meshCloud;
+		if(pcl::io::loadPolygonFile(objPath, mesh) > 0)
+			pcl::fromPCLPointCloud2(mesh.cloud, meshCloud);
+		if(meshCloud.points.empty()){
+			std::cout << "buildCollisionHull: could not load " << objPath << std::endl;
+			exit(-1);
+		}
+
+		std::vector<Eigen::Vector3f> meshPoints(meshCloud.points.size());
+		for(int ii=0; ii<meshCloud.points.size(); ii++)
+			meshPoints[ii] = meshCloud.points[ii].getVector3fMap();
+
+		if(maxVertices <= 0 || meshPoints.size() <= maxVertices){
+			hullPoints = meshPoints;
+			return 0;
+		}
+
+		// keep the support point of every lattice direction, the directions sharing one are merged
+		std::vector<Eigen::Vector3f> dirs = sphereDirections(maxVertices);
+		std::vector<bool> kept(meshPoints.size(), false);
+		hullPoints.clear();
+		for(int ii=0; ii<dirs.size(); ii++){
+			int idx = 0;
+			supportValue(meshPoints, dirs[ii], idx);
+			if(!kept[idx]){
+				kept[idx] = true;
+				hullPoints.push_back(meshPoints[idx]);
+			}
+		}
+
+		float maxError = 0;
+		int idx;
+		std::vector<Eigen::Vector3f> errorDirs = sphereDirections(hullErrorDirections);
+		for(int ii=0; ii<errorDirs.size(); ii++)
+			maxError = std::max(maxError, supportValue(meshPoints, errorDirs[ii], idx) - supportValue(hullPoints, errorDirs[ii], idx));
+		return maxError;
+	}
+
 	/********************************* function: constructor ***********************************************
 	*******************************************************************************************************/
 
 	PhySim::PhySim(std::vector< float> tableParams){
-		btDefaultCollisionConfiguration* collisionConfiguration = new btDefaultCollisionConfiguration();
-		btCollisionDispatcher* dispatcher = new	btCollisionDispatcher(collisionConfiguration);
-		btBroadphaseInterface* overlappingPairCache = new btDbvtBroadphase();
-		btSequentialImpulseConstraintSolver* solver = new btSequentialImpulseConstraintSolver;
+		collisionConfiguration = new btDefaultCollisionConfiguration();
+		dispatcher = new	btCollisionDispatcher(collisionConfiguration);
+		overlappingPairCache = new btDbvtBroadphase();
+		solver = new btSequentialImpulseConstraintSolver;
 		dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,overlappingPairCache,solver,collisionConfiguration);
+		tableShape = NULL;
 		dynamicsWorld->setGravity(btVector3(0,0,gravityVal));
 	}
 
@@ -21,6 +148,7 @@ namespace physim{
 
 	void PhySim::addTable(std::vector< float> tableParams){
 		btCollisionShape* groundShape = new btBoxShape(btVector3(btScalar(0.40),btScalar(0.40),btScalar(0.20)));
+		tableShape = groundShape;
 
 		btTransform groundTransform;
 		groundTransform.setIdentity();
@@ -32,6 +160,7 @@ namespace physim{
 						tableParams[4], tableParams[5], tableParams[6], 
 						tableParams[8], tableParams[9], tableParams[10]);
 		groundTransform.setBasis(rotMat);
+		tableTransform = groundTransform;
 
 		btScalar mass(0.);
 		bool isDynamic = (mass != 0.f);
@@ -50,14 +179,11 @@ namespace physim{
 	/********************************* function: initRigidBodies *******************************************
 	*******************************************************************************************************/
 
-	void PhySim::initRigidBody(std::string objName){
-		std::string sfileName = "/home/chaitanya/github/PhysimGlobalPose/models/" + objName + "/" + objName + ".obj";
-		const char* cfileName = sfileName.c_str();
-		GLInstanceGraphicsShape* glmesh = LoadMeshFromObj(cfileName, "");
-		std::cout << "[INFO] Obj loaded: Extracted "<< glmesh->m_numvertices << " vertices from obj file " << sfileName << std::endl;
-
-		const GLInstanceVertex& v = glmesh->m_vertices->at(0);
-		btConvexHullShape* shape = new btConvexHullShape((const btScalar*)(&(v.xyzw[0])), glmesh->m_numvertices, sizeof(GLInstanceVertex));
+	void PhySim::initRigidBody(std::string objName, const std::vector<Eigen::Vector3f> &hullPoints){
+		btConvexHullShape* shape = new btConvexHullShape();
+		for(int ii=0; ii<hullPoints.size(); ii++)
+			shape->addPoint(btVector3(hullPoints[ii][0], hullPoints[ii][1], hullPoints[ii][2]), false);
+		shape->recalcLocalAabb();
 		float scaling[4] = {1,1,1,1};
 		btVector3 localScaling(scaling[0],scaling[1],scaling[2]);
 		shape->setLocalScaling(localScaling);
@@ -127,6 +253,53 @@ namespace physim{
 		tform.translation() = transEig;
 	}
 
+	/********************************* function: classifyPlacement *****************************************
+	Collision query of objName at tform (world frame) against the table and the placed objects,
+	run instead of stepping the world to sort out the placements that are hopeless or already at rest.
+	A contact is only a support when it is the table seen from above, a contact with a placed object
+	(on its side or on top, away from the centre of mass) is left to the simulation.
+	*******************************************************************************************************/
+
+	Placement PhySim::classifyPlacement(std::string objName, Eigen::Isometry3d tform,
+			const std::vector<std::pair<std::string, Eigen::Isometry3d> > &placedObjects){
+		placementStats.checked++;
+		btCollisionShape* shape = cShapes[objName];
+		btTransform btform = toBtTransform(tform);
+
+		btScalar objectDistance = distanceToObjects(objName, tform, placedObjects);
+		btScalar tableDistance = BT_LARGE_FLOAT;
+		btVector3 tableNormal(0,0,0);
+		if(tableShape)
+			tableDistance = signedDistance(shape, btform, tableShape, tableTransform, &tableNormal);
+
+		if(std::min(objectDistance, tableDistance) < -rejectPenetration){
+			placementStats.rejected++;
+			return PLACEMENT_REJECT;
+		}
+
+		// gravity is along -z in world frame
+		if(std::abs(tableDistance) < restingDistance && objectDistance > restingDistance &&
+				tableNormal.z() > minSupportNormalZ)
+			return PLACEMENT_RESTING;
+		return PLACEMENT_SETTLE;
+	}
+
+	/********************************* function: distanceToObjects *****************************************
+	Smallest signed distance of objName at tform to the placed objects, all in world frame
+	*******************************************************************************************************/
+
+	float PhySim::distanceToObjects(std::string objName, Eigen::Isometry3d tform,
+			const std::vector<std::pair<std::string, Eigen::Isometry3d> > &placedObjects){
+		btCollisionShape* shape = cShapes[objName];
+		btTransform btform = toBtTransform(tform);
+
+		btScalar minDistance = BT_LARGE_FLOAT;
+		for(int ii=0; ii<placedObjects.size(); ii++)
+			minDistance = std::min(minDistance, signedDistance(shape, btform, 
+				cShapes[placedObjects[ii].first], toBtTransform(placedObjects[ii].second)));
+		return minDistance;
+	}
+
 	/********************************* function: removeObject **********************************************
 	*******************************************************************************************************/
 
@@ -142,10 +315,12 @@ namespace physim{
 	*******************************************************************************************************/
 
 	PhySim::~PhySim(){
-		// deleting collision shapes
-		for (std::map<std::string, btCollisionShape*>::iterator it=cShapes.begin(); it!=cShapes.end(); ++it){
-			btCollisionShape* shape = it->second;
-			delete shape;
+		// removing the table and the objects still in the world, deleting the table
+		for (int i=dynamicsWorld->getNumCollisionObjects()-1; i>=0 ;i--) {
+			btCollisionObject* obj = dynamicsWorld->getCollisionObjectArray()[i];
+			dynamicsWorld->removeCollisionObject(obj);
+			if(obj->getCollisionShape() == tableShape)
+				delete obj;
 		}
 
 		// deleting rigid bodies
@@ -153,13 +328,19 @@ namespace physim{
 			btRigidBody* body = it->second;
 			delete body;
 		}
-		// deleting the table
-		for (int i=dynamicsWorld->getNumCollisionObjects()-1; i>=0 ;i--) {
-			btCollisionObject* obj = dynamicsWorld->getCollisionObjectArray()[i];
-			btRigidBody* body = btRigidBody::upcast(obj);
-			dynamicsWorld->removeCollisionObject(obj);
-			delete obj;
+
+		// deleting collision shapes
+		for (std::map<std::string, btCollisionShape*>::iterator it=cShapes.begin(); it!=cShapes.end(); ++it){
+			btCollisionShape* shape = it->second;
+			delete shape;
 		}
+		delete tableShape;
+
+		delete dynamicsWorld;
+		delete solver;
+		delete overlappingPairCache;
+		delete dispatcher;
+		delete collisionConfiguration;
 	}
 
 	/********************************* end of functions ****************************************************
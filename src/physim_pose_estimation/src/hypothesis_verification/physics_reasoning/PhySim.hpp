@@ -16,24 +16,71 @@
 #include "../examples/Importers/ImportObjDemo/Wavefront2GLInstanceGraphicsShape.h"
 #include "../examples/Utils/b3ResourcePath.h"
 #include "../examples/CommonInterfaces/CommonParameterInterface.h"
+#include <BulletCollision/NarrowPhaseCollision/btGjkPairDetector.h>
+#include <BulletCollision/NarrowPhaseCollision/btGjkEpaPenetrationDepthSolver.h>
+#include <BulletCollision/NarrowPhaseCollision/btPointCollector.h>
+#include <BulletCollision/NarrowPhaseCollision/btVoronoiSimplexSolver.h>
 
 namespace physim{
 
+	// outcome of the collision query run before simulating a new object
+	enum Placement{
+		PLACEMENT_RESTING,		// touches only the table, from above, without penetrating
+		PLACEMENT_SETTLE,		// needs the dynamics simulation
+		PLACEMENT_REJECT		// buried in the table or a placed object, not simulated
+	};
+
+	struct PlacementStats{
+		int checked;
+		int resting;		// resting placements confirmed stable and kept without simulation
+		int rejected;
+		int simulated;
+		int presettled;		// settled poses reused from the table only pre-pass
+		PlacementStats() : checked(0), resting(0), rejected(0), simulated(0), presettled(0) {}
+	};
+
+	// pose of a hypothesis after dropping it alone on the table
+	struct SettledPose{
+		Eigen::Isometry3d pose;		// camera frame
+		bool stable;				// the hypothesis barely moved
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	};
+
+	// Convex hull of the obj mesh at objPath for the collision shape, reduced to the support points of
+	// at most maxVertices directions (0 keeps every vertex). Returns the largest inward shift of the
+	// hull surface over a dense set of directions, i.e. how much the reduced hull shrinks.
+	float buildCollisionHull(std::string objPath, int maxVertices, std::vector<Eigen::Vector3f> &hullPoints);
+
 	class PhySim{
 		public:
 			btDiscreteDynamicsWorld* dynamicsWorld;
 			std::map<std::string, btRigidBody*> rBodyMap;
 			std::map<std::string, btCollisionShape*> cShapes;
+			btCollisionShape* tableShape;
 
 			PhySim(std::vector< float> tableParams);
 			~PhySim();
 			void addTable(std::vector< float> tableParams);
-			void initRigidBody(std::string);
+			void initRigidBody(std::string objName, const std::vector<Eigen::Vector3f> &hullPoints);
 			void addObject(std::string objName, Eigen::Isometry3d tform, float mass);
 			void removeObject(std::string objName);
 			void simulate(int num_steps);
 			void getTransform(std::string objName, Eigen::Isometry3d &tform);
+			Placement classifyPlacement(std::string objName, Eigen::Isometry3d tform,
+				const std::vector<std::pair<std::string, Eigen::Isometry3d> > &placedObjects);
+			float distanceToObjects(std::string objName, Eigen::Isometry3d tform,
+				const std::vector<std::pair<std::string, Eigen::Isometry3d> > &placedObjects);
+
+			PlacementStats placementStats;
+
+		private:
+			btTransform tableTransform;
 
+			// the world does not own its collision configuration, dispatcher, broadphase and solver
+			btDefaultCollisionConfiguration* collisionConfiguration;
+			btCollisionDispatcher* dispatcher;
+			btBroadphaseInterface* overlappingPairCache;
+			btSequentialImpulseConstraintSolver* solver;
 	};
 
 } //namespace
@@ -1,5 +1,6 @@
 #include <GlobalCfg.hpp>
 #include <SceneCfg.hpp>
+#include <DepthRenderer.hpp>
 
 // global config pointer
 GlobalCfg *pCfg;
@@ -7,18 +8,14 @@ GlobalCfg *pCfg;
 namespace utilities{
   std::map<std::string, geometry_msgs::Pose> anyTimePoseArray;
   PointCloudRGB::Ptr pc_viz;
+  std::mutex vizMutex;
 }
 
 int runVizThread = 1;
 
-// depth_sim package
-void initScene (int argc, char **argv);
-void addObjects(pcl::PolygonMesh::Ptr mesh);
-void renderDepth(Eigen::Matrix4f pose, cv::Mat &depth_image, std::string path);
-void clearScene();
-
 void publishMarkers(std::vector<visualization_msgs::Marker> &marker, std::vector<ros::Publisher> &marker_pub, ros::Publisher pub) {
   while(runVizThread){
+    std::unique_lock<std::mutex> vizLock(utilities::vizMutex);
     for (int ii=0; ii<pCfg->num_objects; ii++){
       std::map<std::string, geometry_msgs::Pose>::iterator it = utilities::anyTimePoseArray.find(pCfg->gObjects[ii]->objName);
       geometry_msgs::Pose msg = it->second;
@@ -34,6 +31,7 @@ void publishMarkers(std::vector<visualization_msgs::Marker> &marker, std::vector
 
     utilities::pc_viz->header.frame_id = "/world";
     pub.publish (utilities::pc_viz);
+    vizLock.unlock();
     ros::Duration(0.1).sleep();
   }
 }
@@ -87,6 +85,7 @@ bool estimatePose(physim_pose_estimation::EstimateObjectPose::Request &req,
                   physim_pose_estimation::EstimateObjectPose::Response &res){
 
   // refresh visualization
+  std::unique_lock<std::mutex> vizLock(utilities::vizMutex);
   for(int ii=0; ii<pCfg->num_objects; ii++) {
     std::map<std::string, geometry_msgs::Pose>::iterator it = utilities::anyTimePoseArray.find(pCfg->gObjects[ii]->objName);
     it->second.position.x = 10;
@@ -97,30 +96,40 @@ bool estimatePose(physim_pose_estimation::EstimateObjectPose::Request &req,
     it->second.orientation.z = 0;
     it->second.orientation.w = 1;
   }
+  vizLock.unlock();
+
+  // resident set at the end of each stage of this request, VmHWM is shared with the requests
+  // served concurrently and would not belong to this one
+  long startRssKB, endRssKB, peakRssKB;
+  utilities::readMemoryUsage(startRssKB, peakRssKB);
+  long stageMaxRssKB = startRssKB;
 
   // Initialize the scene based on the type of dataset or camera input is chosen as default
-  scene_cfg::SceneCfg *currScene;
+  std::unique_ptr<scene_cfg::SceneCfg> currScene;
   if(!req.OperationMode.compare("APC"))
-    currScene = new scene_cfg::APCSceneCfg(req.SceneFiles, req.SegmentationMode, req.HypothesisGenerationMode, req.HypothesisVerificationMode);
+    currScene.reset(new scene_cfg::APCSceneCfg(req.SceneFiles, req.SegmentationMode, req.HypothesisGenerationMode, req.HypothesisVerificationMode));
   else if(!req.OperationMode.compare("YCB"))
-    currScene = new scene_cfg::YCBSceneCfg(req.SceneFiles, req.SegmentationMode, req.HypothesisGenerationMode, req.HypothesisVerificationMode);
+    currScene.reset(new scene_cfg::YCBSceneCfg(req.SceneFiles, req.SegmentationMode, req.HypothesisGenerationMode, req.HypothesisVerificationMode));
   else
-    currScene = new scene_cfg::CAMSceneCfg(req.SceneFiles, req.SegmentationMode, req.HypothesisGenerationMode, req.HypothesisVerificationMode);
+    currScene.reset(new scene_cfg::CAMSceneCfg(req.SceneFiles, req.SegmentationMode, req.HypothesisGenerationMode, req.HypothesisVerificationMode));
 
-  currScene->cleanDebugLocations();
+  currScene->initRequestContext(pCfg->debugOutput);
   currScene->getSceneInfo(pCfg);
+  utilities::sampleMemoryUsage(stageMaxRssKB);
 
   std::cout<<"number of objects: " << currScene->numObjects << std::endl
            <<"camera pose: " << std::endl << currScene->camPose << std::endl
            <<"camera intrinsics: "<< std::endl << currScene->camIntrinsic << std::endl;
 
-  currScene->removeTable();
   currScene->perfromSegmentation(pCfg);
+  utilities::sampleMemoryUsage(stageMaxRssKB);
   
   clock_t time_start = clock ();
   
   currScene->generateHypothesis();
+  utilities::sampleMemoryUsage(stageMaxRssKB);
   currScene->performHypothesisSelection();
+  utilities::sampleMemoryUsage(stageMaxRssKB);
 
   float total_time = float( clock () - time_start ) /  CLOCKS_PER_SEC;
 
@@ -129,7 +138,9 @@ bool estimatePose(physim_pose_estimation::EstimateObjectPose::Request &req,
   // pFile << total_time << std::endl;
   // pFile.close();
   
+  vizLock.lock();
   copyPointCloud(*currScene->sceneCloud, *utilities::pc_viz);
+  vizLock.unlock();
 
   // iterate over scene objects
   for(int ii=0; ii<currScene->numObjects; ii++){
@@ -159,13 +170,20 @@ bool estimatePose(physim_pose_estimation::EstimateObjectPose::Request &req,
 
     // Write final result in the file result.txt
     ofstream pFile;
-    pFile.open ((currScene->scenePath + "result.txt").c_str(), std::ofstream::out | std::ofstream::app);
+    pFile.open (currScene->ctx->resultPath.c_str(), std::ofstream::out | std::ofstream::app);
     pFile << pose.label << " " << msg.position.x << " " << msg.position.y << " " << msg.position.z 
       << " " << msg.orientation.w << " " << msg.orientation.x << " " << msg.orientation.y << " " << msg.orientation.z << std::endl;
     pFile.close();
   }
 
-  delete currScene;
+  currScene.reset();
+
+  // everything the request allocated is released with the scene, the resident set should
+  // come back to its size before the request. The resident set is process wide, with
+  // concurrent requests it also counts theirs.
+  utilities::readMemoryUsage(endRssKB, peakRssKB);
+  ROS_INFO("Request memory: rss %.1f MB before, %.1f MB after, %.1f MB at most at the stage ends, process peak since start %.1f MB", 
+    startRssKB/1024.0, endRssKB/1024.0, stageMaxRssKB/1024.0, peakRssKB/1024.0);
 
   return true;
 }
@@ -178,7 +196,7 @@ int main(int argc, char **argv){
   ros::init(argc, argv, "physim_node");
   pCfg = new GlobalCfg();
   
-  initScene (0, NULL); // Initialize openGL for rendering
+  depth_renderer::start(); // Initialize openGL for rendering
 
   pCfg->loadObjects();
 
@@ -207,12 +225,20 @@ int main(int argc, char **argv){
 
   std::thread marker_thread (publishMarkers, std::ref(markers), std::ref(marker_pubs), pub);
 
+  // requests are served concurrently by a pool of spinner threads, each one with its own
+  // scene context and physics world; the object models in pCfg are shared read-only
+  int numWorkers;
+  ros::param::param<int>("~num_workers", numWorkers, 4);
+
   ros::ServiceServer service = pCfg->nh.advertiseService("pose_estimation", estimatePose);
-  ROS_INFO("Ready for pose estimation");
-  ros::spin();
+  ros::AsyncSpinner spinner(numWorkers);
+  spinner.start();
+  ROS_INFO("Ready for pose estimation, %d workers", numWorkers);
+  ros::waitForShutdown();
   runVizThread = 0;
 
   marker_thread.join();
+  depth_renderer::stop();
   return 0;
 }
 
@@ -0,0 +1,97 @@
+#include <DepthRenderer.hpp>
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+
+// depth_sim package
+void initScene (int argc, char **argv);
+void addObjects(pcl::PolygonMesh::Ptr mesh);
+void renderDepth(Eigen::Matrix4f pose, cv::Mat &depth_image, std::string path);
+void clearScene();
+
+namespace depth_renderer{
+
+	class RenderJob{
+		public:
+			pcl::PolygonMesh::Ptr mesh;
+			Eigen::Matrix4f camPose;
+			std::string path;
+			cv::Mat *depthImage;
+			std::promise<void> done;
+	};
+
+	static std::thread renderThread;
+	static std::mutex queueMutex;
+	static std::condition_variable queueCond;
+	static std::deque<RenderJob*> jobQueue;
+	static bool running = false;
+
+	/********************************* function: renderLoop ************************************************
+	*******************************************************************************************************/
+
+	static void renderLoop(std::promise<void> *ready){
+		initScene (0, NULL); // Initialize openGL for rendering
+		ready->set_value();
+
+		while(1){
+			RenderJob *job;
+			{
+				std::unique_lock<std::mutex> queueLock(queueMutex);
+				queueCond.wait(queueLock, []{ return !jobQueue.empty() || !running; });
+				if(jobQueue.empty())
+					return;
+				job = jobQueue.front();
+				jobQueue.pop_front();
+			}
+
+			clearScene();
+			addObjects(job->mesh);
+			renderDepth(job->camPose, *job->depthImage, job->path);
+			job->done.set_value();
+		}
+	}
+
+	/********************************* function: start *****************************************************
+	*******************************************************************************************************/
+
+	void start(){
+		std::promise<void> ready;
+		running = true;
+		renderThread = std::thread(renderLoop, &ready);
+		ready.get_future().wait();
+	}
+
+	/********************************* function: stop ******************************************************
+	*******************************************************************************************************/
+
+	void stop(){
+		{
+			std::lock_guard<std::mutex> queueLock(queueMutex);
+			running = false;
+		}
+		queueCond.notify_all();
+		if(renderThread.joinable())
+			renderThread.join();
+	}
+
+	/********************************* function: renderMesh ************************************************
+	*******************************************************************************************************/
+
+	void renderMesh(pcl::PolygonMesh::Ptr mesh, Eigen::Matrix4f camPose, cv::Mat &depthImage, std::string path){
+		RenderJob job;
+		job.mesh = mesh;
+		job.camPose = camPose;
+		job.path = path;
+		job.depthImage = &depthImage;
+		std::future<void> done = job.done.get_future();
+
+		{
+			std::lock_guard<std::mutex> queueLock(queueMutex);
+			jobQueue.push_back(&job);
+		}
+		queueCond.notify_one();
+		done.wait();
+	}
+
+}// namespace
@@ -0,0 +1,19 @@
+#ifndef DEPTH_RENDERER
+#define DEPTH_RENDERER
+
+#include <common_io.h>
+
+// The depth_sim renderer keeps a single GLUT window and scene, and its GL context is only
+// current on the thread that created it. All rendering is therefore funneled through one
+// thread that owns the context, so that requests served concurrently can render safely.
+namespace depth_renderer{
+
+	// creates the GL context on a dedicated render thread
+	void start();
+	void stop();
+
+	// renders the depth image of a mesh (world frame) seen from camPose; blocks until done
+	void renderMesh(pcl::PolygonMesh::Ptr mesh, Eigen::Matrix4f camPose, cv::Mat &depthImage, std::string path);
+
+}// namespace
+#endif
@@ -1,4 +1,5 @@
 #include <common_io.h>
+#include <depth_codec.h>
 
 int numBinsEMD = 20;
 
@@ -42,52 +43,26 @@ namespace utilities{
 	}
 
 	/********************************* function: readDepthImage ********************************************
+	rotateBits: the depth is stored with the bits rotated by 3 (APC dataset)
 	*******************************************************************************************************/
 
-	void readDepthImage(cv::Mat &depthImg, std::string path){
+	void readDepthImage(cv::Mat &depthImg, std::string path, bool rotateBits){
 		std::cout << path << std::endl;
-		cv::Mat depthImgRaw = cv::imread(path, CV_16UC1);
-		depthImg = cv::Mat::zeros(depthImgRaw.rows, depthImgRaw.cols, CV_32FC1);
-		for(int u=0; u<depthImgRaw.rows; u++)
-			for(int v=0; v<depthImgRaw.cols; v++){
-				unsigned short depthShort = depthImgRaw.at<unsigned short>(u,v);
-
-				//TODO: need to manually uncomment for APC objects
-				depthShort = (depthShort << 13 | depthShort >> 3);
-				
-				float depth = (float)depthShort/10000;
-				depthImg.at<float>(u, v) = depth;
-			}
+		depth_codec::readImage(path, depthImg, rotateBits);
 	}
 
 	/********************************* function: readProbImage ********************************************
 	*******************************************************************************************************/
 
 	void readProbImage(cv::Mat &probImg, std::string path){
-		cv::Mat depthImgRaw = cv::imread(path, CV_16UC1);
-		probImg = cv::Mat::zeros(depthImgRaw.rows, depthImgRaw.cols, CV_32FC1);
-		for(int u=0; u<depthImgRaw.rows; u++)
-			for(int v=0; v<depthImgRaw.cols; v++){
-				unsigned short depthShort = depthImgRaw.at<unsigned short>(u,v);
-				
-				float depth = (float)depthShort/10000;
-				probImg.at<float>(u, v) = depth;
-			}
+		depth_codec::readImage(path, probImg, false);
 	}
 	
 	/********************************* function: writeDepthImage *******************************************
 	*******************************************************************************************************/
 
 	void writeDepthImage(cv::Mat &depthImg, std::string path){
-		cv::Mat depthImgRaw = cv::Mat::zeros(depthImg.rows, depthImg.cols, CV_16UC1);
-		for(int u=0; u<depthImg.rows; u++)
-			for(int v=0; v<depthImg.cols; v++){
-				float depth = depthImg.at<float>(u,v)*10000;
-				unsigned short depthShort = (unsigned short)depth;
-				// depthShort = (depthShort << 3 | depthShort >> 13);
-				depthImgRaw.at<unsigned short>(u, v) = depthShort;
-			}
-		cv::imwrite(path, depthImgRaw);
+		depth_codec::writeImage(path, depthImg, false);
 	}
 
 	/********************************* function: writeClassImage *******************************************
@@ -270,6 +245,70 @@ namespace utilities{
 		return;
 	}
 
+	/********************************* function: decimateMesh **********************************************
+	Vertex clustering: the vertices falling in one cell of size cellSize are merged into their mean and
+	the polygons collapsing below 3 vertices are dropped. Only the xyz fields are kept, the renderer
+	does not need the texture. Returns the largest distance a vertex moved.
+	*******************************************************************************************************/
+
+	float decimateMesh(const pcl::PolygonMesh &mesh_in, float cellSize, pcl::PolygonMesh &mesh_out){
+		PointCloud::Ptr cloud_in (new PointCloud);
+		PointCloud::Ptr cloud_out (new PointCloud);
+		pcl::fromPCLPointCloud2(mesh_in.cloud, *cloud_in);
+
+		mesh_out.header = mesh_in.header;
+		if(cellSize <= 0){
+			pcl::toPCLPointCloud2(*cloud_in, mesh_out.cloud);
+			mesh_out.polygons = mesh_in.polygons;
+			return 0;
+		}
+
+		// 21 bits per cell coordinate
+		std::map<long long, int> cellIndex;
+		std::vector<int> vertexCluster(cloud_in->points.size());
+		std::vector<int> clusterSize;
+		for(int ii=0; ii<cloud_in->points.size(); ii++){
+			const pcl::PointXYZ &pt = cloud_in->points[ii];
+			long long key = 0;
+			for(int kk=0; kk<3; kk++)
+				key = (key << 21) | ((long long)(std::floor(pt.data[kk] / cellSize) + (1 << 20)) & ((1 << 21) - 1));
+
+			std::map<long long, int>::iterator it = cellIndex.find(key);
+			if(it == cellIndex.end()){
+				it = cellIndex.insert(std::make_pair(key, int(cloud_out->points.size()))).first;
+				cloud_out->points.push_back(pcl::PointXYZ(0, 0, 0));
+				clusterSize.push_back(0);
+			}
+			vertexCluster[ii] = it->second;
+			cloud_out->points[it->second].getVector3fMap() += pt.getVector3fMap();
+			clusterSize[it->second]++;
+		}
+		for(int ii=0; ii<cloud_out->points.size(); ii++)
+			cloud_out->points[ii].getVector3fMap() /= clusterSize[ii];
+		cloud_out->width = cloud_out->points.size();
+		cloud_out->height = 1;
+
+		float maxShift = 0;
+		for(int ii=0; ii<cloud_in->points.size(); ii++)
+			maxShift = std::max(maxShift, (cloud_in->points[ii].getVector3fMap() - 
+				cloud_out->points[vertexCluster[ii]].getVector3fMap()).norm());
+
+		mesh_out.polygons.clear();
+		for(int ii=0; ii<mesh_in.polygons.size(); ii++){
+			pcl::Vertices poly;
+			const std::vector<uint32_t> &vertices = mesh_in.polygons[ii].vertices;
+			for(int jj=0; jj<vertices.size(); jj++){
+				uint32_t idx = vertexCluster[vertices[jj]];
+				if(std::find(poly.vertices.begin(), poly.vertices.end(), idx) == poly.vertices.end())
+					poly.vertices.push_back(idx);
+			}
+			if(poly.vertices.size() >= 3)
+				mesh_out.polygons.push_back(poly);
+		}
+		pcl::toPCLPointCloud2(*cloud_out, mesh_out.cloud);
+		return maxShift;
+	}
+
 	/********************************* function: convertToMatrix *******************************************
 	*******************************************************************************************************/
 
@@ -836,6 +875,35 @@ namespace utilities{
 						   T(2, 0), T(2, 1), T(2, 2), T(2, 3), 
 						   0, 0, 0, 1;
      }
+
+	/********************************* function: readMemoryUsage *******************************************
+	Current and peak resident set size of the process in kB (VmRSS and VmHWM of /proc/self/status)
+	*******************************************************************************************************/
+
+	bool readMemoryUsage(long &rssKB, long &peakRssKB){
+		rssKB = peakRssKB = 0;
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while(std::getline(status, line)){
+			if(!line.compare(0, 6, "VmRSS:"))
+				rssKB = atol(line.c_str() + 6);
+			else if(!line.compare(0, 6, "VmHWM:"))
+				peakRssKB = atol(line.c_str() + 6);
+		}
+		return rssKB > 0;
+	}
+
+	/********************************* function: sampleMemoryUsage *****************************************
+	Raises maxRssKB to the current resident set size. Sampled by a request in its own thread, unlike
+	VmHWM which is shared by all the requests of the process; the resident set itself is process wide.
+	*******************************************************************************************************/
+
+	void sampleMemoryUsage(long &maxRssKB){
+		long rssKB, peakRssKB;
+		if(readMemoryUsage(rssKB, peakRssKB))
+			maxRssKB = std::max(maxRssKB, rssKB);
+	}
+
 	/********************************* end of functions ****************************************************
 	*******************************************************************************************************/
 
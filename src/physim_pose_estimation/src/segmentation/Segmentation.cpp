@@ -1,10 +1,15 @@
 #include <Segmentation.hpp>
+#include <unordered_map>
 
 #include <rcnn_detection_package/UpdateActiveListFrame.h>
 #include <rcnn_detection_package/UpdateBbox.h>
 
 #include <fcn_segmentation_package/UpdateActiveListFrame.h>
 #include <fcn_segmentation_package/UpdateSeg.h>
+#include <fcn_segmentation_package/SegmentScene.h>
+
+#include <cv_bridge/cv_bridge.h>
+#include <sensor_msgs/image_encodings.h>
 
 namespace segmentation{
   
@@ -17,6 +22,87 @@ namespace segmentation{
   *******************************************************************************************************/
   Segmentation::~Segmentation(){
     
+  }
+
+  /********************************* function: setBoxSegment *********************************************
+  The object covers its whole detection box, with probability one
+  *******************************************************************************************************/
+
+  static void setBoxSegment(scene_cfg::SceneCfg *sCfg, scene_cfg::SceneObjects *sceneObj, cv::Rect box){
+    box &= cv::Rect(0, 0, sCfg->colorImage.cols, sCfg->colorImage.rows);
+    sceneObj->maskBox = box;
+    sceneObj->objMask = cv::Mat::ones(box.height, box.width, CV_8UC1);
+    sceneObj->probBox = box;
+    sceneObj->probImage = cv::Mat::ones(box.height, box.width, CV_32FC1);
+  }
+
+  /********************************* function: writeProbImage ********************************************
+  Full frame 16 bit png of the probability map, for the debug output
+  *******************************************************************************************************/
+
+  static void writeProbImage(scene_cfg::SceneCfg *sCfg, scene_cfg::SceneObjects *sceneObj){
+    cv::Mat probImage = cv::Mat::zeros(sCfg->colorImage.rows, sCfg->colorImage.cols, CV_16UC1);
+    if(sceneObj->probBox.area() > 0){
+      cv::Mat probBox = probImage(sceneObj->probBox);
+      sceneObj->probImage.convertTo(probBox, CV_16UC1, 10000);
+    }
+    cv::imwrite(sCfg->ctx->super4PCSDir + sceneObj->pObject->objName + ".png", probImage);
+  }
+
+  /********************************* function: demuxLabelImage *******************************************
+  Splits a label image into the masks of all the scene objects in a single pass. A lookup table
+  maps the label to the object, the pixels of each object are collected as row runs and its
+  mask is then filled over the bounding box of the runs. Objects of the same class share it.
+  *******************************************************************************************************/
+
+  template <typename LabelType>
+  static void demuxLabelImage(const cv::Mat &labels, scene_cfg::SceneCfg *sCfg){
+    int numLabels = 0;
+    for(int ii=0; ii<sCfg->numObjects; ii++)
+      numLabels = std::max(numLabels, sCfg->pSceneObjects[ii]->pObject->objIdx + 1);
+
+    std::vector<int> labelToObject(numLabels, -1);
+    for(int ii=0; ii<sCfg->numObjects; ii++){
+      int objIdx = sCfg->pSceneObjects[ii]->pObject->objIdx;
+      if(objIdx >= 0 && labelToObject[objIdx] < 0)
+        labelToObject[objIdx] = ii;
+    }
+
+    // runs of every object: row, first column, last column + 1
+    std::vector<std::vector<cv::Vec3i> > runs(sCfg->numObjects);
+    for(int u=0; u<labels.rows; u++){
+      const LabelType *labelRow = labels.ptr<LabelType>(u);
+      int v = 0;
+      while(v < labels.cols){
+        int label = labelRow[v];
+        int start = v;
+        while(v < labels.cols && labelRow[v] == label)
+          v++;
+        if(label < numLabels && labelToObject[label] >= 0)
+          runs[labelToObject[label]].push_back(cv::Vec3i(u, start, v));
+      }
+    }
+
+    for(int ii=0; ii<sCfg->numObjects; ii++){
+      scene_cfg::SceneObjects *sceneObj = sCfg->pSceneObjects[ii];
+      int objIdx = sceneObj->pObject->objIdx;
+      if(objIdx < 0 || runs[labelToObject[objIdx]].empty())
+        continue;
+
+      const std::vector<cv::Vec3i> &objRuns = runs[labelToObject[objIdx]];
+      cv::Point tl(labels.cols, objRuns.front()[0]), br(0, objRuns.back()[0] + 1);
+      for(int jj=0; jj<objRuns.size(); jj++){
+        tl.x = std::min(tl.x, objRuns[jj][1]);
+        br.x = std::max(br.x, objRuns[jj][2]);
+      }
+
+      sceneObj->maskBox = cv::Rect(tl, br);
+      sceneObj->objMask = cv::Mat::zeros(br.y - tl.y, br.x - tl.x, CV_8UC1);
+      for(int jj=0; jj<objRuns.size(); jj++){
+        uchar *maskRow = sceneObj->objMask.ptr<uchar>(objRuns[jj][0] - tl.y);
+        std::fill(maskRow + objRuns[jj][1] - tl.x, maskRow + objRuns[jj][2] - tl.x, 1);
+      }
+    }
   }
 
 	/********************************* function: compute2dSegment ******************************************
@@ -42,12 +128,13 @@ namespace segmentation{
 
     	// Calling R-CNN
     	boxsrv.request.scene_path = sCfg->scenePath;
+    	boxsrv.request.output_path = sCfg->ctx->super4PCSDir;
     	if (clientbox.call(boxsrv)){
       		for(int ii=0; ii<sCfg->numObjects; ii++){
         		cv::Rect box = cv::Rect(boxsrv.response.tl_x[ii], boxsrv.response.tl_y[ii], 
         										        boxsrv.response.br_x[ii] - boxsrv.response.tl_x[ii],
                     				        boxsrv.response.br_y[ii] - boxsrv.response.tl_y[ii]);
-            sCfg->pSceneObjects[ii]->objMask(box) = 1.0;
+            setBoxSegment(sCfg, sCfg->pSceneObjects[ii], box);
           }
       }
       else{
@@ -76,15 +163,15 @@ namespace segmentation{
 
       // Calling R-CNN
       boxsrv.request.scene_path = sCfg->scenePath;
+      boxsrv.request.output_path = sCfg->ctx->super4PCSDir;
       if (clientbox.call(boxsrv)){
           for(int ii=0; ii<sCfg->numObjects; ii++){
             cv::Rect box = cv::Rect(boxsrv.response.tl_x[ii], boxsrv.response.tl_y[ii], 
                                     boxsrv.response.br_x[ii] - boxsrv.response.tl_x[ii],
                                     boxsrv.response.br_y[ii] - boxsrv.response.tl_y[ii]);
-            sCfg->pSceneObjects[ii]->objMask(box) = 1.0;
-            cv::Mat probImage = cv::Mat::zeros(sCfg->pSceneObjects[ii]->objMask.rows, sCfg->pSceneObjects[ii]->objMask.cols, CV_16UC1);
-            probImage(box) = 10000;
-            cv::imwrite(sCfg->scenePath + "debug_super4PCS/" + sCfg->pSceneObjects[ii]->pObject->objName + ".png", probImage);
+            setBoxSegment(sCfg, sCfg->pSceneObjects[ii], box);
+            if(sCfg->ctx->debugOutput)
+              writeProbImage(sCfg, sCfg->pSceneObjects[ii]);
           }
       }
       else{
@@ -113,21 +200,11 @@ namespace segmentation{
 
       // Calling FCN
       segsrv.request.scene_path = sCfg->scenePath;
+      segsrv.request.output_path = sCfg->ctx->super4PCSDir;
       if (clientbox.call(segsrv)){
         // use the argmax prediction
-        cv::Mat classImage = cv::imread(sCfg->scenePath + "debug_super4PCS/frame-000000.fcn.mask.png", -1);
-        int imgWidth = classImage.cols;
-        int imgHeight = classImage.rows;
-
-        for(int u=0; u<imgHeight; u++){
-          for(int v=0; v<imgWidth; v++) {
-            int classVal = classImage.at<unsigned short>(u,v);
-            for(int ii=0; ii<sCfg->numObjects; ii++){
-              if(sCfg->pSceneObjects[ii]->pObject->objIdx == classVal)
-                sCfg->pSceneObjects[ii]->objMask.at<float>(u,v) = 1.0;
-            }
-          }
-        }
+        cv::Mat classImage = cv::imread(sCfg->ctx->super4PCSDir + "frame-000000.fcn.mask.png", -1);
+        demuxLabelImage<unsigned short>(classImage, sCfg);
 
       }
       else{
@@ -136,105 +213,221 @@ namespace segmentation{
       }
   }
 
-  void FCNThresholdSegmentation::compute2dSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg){
-    ros::ServiceClient clientlist = gCfg->nh.serviceClient<fcn_segmentation_package::UpdateActiveListFrame>("/update_active_list_and_frame");
-    ros::ServiceClient clientbox = gCfg->nh.serviceClient<fcn_segmentation_package::UpdateSeg>("/handle_get_segments");
-    fcn_segmentation_package::UpdateActiveListFrame listsrv;
-    fcn_segmentation_package::UpdateSeg segsrv;
+  // converts the uint8 probability map of a /segment_scene response to CV_32FC1 in [0, 1],
+  // clipped to the image, and returns the image region it covers
+  static cv::Rect decodeProbMap(const sensor_msgs::Image &msg, int roiX, int roiY, cv::Size imgSize, cv::Mat &probImage){
+    cv_bridge::CvImageConstPtr cv_ptr = cv_bridge::toCvCopy(msg, sensor_msgs::image_encodings::MONO8);
+    cv::Rect roi = cv::Rect(roiX, roiY, cv_ptr->image.cols, cv_ptr->image.rows) & cv::Rect(cv::Point(0, 0), imgSize);
+    probImage.release();
+    if(roi.area() > 0)
+      cv_ptr->image(roi - cv::Point(roiX, roiY)).convertTo(probImage, CV_32FC1, 1.0/255);
+    return roi;
+  }
 
-    // Update object list
-    for(int ii=0; ii<sCfg->numObjects; ii++){
-      listsrv.request.active_list.push_back(sCfg->pSceneObjects[ii]->pObject->objIdx);
-      listsrv.request.active_frame = "000000";
-      if(clientlist.call(listsrv))
-        ROS_INFO("Segmentation::compute2dSegment, object: %d", ii+1);
-      else {
-        ROS_ERROR("Failed to call service UpdateActiveListFrame");
-        exit(1);
-      }
+  /********************************* function: compute2dSegment ******************************************
+  One /segment_scene call carries the active list and returns the probability maps, cropped to
+  their non-zero pixels, for every object and the background (last map). The maps and masks
+  stay in memory over their region, no png goes through the debug directory.
+  *******************************************************************************************************/
+
+  void FCNThresholdSegmentation::compute2dSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg){
+    ros::ServiceClient clientseg = gCfg->nh.serviceClient<fcn_segmentation_package::SegmentScene>("/segment_scene");
+    fcn_segmentation_package::SegmentScene segsrv;
+
+    for(int ii=0; ii<sCfg->numObjects; ii++)
+      segsrv.request.active_list.push_back(sCfg->pSceneObjects[ii]->pObject->objIdx);
+    segsrv.request.active_frame = "000000";
+    segsrv.request.scene_path = sCfg->scenePath;
+
+    // Calling FCN
+    if (!clientseg.call(segsrv) || !segsrv.response.result || segsrv.response.prob_maps.size() != (size_t)sCfg->numObjects + 1){
+      ROS_ERROR("Failed to call service SegmentScene");
+      exit(1);
     }
 
-      // Calling FCN
-      segsrv.request.scene_path = sCfg->scenePath;
-      if (clientbox.call(segsrv)){
-        for(int ii=0; ii<sCfg->numObjects; ii++){
-          cv::Mat probImage, bkgProbImg;
-          utilities::readProbImage(probImage, sCfg->scenePath + "debug_super4PCS/" + sCfg->pSceneObjects[ii]->pObject->objName + ".png");
-          utilities::readProbImage(bkgProbImg, sCfg->scenePath + "debug_super4PCS/background.png");
-          int imgWidth = probImage.cols;
-          int imgHeight = probImage.rows;
-
-          for(int u=0; u<imgHeight; u++){
-            for(int v=0; v<imgWidth; v++) {
-              float probVal = probImage.at<float>(u,v);
-              float bkgProb = bkgProbImg.at<float>(u,v);
-              if(probVal > 0 && bkgProb < 0.8)
-                sCfg->pSceneObjects[ii]->objMask.at<float>(u,v) = 1.0;
-              }
-          }
+    cv::Size imgSize(sCfg->colorImage.cols, sCfg->colorImage.rows);
+    cv::Mat bkgProbImg;
+    cv::Rect bkgBox = decodeProbMap(segsrv.response.prob_maps[sCfg->numObjects], segsrv.response.roi_x[sCfg->numObjects], 
+                                    segsrv.response.roi_y[sCfg->numObjects], imgSize, bkgProbImg);
 
-        }
-      }
-      else{
-        ROS_ERROR("Failed to call service UpdateSeg");
-        exit(1);
-      }
+    for(int ii=0; ii<sCfg->numObjects; ii++){
+      scene_cfg::SceneObjects *sceneObj = sCfg->pSceneObjects[ii];
+      sceneObj->probBox = decodeProbMap(segsrv.response.prob_maps[ii], segsrv.response.roi_x[ii], segsrv.response.roi_y[ii], 
+                                        imgSize, sceneObj->probImage);
+
+      // background probability over the object region, zero outside its own region
+      cv::Rect box = sceneObj->probBox;
+      cv::Mat bkgProb = cv::Mat::zeros(box.height, box.width, CV_32FC1);
+      cv::Rect common = box & bkgBox;
+      if(common.area() > 0)
+        bkgProbImg(common - bkgBox.tl()).copyTo(bkgProb(common - box.tl()));
+
+      sceneObj->maskBox = box;
+      if(box.area() > 0)
+        sceneObj->objMask = (sceneObj->probImage > 0) & (bkgProb < 0.8);
+
+      if(sCfg->ctx->debugOutput)
+        writeProbImage(sCfg, sceneObj);
+    }
   }
 
   /********************************* function: compute2dSegment ******************************************
   *******************************************************************************************************/
 
   void GTSegmentation::compute2dSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg){
-    for(int ii=0; ii<sCfg->numObjects; ii++){
-      cv::Mat classImage = cv::imread(sCfg->scenePath + "frame-000000.mask.png", -1);
-      cv::Mat probImage = cv::Mat::zeros(sCfg->pSceneObjects[ii]->objMask.rows, sCfg->pSceneObjects[ii]->objMask.cols, CV_16UC1);
-
-      int imgWidth = classImage.cols;
-      int imgHeight = classImage.rows;
-
-      for(int u=0; u<imgHeight; u++)
-        for(int v=0; v<imgWidth; v++){
-          int classVal = (int)classImage.at<uchar>(u,v);
-          if(sCfg->pSceneObjects[ii]->pObject->objIdx == classVal){
-            sCfg->pSceneObjects[ii]->objMask.at<float>(u,v) = 1.0;
-            probImage.at<unsigned short>(u,v) = 10000;
-          }
-        }
+    cv::Mat classImage = cv::imread(sCfg->scenePath + "frame-000000.mask.png", -1);
+    demuxLabelImage<uchar>(classImage, sCfg);
 
-      cv::imwrite(sCfg->scenePath + "debug_super4PCS/" + sCfg->pSceneObjects[ii]->pObject->objName + ".png", probImage);
+    for(int ii=0; ii<sCfg->numObjects; ii++){
+      scene_cfg::SceneObjects *sceneObj = sCfg->pSceneObjects[ii];
+      sceneObj->probBox = sceneObj->maskBox;
+      sceneObj->objMask.convertTo(sceneObj->probImage, CV_32FC1);
+      if(sCfg->ctx->debugOutput)
+        writeProbImage(sCfg, sceneObj);
     }
   }
 
   /********************************* function: compute3dSegment ******************************************
+  The objects are segmented concurrently, each one by its own thread
   *******************************************************************************************************/
 
-  void Segmentation::compute3dSegment(scene_cfg::SceneCfg *sCfg){
+  void Segmentation::compute3dSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg){
+    std::vector<std::thread> workers;
+    for(int ii=0; ii<sCfg->numObjects; ii++)
+      workers.push_back(std::thread(&Segmentation::computeObjectSegment, this, gCfg, sCfg, ii));
+    for(int ii=0; ii<workers.size(); ii++)
+      workers[ii].join();
+  }
 
-    for(int ii=0; ii<sCfg->numObjects; ii++){
-      cv::Mat objDepth = sCfg->depthImage.mul(sCfg->pSceneObjects[ii]->objMask);
-      
-      utilities::writeDepthImage(objDepth, sCfg->scenePath + "debug_search/" + sCfg->pSceneObjects[ii]->pObject->objName + ".png");
+  // sums of the points of a 1cm voxel
+  struct VoxelSum{
+    Eigen::Vector3f pos;
+    Eigen::Vector3f colour;
+    Eigen::Vector3f normal;
+    int count;
+  };
+
+  /********************************* function: computeObjectSegment **************************************
+  Back-projects the masked depth inside the box of the mask, averages the points of
+  each 1cm voxel and estimates unit normals oriented towards the camera. The voxel average
+  and the normal orientation are done in the same pass as the back-projection. With the
+  "INTEGRAL_IMAGE" normals (~segment_normals), the normals are estimated on the organized box
+  before the pass and averaged per voxel, otherwise MLS runs on the voxel averages.
+  *******************************************************************************************************/
 
-      PointCloudRGB::Ptr segment = PointCloudRGB::Ptr(new PointCloudRGB);
-      utilities::convert3dUnOrganizedRGB(objDepth, sCfg->colorImage, sCfg->camIntrinsic, segment);
+  void Segmentation::computeObjectSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg, int objIdx){
+    scene_cfg::SceneObjects *sceneObj = sCfg->pSceneObjects[objIdx];
+    const float leafSize = 0.01;
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    sceneObj->pclSegment = pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBNormal>);
 
-      clock_t t0 = clock();
-      sCfg->pSceneObjects[ii]->pclSegment = pcl::PointCloud<pcl::PointXYZRGBNormal>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBNormal>);
+    cv::Rect box = sceneObj->maskBox;
 
-      copyPointCloud(*segment, *sCfg->pSceneObjects[ii]->pclSegment);
+    if(sCfg->ctx->debugOutput){
+      cv::Mat objDepth = cv::Mat::zeros(sCfg->depthImage.rows, sCfg->depthImage.cols, CV_32FC1);
+      if(box.area() > 0){
+        cv::Mat objDepthBox = objDepth(box);
+        sCfg->depthImage(box).copyTo(objDepthBox, sceneObj->objMask);
+      }
+      utilities::writeDepthImage(objDepth, sCfg->ctx->searchDir + sceneObj->pObject->objName + ".png");
+    }
 
-      // pcl::NormalEstimation<pcl::PointXYZRGB, pcl::PointXYZRGBNormal> ne;
-      // pcl::search::KdTree<pcl::PointXYZRGB>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZRGB> ());
-      // ne.setInputCloud (segment);
-      // ne.setSearchMethod (tree);
-      // ne.setRadiusSearch (0.005);
-      // ne.setViewPoint (0, 0, 0);
-      // ne.compute (*sCfg->pSceneObjects[ii]->pclSegment);
+    std::unordered_map<int64_t, int> voxelIndex;
+    std::vector<VoxelSum> voxels;
+    auto addPoint = [&](const pcl::PointXYZRGB &pt, const Eigen::Vector3f &normal){
+      int64_t key = 0;
+      for(int dim=0; dim<3; dim++)
+        key = (key << 21) | ((int64_t)floor(pt.data[dim]/leafSize) & 0x1FFFFF);
+      auto it = voxelIndex.insert(std::make_pair(key, (int)voxels.size()));
+      if(it.second){
+        VoxelSum empty = {Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero(), 0};
+        voxels.push_back(empty);
+      }
+      VoxelSum &voxel = voxels[it.first->second];
+      voxel.pos += pt.getVector3fMap();
+      voxel.colour += Eigen::Vector3f(pt.r, pt.g, pt.b);
+      voxel.normal += normal;
+      voxel.count++;
+    };
+
+    bool integralNormals = !gCfg->segmentNormals.compare("INTEGRAL_IMAGE");
+    PointCloudRGB::Ptr boxCloud(new PointCloudRGB);
+    if(integralNormals){
+      pcl::PointXYZRGB invalid;
+      invalid.x = invalid.y = invalid.z = std::numeric_limits<float>::quiet_NaN();
+      boxCloud->width = box.width;
+      boxCloud->height = box.height;
+      boxCloud->is_dense = false;
+      boxCloud->points.assign(box.width*box.height, invalid);
+    }
 
-      pcl::VoxelGrid<pcl::PointXYZRGB> sor;
-      sor.setInputCloud (segment);
-      sor.setLeafSize (0.01, 0.01, 0.01);
-      sor.filter (*segment);
+    for(int u=box.y; u<box.y + box.height; u++){
+      const uchar *maskRow = sceneObj->objMask.ptr<uchar>(u - box.y);
+      for(int v=box.x; v<box.x + box.width; v++){
+        float depth = sCfg->depthImage.at<float>(u,v);
+        if(maskRow[v - box.x] && depth > 0.1 && depth < 2.0){
+          cv::Vec3b colour = sCfg->colorImage.at<cv::Vec3b>(u,v);
+          pcl::PointXYZRGB pt;
+          pt.x = (float)((v - sCfg->camIntrinsic(0,2)) * depth / sCfg->camIntrinsic(0,0));
+          pt.y = (float)((u - sCfg->camIntrinsic(1,2)) * depth / sCfg->camIntrinsic(1,1));
+          pt.z = depth;
+          pt.r = colour.val[2];
+          pt.g = colour.val[1];
+          pt.b = colour.val[0];
+          if(integralNormals)
+            boxCloud->at(v - box.x, u - box.y) = pt;
+          else
+            addPoint(pt, Eigen::Vector3f::Zero());
+        }
+      }
+    }
+
+    if(integralNormals && box.area() > 0){
+      pcl::PointCloud<pcl::Normal>::Ptr boxNormals(new pcl::PointCloud<pcl::Normal>);
+      pcl::IntegralImageNormalEstimation<pcl::PointXYZRGB, pcl::Normal> ne;
+      ne.setNormalEstimationMethod (ne.AVERAGE_3D_GRADIENT);
+      ne.setMaxDepthChangeFactor (0.02f);
+      ne.setNormalSmoothingSize (10.0f);
+      ne.setInputCloud (boxCloud);
+      ne.compute (*boxNormals);
+
+      // points without a normal, at depth discontinuities, are dropped
+      for(int ii=0; ii<boxCloud->points.size(); ii++){
+        const pcl::Normal &n = boxNormals->points[ii];
+        if(!pcl::isFinite(boxCloud->points[ii]) || !std::isfinite(n.normal_x) || 
+            !std::isfinite(n.normal_y) || !std::isfinite(n.normal_z))
+          continue;
+        Eigen::Vector3f normal(n.normal_x, n.normal_y, n.normal_z);
+        if(normal.dot(boxCloud->points[ii].getVector3fMap()) > 0)
+          normal = -normal;
+        addPoint(boxCloud->points[ii], normal);
+      }
+    }
+
+    PointCloudRGB::Ptr segment(new PointCloudRGB);
+    for(int ii=0; ii<voxels.size(); ii++){
+      const VoxelSum &voxel = voxels[ii];
+      pcl::PointXYZRGBNormal pt;
+      pt.getVector3fMap() = voxel.pos / (float)voxel.count;
+      Eigen::Vector3f colour = voxel.colour / (float)voxel.count;
+      pt.r = (uint8_t)(colour[0] + 0.5);
+      pt.g = (uint8_t)(colour[1] + 0.5);
+      pt.b = (uint8_t)(colour[2] + 0.5);
+      if(integralNormals){
+        pt.getNormalVector3fMap() = voxel.normal.normalized();
+        sceneObj->pclSegment->points.push_back(pt);
+      }
+      else{
+        pcl::PointXYZRGB segPt;
+        segPt.getVector3fMap() = pt.getVector3fMap();
+        segPt.rgba = pt.rgba;
+        segment->points.push_back(segPt);
+      }
+    }
+
+    if(!integralNormals && segment->points.size() > 0){
+      segment->width = segment->points.size();
+      segment->height = 1;
 
       pcl::search::KdTree<pcl::PointXYZRGB>::Ptr tree (new pcl::search::KdTree<pcl::PointXYZRGB>);
       pcl::MovingLeastSquares<pcl::PointXYZRGB, pcl::PointXYZRGBNormal> mls;
@@ -243,12 +436,21 @@ namespace segmentation{
       mls.setPolynomialFit (true);
       mls.setSearchMethod (tree);
       mls.setSearchRadius (0.02);
-      mls.process (*sCfg->pSceneObjects[ii]->pclSegment);
+      mls.process (*sceneObj->pclSegment);
 
-      std::cout << "number of points: " << segment->points.size() <<std::endl;
-      std::cout << "Time after normal estimation: " << float( clock () - t0 ) /  CLOCKS_PER_SEC << std::endl;
+      for(int ii=0; ii<sceneObj->pclSegment->points.size(); ii++){
+        pcl::PointXYZRGBNormal &pt = sceneObj->pclSegment->points[ii];
+        if(pt.getNormalVector3fMap().dot(pt.getVector3fMap()) > 0)
+          pt.getNormalVector3fMap() = -pt.getNormalVector3fMap();
+        pt.getNormalVector3fMap().normalize();
+      }
     }
+    sceneObj->pclSegment->width = sceneObj->pclSegment->points.size();
+    sceneObj->pclSegment->height = 1;
 
+    std::cout << "number of points: " << voxels.size() <<std::endl;
+    std::cout << "Time after normal estimation: " << 
+      std::chrono::duration<float>(std::chrono::steady_clock::now() - t0).count() << std::endl;
   }
 
   /********************************* end of functions ****************************************************
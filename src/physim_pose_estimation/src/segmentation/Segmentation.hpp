@@ -10,9 +10,12 @@ namespace segmentation{
 	class Segmentation{
 	public:
 		Segmentation();
-		~Segmentation();
-		void compute3dSegment(scene_cfg::SceneCfg *sCfg);
+		virtual ~Segmentation();
+		void compute3dSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg);
 		virtual void compute2dSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg){}
+
+	private:
+		void computeObjectSegment(GlobalCfg *gCfg, scene_cfg::SceneCfg *sCfg, int objIdx);
 	};
 
 	class RCNNSegmentation: public Segmentation {